@@ -0,0 +1,419 @@
+// bench.cpp
+// End-to-end benchmark of MoonshineModel::generate() that writes the same JSON report as whisper-bench-e2e,
+// so the two engines can be compared file by file.
+#include <moonshine.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sndfile.h>
+#include <sys/resource.h>
+
+using json = nlohmann::ordered_json;
+
+const int SAMPLE_RATE = 16000;
+const int MAX_CHUNK_SAMPLES = SAMPLE_RATE * 30;  // the longest input generate() is fed at once
+
+struct BenchParams
+{
+    std::string models_dir = "model/base";
+    std::string output;
+    std::vector<std::string> files;
+    std::vector<int> n_threads = {4};
+    std::string precision = "fp32";  // one precision, or encode,uncached_decode,cached_decode
+    int n_repeat = 1;
+    int step_ms = 400;      // partial refresh cadence of moonshine_live
+    int length_ms = 5000;   // longest segment of moonshine_live
+    int bucket_ms = 0;      // pad inputs up to length_ms to multiples of this (0 - off)
+    bool no_stream = false;
+    double threshold = 0.05;
+    std::vector<std::string> compare;
+};
+
+struct StreamResult
+{
+    double t_compute_s = 0.0;  // sum of the per-refresh compute times
+    double upl_s = 0.0;        // average user-perceived latency
+    int n_steps = 0;
+};
+
+void printUsage(const char *argv0, const BenchParams &params)
+{
+    std::cerr << "Usage: " << argv0 << " [options] <wav_file> [<wav_file> ...]\n"
+              << "       " << argv0 << " --compare <base.json> <new.json> [--threshold F]\n\n"
+              << "Options:\n"
+              << "  -m DIR        models directory (default: " << params.models_dir << ")\n"
+              << "  -t N,...      comma-separated intra-op thread counts (default: 4)\n"
+              << "  -r N          runs per file, the fastest one is reported (default: " << params.n_repeat << ")\n"
+              << "  -p P[,P,P]    precision of all sessions, or of encode,uncached_decode,cached_decode:\n"
+              << "                fp32, int8 or qdq (default: " << params.precision << ", see scripts/quantize_onnx.py)\n"
+              << "  -o FILE       write the JSON report to FILE instead of stdout\n"
+              << "  --step N      streaming simulation: refresh interval in ms (default: " << params.step_ms << ")\n"
+              << "  --length N    streaming simulation: maximum segment length in ms (default: " << params.length_ms << ")\n"
+              << "  --bucket N    pad inputs up to --length to multiples of N ms, can change the transcript,\n"
+              << "                see MoonshineModel::set_buckets()\n"
+              << "                (default: " << params.bucket_ms << " - off)\n"
+              << "  --no-stream   skip the streaming simulation (no sRTF / UPL)\n"
+              << "  --threshold F relative increase that counts as a regression (default: " << params.threshold << ")\n";
+}
+
+std::vector<int> parseIntList(const std::string &s)
+{
+    std::vector<int> res;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        res.push_back(std::stoi(item));
+    }
+    return res;
+}
+
+MoonshineModel::Profile parseProfile(const std::string &s)
+{
+    std::vector<MoonshineModel::Precision> res;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        res.push_back(MoonshineModel::parse_precision(item));
+    }
+    if (res.size() == 1) return MoonshineModel::Profile::all(res[0]);
+    if (res.size() != 3) throw std::invalid_argument("Expected 1 or 3 precisions: " + s);
+    return {res[0], res[1], res[2]};
+}
+
+std::vector<float> readWavFile(const std::string &filename)
+{
+    SF_INFO sfinfo;
+    SNDFILE *file = sf_open(filename.c_str(), SFM_READ, &sfinfo);
+
+    if (!file)
+    {
+        throw std::runtime_error("Error opening file " + filename);
+    }
+
+    std::vector<float> buffer(sfinfo.frames * sfinfo.channels);
+    sf_readf_float(file, buffer.data(), sfinfo.frames);
+    sf_close(file);
+
+    // downmix to mono
+    if (sfinfo.channels > 1)
+    {
+        std::vector<float> mono(sfinfo.frames);
+        for (sf_count_t i = 0; i < sfinfo.frames; ++i)
+        {
+            float sum = 0.0f;
+            for (int c = 0; c < sfinfo.channels; ++c) sum += buffer[i * sfinfo.channels + c];
+            mono[i] = sum / (float)sfinfo.channels;
+        }
+        return mono;
+    }
+    return buffer;
+}
+
+// Peak resident set size of the process in kB
+int64_t getPeakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (int64_t)usage.ru_maxrss / 1024;
+#else
+    return (int64_t)usage.ru_maxrss;
+#endif
+}
+
+double timeS()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+std::string baseName(const std::string &path)
+{
+    const size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+// Transcribe the whole file in 30 s chunks, as moonshine_file does
+void transcribeFile(MoonshineModel &model, const std::vector<float> &audio)
+{
+    for (size_t i = 0; i < audio.size(); i += MAX_CHUNK_SAMPLES)
+    {
+        std::vector<float> chunk(audio.begin() + (long)i,
+                                 audio.begin() + (long)std::min(i + MAX_CHUNK_SAMPLES, audio.size()));
+        model.generate(chunk);
+    }
+}
+
+// Replay the audio the way moonshine_live consumes a live source: the current segment is re-transcribed every
+// step_ms and closed once it reaches length_ms. The latency of a step is measured from the middle of the step to
+// the end of its transcription, on a virtual clock, so a slow device accumulates a backlog as it would live.
+StreamResult simulateStream(MoonshineModel &model, const std::vector<float> &audio,
+                            const BenchParams &params)
+{
+    const size_t n_step = (size_t)params.step_ms * SAMPLE_RATE / 1000;
+    const size_t n_len = (size_t)params.length_ms * SAMPLE_RATE / 1000;
+
+    StreamResult res;
+    double t_clock = 0.0;
+    double upl_sum = 0.0;
+
+    size_t seg_beg = 0;
+    for (size_t end = std::min(n_step, audio.size());; end = std::min(end + n_step, audio.size()))
+    {
+        std::vector<float> segment(audio.begin() + (long)seg_beg, audio.begin() + (long)end);
+
+        const double t0 = timeS();
+        model.generate(segment);
+        const double t_compute = timeS() - t0;
+
+        const double t_arrive = (double)end / SAMPLE_RATE;
+        const double t_chunk = (double)std::min(n_step, end) / SAMPLE_RATE;
+
+        t_clock = std::max(t_clock, t_arrive) + t_compute;
+        upl_sum += t_clock - (t_arrive - 0.5 * t_chunk);
+        res.t_compute_s += t_compute;
+        res.n_steps++;
+
+        if (end == audio.size()) break;
+        if (end - seg_beg >= n_len) seg_beg = end;
+    }
+
+    res.upl_s = res.n_steps > 0 ? upl_sum / res.n_steps : 0.0;
+    return res;
+}
+
+int runCompare(const BenchParams &params)
+{
+    json base;
+    json curr;
+    try
+    {
+        std::ifstream fin_base(params.compare[0]);
+        std::ifstream fin_curr(params.compare[1]);
+        fin_base >> base;
+        fin_curr >> curr;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: failed to read reports: " << e.what() << "\n";
+        return 1;
+    }
+
+    // lower is better for all of these
+    // the peak RSS is not compared, it is a single value of the whole process (see the report)
+    const char *metrics[] = {"rtf",         "srtf",        "upl_s",      "t_mel_us",
+                             "t_preprocess_us", "t_encode_us", "t_decode_us"};
+
+    int n_regress = 0;
+    int n_matched = 0;
+    for (const auto &rc : curr["results"])
+    {
+        for (const auto &rb : base["results"])
+        {
+            if (rb["file"] != rc["file"] || rb["n_threads"] != rc["n_threads"]) continue;
+
+            n_matched++;
+            for (const char *m : metrics)
+            {
+                if (!rb.contains(m) || !rc.contains(m)) continue;
+
+                const double vb = rb[m].get<double>();
+                const double vc = rc[m].get<double>();
+                if (vb <= 0.0) continue;
+
+                const double change = vc / vb - 1.0;
+                const bool regress = change > params.threshold;
+                n_regress += regress;
+
+                std::cout << rc["file"].get<std::string>() << " t=" << rc["n_threads"].get<int>()
+                          << " " << m << ": " << vb << " -> " << vc << " (" << (change >= 0 ? "+" : "")
+                          << 100.0 * change << "%)" << (regress ? "  REGRESSION" : "") << "\n";
+            }
+            break;
+        }
+    }
+
+    std::cout << "\n"
+              << n_matched << " matched results, " << n_regress << " regressions above "
+              << 100.0 * params.threshold << "%\n";
+    return n_regress > 0 ? 2 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchParams params;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (arg == "-h" || arg == "--help")
+        {
+            printUsage(argv[0], params);
+            return 0;
+        }
+        else if (arg == "-m" && has_value) params.models_dir = argv[++i];
+        else if (arg == "-t" && has_value) params.n_threads = parseIntList(argv[++i]);
+        else if (arg == "-r" && has_value) params.n_repeat = std::stoi(argv[++i]);
+        else if (arg == "-p" && has_value) params.precision = argv[++i];
+        else if (arg == "-o" && has_value) params.output = argv[++i];
+        else if (arg == "--step" && has_value) params.step_ms = std::stoi(argv[++i]);
+        else if (arg == "--length" && has_value) params.length_ms = std::stoi(argv[++i]);
+        else if (arg == "--bucket" && has_value) params.bucket_ms = std::stoi(argv[++i]);
+        else if (arg == "--no-stream") params.no_stream = true;
+        else if (arg == "--threshold" && has_value) params.threshold = std::stod(argv[++i]);
+        else if (arg == "--compare" && i + 2 < argc)
+        {
+            params.compare = {argv[i + 1], argv[i + 2]};
+            i += 2;
+        }
+        else if (arg[0] != '-') params.files.push_back(arg);
+        else
+        {
+            printUsage(argv[0], params);
+            return 1;
+        }
+    }
+
+    if (params.compare.size() == 2) return runCompare(params);
+
+    if (params.files.empty())
+    {
+        printUsage(argv[0], params);
+        return 1;
+    }
+
+    json report;
+    report["engine"] = "moonshine.cpp";
+    report["model"] = baseName(params.models_dir);
+    report["precision"] = params.precision;
+    report["bucket_ms"] = params.bucket_ms;
+    report["results"] = json::array();
+
+    try
+    {
+        for (const int n_threads : params.n_threads)
+        {
+            const double t_load_beg = timeS();
+            MoonshineModel model(params.models_dir, n_threads, parseProfile(params.precision));
+            const double t_load_s = timeS() - t_load_beg;
+
+            if (params.bucket_ms > 0)
+            {
+                std::vector<size_t> buckets;
+                for (int ms = params.bucket_ms; ms <= params.length_ms; ms += params.bucket_ms)
+                {
+                    buckets.push_back((size_t)ms * SAMPLE_RATE / 1000);
+                }
+                model.set_buckets(buckets);
+            }
+
+            // warm up the sessions so the first file is not charged for lazy initialization
+            model.generate(std::vector<float>(SAMPLE_RATE, 0.0f));
+
+            for (const auto &fname : params.files)
+            {
+                const std::vector<float> audio = readWavFile(fname);
+                const double audio_s = (double)audio.size() / SAMPLE_RATE;
+
+                double t_best = -1.0;
+                MoonshineModel::Timings timings;
+                for (int r = 0; r < params.n_repeat; ++r)
+                {
+                    model.reset_timings();
+                    const double t0 = timeS();
+                    transcribeFile(model, audio);
+                    const double t_run = timeS() - t0;
+                    if (t_best < 0.0 || t_run < t_best)
+                    {
+                        t_best = t_run;
+                        timings = model.timings();
+                    }
+                }
+
+                json res;
+                res["file"] = baseName(fname);
+                res["audio_s"] = audio_s;
+                res["n_threads"] = n_threads;
+                res["t_load_s"] = t_load_s;
+                res["t_total_s"] = t_best;
+                res["rtf"] = t_best / audio_s;
+
+                if (!params.no_stream)
+                {
+                    const StreamResult sr = simulateStream(model, audio, params);
+                    res["srtf"] = sr.t_compute_s / audio_s;
+                    res["upl_s"] = sr.upl_s;
+                    res["n_steps"] = sr.n_steps;
+                }
+
+                res["t_preprocess_us"] = timings.t_preprocess_us;
+                res["t_encode_us"] = timings.t_encode_us;
+                res["t_decode_us"] = timings.t_decode_us;
+
+                // preprocess + encode latency per padded length, of the last run and the streaming simulation
+                if (params.bucket_ms > 0)
+                {
+                    res["buckets"] = json::array();
+                    for (const auto &b : model.bucket_stats())
+                    {
+                        if (b.n_calls == 0) continue;
+                        json jb;
+                        jb["ms"] = (int64_t)b.n_samples * 1000 / SAMPLE_RATE;
+                        jb["n_calls"] = b.n_calls;
+                        jb["avg_ms"] = b.t_total_us / 1000.0 / b.n_calls;
+                        jb["max_ms"] = b.t_max_us / 1000.0;
+                        res["buckets"].push_back(jb);
+                    }
+                }
+
+                std::cerr << baseName(fname) << ": n_threads = " << n_threads
+                          << ", RTF = " << res["rtf"].get<double>();
+                if (!params.no_stream)
+                {
+                    std::cerr << ", sRTF = " << res["srtf"].get<double>()
+                              << ", UPL = " << res["upl_s"].get<double>() << " s";
+                }
+                std::cerr << "\n";
+
+                report["results"].push_back(res);
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    // the peak only grows within a process, so it is reported once for all results rather than per result
+    report["peak_rss_kb"] = getPeakRssKb();
+
+    const std::string out = report.dump(2);
+    if (params.output.empty())
+    {
+        std::cout << out << "\n";
+    }
+    else
+    {
+        std::ofstream fout(params.output);
+        if (!fout)
+        {
+            std::cerr << "Error: failed to open " << params.output << " for writing\n";
+            return 1;
+        }
+        fout << out << "\n";
+    }
+    return 0;
+}
@@ -1,6 +1,7 @@
 // live_transcription.cpp
 #define SDL_MAIN_HANDLED
 #include <moonshine.hpp>
+#include <silero_vad.hpp>
 #include <SDL.h>
 #include <iostream>
 #include <vector>
@@ -9,6 +10,8 @@
 #include <mutex>
 #include <csignal>
 #include <cmath>
+#include <filesystem>
+#include <memory>
 
 std::atomic<bool> running(true);
 void signalHandler(int signum) {
@@ -22,8 +25,10 @@ const int LOOKBACK_CHUNKS = 5;
 const size_t LOOKBACK_SAMPLES = LOOKBACK_CHUNKS * CHUNK_SIZE;
 const float MIN_REFRESH_SECS = 0.4f; // partial-refresh cadence
 const float MAX_SPEECH_SECS = 5.0f; // cap segment length
-const float VAD_START_THRESHOLD = 0.01f; // RMS threshold to consider speech start
+const int BUCKET_MS = 0; // pad the model input to a multiple of this (0 - off, see MoonshineModel::set_buckets())
+const float VAD_START_THRESHOLD = 0.01f; // RMS threshold to consider speech start (no VAD model)
 const int SILENCE_CHUNKS_TO_END = 10; // number of consecutive quiet chunks to mark end (~0.32s)
+static_assert(CHUNK_SIZE == SileroVad::CHUNK_SIZE, "chunks are fed to the VAD as they are");
 const size_t MIN_MODEL_SAMPLES = 1024; // ~64 ms
 
 // Thread-shared audio buffer (use deque for efficient pop_front)
@@ -81,9 +86,9 @@ float dummy_arr[SAMPLE_RATE];
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
-        std::cerr << "Usage: " << argv[0] << " <models_dir>\n";
+        std::cerr << "Usage: " << argv[0] << " <models_dir> [silero_vad.onnx]\n";
         return 1;
     }
     std::signal(SIGINT, signalHandler);
@@ -91,9 +96,37 @@ int main(int argc, char* argv[])
     try
     {
         MoonshineModel model(argv[1]);
+
+        // Silero VAD gate, either given explicitly or found next to the Moonshine models
+        std::unique_ptr<SileroVad> vad;
+        const std::string vad_path =
+            argc == 3 ? argv[2] : std::string(argv[1]) + "/silero_vad.onnx";
+        if (argc == 3 || std::filesystem::exists(vad_path))
+        {
+            vad = std::make_unique<SileroVad>(vad_path);
+            std::cout << "Using Silero VAD from " << vad_path << "\n";
+        }
+        else
+        {
+            std::cout << "No silero_vad.onnx in " << argv[1]
+                      << ", falling back to the RMS threshold\n";
+        }
+
+        // keep the speech padding of the VAD before the start of a segment
+        const size_t lookback_samples =
+            vad ? std::max<size_t>(CHUNK_SIZE, (size_t)vad->pad_samples()) : LOOKBACK_SAMPLES;
         try
         {
-            model.generate(warmup);
+            // the partial refreshes grow by MIN_REFRESH_SECS each time, padding them to a few
+            // lengths lets ONNX Runtime reuse the allocation plans of preprocess and encode.
+            // set_buckets() also warms up every bucket
+            std::vector<size_t> buckets;
+            for (int ms = BUCKET_MS; BUCKET_MS > 0 && ms <= (int)(MAX_SPEECH_SECS * 1000); ms += BUCKET_MS)
+                buckets.push_back((size_t)ms * SAMPLE_RATE / 1000);
+            if (buckets.empty())
+                model.generate(warmup);
+            else
+                model.set_buckets(buckets);
         }
         catch (...)
         {
@@ -157,18 +190,24 @@ int main(int argc, char* argv[])
                         continue;
                     }
                     audio_buffer.pop(chunk.data(), CHUNK_SIZE);
-                    float rms = compute_rms(chunk.data(), CHUNK_SIZE);
+
+                    float rms = 0.0f;
+                    if (vad)
+                        vad->process(chunk.data());
+                    else
+                        rms = compute_rms(chunk.data(), CHUNK_SIZE);
+                    const bool is_speech = vad ? vad->triggered() : rms > VAD_START_THRESHOLD;
 
                     // Push into speech buffer
                     speech_buffer.push(chunk.data(), CHUNK_SIZE);
 
                     if (!recording)
-                        while(speech_buffer.size() > LOOKBACK_SAMPLES) // keep look-back
-                            speech_buffer.pop(dummy_arr,std::min(SAMPLE_RATE, int(speech_buffer.size()-LOOKBACK_SAMPLES)));
+                        while(speech_buffer.size() > lookback_samples) // keep look-back
+                            speech_buffer.pop(dummy_arr,std::min(SAMPLE_RATE, int(speech_buffer.size()-lookback_samples)));
 
 
                     // VAD start
-                    if (!recording && rms > VAD_START_THRESHOLD)
+                    if (!recording && is_speech)
                     {
                         recording = true;
                         silence_chunks = 0;
@@ -178,34 +217,56 @@ int main(int argc, char* argv[])
 
                     if (recording)
                     {
-                        if (rms <= VAD_START_THRESHOLD)
-                            ++silence_chunks;
+                        bool ended;
+                        if (vad)
+                            ended = !vad->triggered(); // hysteresis and min silence are in the VAD
                         else
-                            silence_chunks = 0;
+                        {
+                            if (rms <= VAD_START_THRESHOLD)
+                                ++silence_chunks;
+                            else
+                                silence_chunks = 0;
+                            ended = silence_chunks >= SILENCE_CHUNKS_TO_END;
+                        }
 
                         // Check end conditions
-                        if (silence_chunks >= SILENCE_CHUNKS_TO_END ||
-                            speech_buffer.size() >= speech_buffer.capacity)
+                        if (ended || speech_buffer.size() >= speech_buffer.capacity)
                         {
+                            // drop the trailing silence beyond the padding, and segments that
+                            // were too short to be speech, before they reach the model
+                            size_t n_trim = 0;
+                            bool keep = true;
+                            if (vad && ended)
+                            {
+                                const int64_t n_silence = vad->silence_samples() - vad->pad_samples();
+                                n_trim = std::min(speech_buffer.size(), (size_t)std::max<int64_t>(0, n_silence));
+                                keep = vad->long_enough();
+                            }
+
                             // Convert speech buffer to vector
-                            std::vector<float> speech(speech_buffer.size());
+                            std::vector<float> speech(speech_buffer.size() - n_trim);
                             speech_buffer.pop(speech.data(), speech.size());
+                            while (speech_buffer.size() > 0)
+                                speech_buffer.pop(dummy_arr, std::min(SAMPLE_RATE, int(speech_buffer.size())));
 
-                            try
+                            if (keep)
                             {
-                                auto tokens = model.generate(speech);
-                                std::string result = model.detokenize(tokens);
-                                print_overwrite("Transcription: " + result + "\n");
-                            }
-                            catch (const std::exception& e)
-                            {
-                                print_overwrite(std::string("Transcription error: ") + e.what() +
-                                                "\n");
+                                try
+                                {
+                                    auto tokens = model.generate(speech);
+                                    std::string result = model.detokenize(tokens);
+                                    print_overwrite("Transcription: " + result + "\n");
+                                }
+                                catch (const std::exception& e)
+                                {
+                                    print_overwrite(std::string("Transcription error: ") + e.what() +
+                                                    "\n");
+                                }
                             }
 
                             recording = false;
                             silence_chunks = 0;
-                            std::cout << "[Speech ended]\n";
+                            std::cout << (keep ? "[Speech ended]\n" : "[Speech discarded]\n");
                             continue;
                         }
 
@@ -233,8 +294,8 @@ int main(int argc, char* argv[])
                     }
                 }
 
-                // Flush remaining
-                if (speech_buffer.size() > 0)
+                // Flush remaining (the look-back alone is not speech)
+                if (recording && speech_buffer.size() > 0)
                 {
                     std::vector<float> speech(speech_buffer.size());
                     speech_buffer.pop(speech.data(), speech.size());
@@ -258,6 +319,16 @@ int main(int argc, char* argv[])
         transcribe_thread.join();
         SDL_CloseAudioDevice(dev);
         SDL_Quit();
+
+        if (!model.bucket_stats().empty())
+            std::cout << "\nPreprocess + encode latency per input length:\n";
+        for (const auto& b : model.bucket_stats())
+        {
+            if (b.n_calls == 0) continue;
+            std::cout << "  " << b.n_samples * 1000 / SAMPLE_RATE << " ms: " << b.n_calls
+                      << " calls, avg " << b.t_total_us / b.n_calls / 1000.0 << " ms, max "
+                      << b.t_max_us / 1000.0 << " ms\n";
+        }
     }
     catch (const std::exception& e)
     {
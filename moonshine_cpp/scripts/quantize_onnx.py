@@ -0,0 +1,192 @@
+"""
+Produce INT8 variants of the Moonshine encoder and decoders for MoonshineModel::Precision.
+
+  dynamic  weights are quantized offline, activations on the fly (DynamicQuantizeLinear + MatMulInteger).
+           Needs no calibration data. Written as <name>_int8.onnx.
+  static   weights and activations are quantized in QDQ format, with activation ranges calibrated by
+           running the float models on the clips in evaluation/assets. Written as <name>_qdq.onnx.
+
+Only the MatMul / Gemm nodes are quantized. preprocess.onnx is left in float: it is a small conv
+frontend and its output feeds the encoder directly.
+
+Usage:
+  python scripts/quantize_onnx.py model/base
+  python scripts/quantize_onnx.py model/base --mode static --assets ../evaluation/assets
+"""
+
+import argparse
+import glob
+import os
+import sys
+import tempfile
+
+import librosa
+import numpy as np
+import onnxruntime as ort
+from onnxruntime.quantization import (
+    CalibrationDataReader,
+    CalibrationMethod,
+    QuantFormat,
+    QuantType,
+    quantize_dynamic,
+    quantize_static,
+)
+from onnxruntime.quantization.shape_inference import quant_pre_process
+
+SAMPLE_RATE = 16000
+MODELS = ["encode", "uncached_decode", "cached_decode"]
+OP_TYPES = ["MatMul", "Gemm"]
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_ASSETS = os.path.join(SCRIPT_DIR, "..", "..", "evaluation", "assets")
+
+
+def output_path(models_dir, name, mode):
+    """Path of a quantized model, see MoonshineModel::model_file()."""
+    suffix = "_int8" if mode == "dynamic" else "_qdq"
+    return os.path.join(models_dir, name + suffix + ".onnx")
+
+
+def create_session(path):
+    options = ort.SessionOptions()
+    options.graph_optimization_level = ort.GraphOptimizationLevel.ORT_DISABLE_ALL
+    return ort.InferenceSession(path, options, providers=["CPUExecutionProvider"])
+
+
+def input_names(session):
+    return [i.name for i in session.get_inputs()]
+
+
+def collect_calibration_inputs(models_dir, wav_files, max_steps):
+    """
+    Run the float pipeline the same way as MoonshineModel::generate() and record the inputs of
+    every session.
+
+    Args:
+        models_dir (str): Directory with the float .onnx files
+        wav_files (list): Audio clips to run
+        max_steps (int): Maximum number of cached decoder steps recorded per clip
+
+    Returns:
+        dict: model name -> list of input feeds
+    """
+    preprocess = create_session(os.path.join(models_dir, "preprocess.onnx"))
+    encode = create_session(os.path.join(models_dir, "encode.onnx"))
+    uncached_decode = create_session(os.path.join(models_dir, "uncached_decode.onnx"))
+    cached_decode = create_session(os.path.join(models_dir, "cached_decode.onnx"))
+
+    feeds = {name: [] for name in MODELS}
+
+    for path in wav_files:
+        audio, _ = librosa.load(path, sr=SAMPLE_RATE, mono=True)
+        audio = audio.astype(np.float32)[np.newaxis, :]
+
+        features = preprocess.run(None, {input_names(preprocess)[0]: audio})[0]
+
+        seq_len = np.array([features.shape[1]], dtype=np.int32)
+
+        feed = dict(zip(input_names(encode), [features, seq_len]))
+        feeds["encode"].append(feed)
+        context = encode.run(None, feed)[0]
+
+        token = np.array([[1]], dtype=np.int32)
+
+        feed = dict(zip(input_names(uncached_decode), [token, context, seq_len]))
+        feeds["uncached_decode"].append(feed)
+        outputs = uncached_decode.run(None, feed)
+
+        max_len = min(int(audio.shape[1] / SAMPLE_RATE * 6), max_steps)
+        for _ in range(max_len):
+            next_token = int(np.argmax(outputs[0]))
+            if next_token == 2:
+                break
+
+            seq_len = seq_len + 1
+            token = np.array([[next_token]], dtype=np.int32)
+
+            feed = dict(zip(input_names(cached_decode), [token, context, seq_len] + outputs[1:]))
+            feeds["cached_decode"].append(feed)
+            outputs = cached_decode.run(None, feed)
+
+        print(f"{os.path.basename(path)}: {len(feeds['cached_decode'])} decoder steps so far")
+
+    return feeds
+
+
+class FeedReader(CalibrationDataReader):
+    """Hands a list of recorded input feeds to the calibrator."""
+
+    def __init__(self, feeds):
+        self.iter = iter(feeds)
+
+    def get_next(self):
+        return next(self.iter, None)
+
+
+def preprocess_model(src, dst):
+    """Shape inference and graph cleanup recommended before quantization; falls back to the input."""
+    try:
+        quant_pre_process(src, dst, skip_symbolic_shape=True)
+        return dst
+    except Exception as e:
+        print(f"warning: quant_pre_process failed for {src} ({e}), quantizing the original graph")
+        return src
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Quantize the Moonshine ONNX models to INT8")
+    parser.add_argument("models_dir", help="Directory with encode.onnx, uncached_decode.onnx and cached_decode.onnx")
+    parser.add_argument("--mode", choices=["dynamic", "static", "both"], default="both",
+                        help="Quantization mode (default: both)")
+    parser.add_argument("--assets", default=DEFAULT_ASSETS,
+                        help="Directory with the calibration clips for --mode static (default: evaluation/assets)")
+    parser.add_argument("--max-files", type=int, default=8, help="Maximum number of calibration clips (default: 8)")
+    parser.add_argument("--max-steps", type=int, default=64,
+                        help="Maximum number of calibrated decoder steps per clip (default: 64)")
+    parser.add_argument("--per-channel", action="store_true", help="Per-channel weight scales for --mode static")
+    args = parser.parse_args()
+
+    for name in MODELS:
+        if not os.path.exists(os.path.join(args.models_dir, name + ".onnx")):
+            print(f"Error: {name}.onnx not found in {args.models_dir}")
+            sys.exit(1)
+
+    modes = ["dynamic", "static"] if args.mode == "both" else [args.mode]
+
+    feeds = None
+    if "static" in modes:
+        # short clips first, so that a small --max-files still covers several lengths
+        wav_files = sorted(glob.glob(os.path.join(args.assets, "*.wav")), key=os.path.getsize)
+        if not wav_files:
+            print(f"Error: no .wav files in {args.assets}")
+            sys.exit(1)
+        step = max(1, len(wav_files) // args.max_files)
+        wav_files = wav_files[::step][:args.max_files]
+
+        feeds = collect_calibration_inputs(args.models_dir, wav_files, args.max_steps)
+
+    with tempfile.TemporaryDirectory() as tmp_dir:
+        for name in MODELS:
+            src = os.path.join(args.models_dir, name + ".onnx")
+            src = preprocess_model(src, os.path.join(tmp_dir, name + ".onnx"))
+
+            for mode in modes:
+                dst = output_path(args.models_dir, name, mode)
+
+                if mode == "dynamic":
+                    quantize_dynamic(src, dst, op_types_to_quantize=OP_TYPES, weight_type=QuantType.QInt8)
+                else:
+                    quantize_static(src, dst, FeedReader(feeds[name]),
+                                    quant_format=QuantFormat.QDQ,
+                                    op_types_to_quantize=OP_TYPES,
+                                    activation_type=QuantType.QInt8,
+                                    weight_type=QuantType.QInt8,
+                                    per_channel=args.per_channel,
+                                    calibrate_method=CalibrationMethod.MinMax)
+
+                size_src = os.path.getsize(os.path.join(args.models_dir, name + ".onnx"))
+                print(f"{dst}: {size_src / 1e6:.1f} MB -> {os.path.getsize(dst) / 1e6:.1f} MB")
+
+
+if __name__ == "__main__":
+    main()
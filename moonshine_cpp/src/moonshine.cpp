@@ -5,6 +5,8 @@
 #include <nlohmann/json.hpp>
 #include <fstream>
 #include <sstream>
+#include <chrono>
+#include <algorithm>
 #include <onnxruntime_cxx_api.h>
 #ifdef _WIN32
 #include <windows.h>
@@ -62,21 +64,55 @@ std::string readFileAsUtf8(const std::string &file_path)
 
 
 
-MoonshineModel::MoonshineModel(const std::string &models_dir)
-    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU))
+// Microseconds elapsed since the given time point
+static int64_t elapsed_us(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                 start)
+        .count();
+}
+
+MoonshineModel::MoonshineModel(const std::string &models_dir, int n_threads,
+                               const Profile &profile)
+    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU)),
+      n_threads_(n_threads),
+      profile_(profile)
 {
     std::cout << "Initializing Moonshine model from " << models_dir << std::endl;
     this->env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "MoonshineModel");
     preprocess_ = createSession(models_dir + "/preprocess.onnx");
-    encode_ = createSession(models_dir + "/encode.onnx");
-    uncached_decode_ = createSession(models_dir + "/uncached_decode.onnx");
-    cached_decode_ = createSession(models_dir + "/cached_decode.onnx");
+    encode_ = createSession(models_dir + "/" + model_file("encode", profile_.encode));
+    uncached_decode_ =
+        createSession(models_dir + "/" + model_file("uncached_decode", profile_.uncached_decode));
+    cached_decode_ =
+        createSession(models_dir + "/" + model_file("cached_decode", profile_.cached_decode));
 
     // Read tokenizer JSON as UTF-8
     std::string tokenizer_content = readFileAsUtf8(models_dir + "/tokenizer.json");
     load_tokenizer(tokenizer_content);
 }
 
+std::string MoonshineModel::model_file(const std::string &name, Precision precision)
+{
+    switch (precision)
+    {
+        case Precision::INT8_DYNAMIC:
+            return name + "_int8.onnx";
+        case Precision::INT8_STATIC:
+            return name + "_qdq.onnx";
+        default:
+            return name + ".onnx";
+    }
+}
+
+MoonshineModel::Precision MoonshineModel::parse_precision(const std::string &name)
+{
+    if (name == "fp32") return Precision::FP32;
+    if (name == "int8") return Precision::INT8_DYNAMIC;
+    if (name == "qdq") return Precision::INT8_STATIC;
+    throw std::invalid_argument("Unknown precision: " + name + " (expected fp32, int8 or qdq)");
+}
+
 std::unique_ptr<Ort::Session> MoonshineModel::createSession(const std::string &model_path)
 {
     if (!std::filesystem::exists(model_path))
@@ -85,7 +121,7 @@ std::unique_ptr<Ort::Session> MoonshineModel::createSession(const std::string &m
     }
 
     Ort::SessionOptions session_options;
-    session_options.SetIntraOpNumThreads(4);
+    session_options.SetIntraOpNumThreads(n_threads_);
     session_options.SetInterOpNumThreads(1);
     session_options.SetExecutionMode(ORT_SEQUENTIAL);
     session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
@@ -101,14 +137,81 @@ std::unique_ptr<Ort::Session> MoonshineModel::createSession(const std::string &m
     return std::make_unique<Ort::Session>(env_, real_path.c_str(), session_options);
 }
 
+// Number of frames the conv frontend of preprocess.onnx makes of n samples
+// (kernel / stride 127 / 64, 7 / 3 and 3 / 2)
+static int64_t conv_frames(int64_t n)
+{
+    n = (n - 127) / 64 + 1;
+    n = (n - 7) / 3 + 1;
+    n = (n - 3) / 2 + 1;
+    return n;
+}
+
+void MoonshineModel::set_buckets(const std::vector<size_t> &lengths, bool warmup)
+{
+    bucket_stats_.clear();
+    for (const size_t n : lengths)
+    {
+        BucketStats stats;
+        stats.n_samples = n;
+        bucket_stats_.push_back(stats);
+    }
+    std::sort(bucket_stats_.begin(), bucket_stats_.end(),
+              [](const BucketStats &a, const BucketStats &b) { return a.n_samples < b.n_samples; });
+
+    if (!warmup) return;
+
+    const Timings timings = timings_;
+    for (const auto &stats : bucket_stats_)
+    {
+        generate(std::vector<float>(stats.n_samples, 0.0f), 1);
+    }
+    timings_ = timings;
+
+    for (auto &stats : bucket_stats_)
+    {
+        stats = BucketStats{stats.n_samples};
+    }
+}
+
+void MoonshineModel::reset_timings()
+{
+    timings_ = Timings();
+
+    for (auto &stats : bucket_stats_)
+    {
+        stats = BucketStats{stats.n_samples};
+    }
+}
+
 std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_samples,
                                               size_t max_len)
 {
+    // Pad to the bucket of the audio, if any
+    BucketStats *bucket = nullptr;
+    for (auto &stats : bucket_stats_)
+    {
+        if (stats.n_samples >= audio_samples.size())
+        {
+            bucket = &stats;
+            break;
+        }
+    }
+
+    const std::vector<float> *input = &audio_samples;
+    if (bucket)
+    {
+        padded_.resize(bucket->n_samples);
+        std::copy(audio_samples.begin(), audio_samples.end(), padded_.begin());
+        std::fill(padded_.begin() + audio_samples.size(), padded_.end(), 0.0f);
+        input = &padded_;
+    }
+
     // Prepare input audio tensor
-    std::vector<int64_t> audio_shape = {1, static_cast<int64_t>(audio_samples.size())};
+    std::vector<int64_t> audio_shape = {1, static_cast<int64_t>(input->size())};
     Ort::Value audio_tensor = Ort::Value::CreateTensor<float>(
-        memory_info_, const_cast<float *>(audio_samples.data()), audio_samples.size(),
-        audio_shape.data(), audio_shape.size());
+        memory_info_, const_cast<float *>(input->data()), input->size(), audio_shape.data(),
+        audio_shape.size());
 
     std::vector<Ort::AllocatedStringPtr> outputNames;
     Ort::AllocatorWithDefaultOptions allocator;
@@ -116,12 +219,17 @@ std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_sa
     std::vector<const char *> rawInputNames = {"args_0"};
     std::vector<const char *> rawOutputNames = {"sequential"};
 
+    timings_.n_generate++;
+
     // Preprocess
+    const auto t_begin = std::chrono::steady_clock::now();
+    auto t_start = t_begin;
     std::vector<Ort::Value> preprocess_inputs;
     preprocess_inputs.push_back(std::move(audio_tensor));
     auto preprocessed =
         preprocess_->Run(Ort::RunOptions{nullptr}, rawInputNames.data(), preprocess_inputs.data(),
                          preprocess_inputs.size(), rawOutputNames.data(), 1);
+    timings_.t_preprocess_us += elapsed_us(t_start);
 
     // print the shape of the output tensor
     auto shape = preprocessed[0].GetTensorTypeAndShapeInfo().GetShape();
@@ -137,16 +245,37 @@ std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_sa
     encode_inputs.push_back(std::move(preprocessed[0]));
     encode_inputs.push_back(std::move(seq_len_tensor));
     // Encode
+    t_start = std::chrono::steady_clock::now();
     auto context =
         encode_->Run(Ort::RunOptions{nullptr}, encode_input_names.data(), encode_inputs.data(),
                      encode_inputs.size(), encode_output_names.data(), encode_output_names.size());
+    timings_.t_encode_us += elapsed_us(t_start);
+
+    if (bucket)
+    {
+        const int64_t t_us = elapsed_us(t_begin);
+        bucket->n_calls++;
+        bucket->t_total_us += t_us;
+        bucket->t_max_us = std::max(bucket->t_max_us, t_us);
+    }
 
     // copy context to avoid modifying the original context
     auto context_shape = context[0].GetTensorTypeAndShapeInfo().GetShape();
+
+    // the frames of the padding are dropped, so that the decoder does not attend to them. this
+    // does not undo the padding: the encoder is not causal, so the states of the real frames were
+    // computed over the silence as well (see set_buckets()).
+    // the context is [1, frames, dim], the leading frames are a prefix of its data
+    if (bucket)
+    {
+        seq_len = (int32_t)std::clamp<int64_t>(conv_frames((int64_t)audio_samples.size()), 1,
+                                               context_shape[1]);
+        context_shape[1] = seq_len;
+    }
+    const size_t context_size = (size_t)(context_shape[0] * context_shape[1] * context_shape[2]);
     Ort::Value context_copy =
         Ort::Value::CreateTensor<float>(memory_info_, context[0].GetTensorMutableData<float>(),
-                                        context[0].GetTensorTypeAndShapeInfo().GetElementCount(),
-                                        context_shape.data(), context_shape.size());
+                                        context_size, context_shape.data(), context_shape.size());
 
     // Initial token
     std::vector<int32_t> tokens = {1};  // Start token
@@ -170,11 +299,15 @@ std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_sa
     uncached_decode_inputs.push_back(std::move(seq_len_tensor));
 
     // Initial uncached decode
+    t_start = std::chrono::steady_clock::now();
     auto cache =
         uncached_decode_->Run(Ort::RunOptions{nullptr}, decode_input_names.data(),
                               uncached_decode_inputs.data(), uncached_decode_inputs.size(),
                               decode_output_names.data(), uncached_decode_->GetOutputCount());
 
+    timings_.t_decode_us += elapsed_us(t_start);
+    timings_.n_decode++;
+
     // Generate tokens
     for (size_t i = 0; i < max_len; ++i)
     {
@@ -207,9 +340,8 @@ std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_sa
                                                           input_shape.data(), input_shape.size());
 
         context_copy = Ort::Value::CreateTensor<float>(
-            memory_info_, context[0].GetTensorMutableData<float>(),
-            context[0].GetTensorTypeAndShapeInfo().GetElementCount(), context_shape.data(),
-            context_shape.size());
+            memory_info_, context[0].GetTensorMutableData<float>(), context_size,
+            context_shape.data(), context_shape.size());
 
         // Run cached decode
         std::vector<Ort::Value> cached_inputs;
@@ -221,10 +353,13 @@ std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_sa
             cached_inputs.push_back(std::move(cache[j]));
         }
 
+        t_start = std::chrono::steady_clock::now();
         cache = cached_decode_->Run(Ort::RunOptions{nullptr}, cached_decode_input_names.data(),
                                     cached_inputs.data(), cached_inputs.size(),
                                     cached_decode_output_names.data(),
                                     cached_decode_->GetOutputCount());
+        timings_.t_decode_us += elapsed_us(t_start);
+        timings_.n_decode++;
     }
 
     return tokens;
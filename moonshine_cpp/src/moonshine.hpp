@@ -5,6 +5,7 @@
 #include <string>
 #include <memory>
 #include <map>
+#include <cstdint>
 
 /**
  * @class MoonshineModel
@@ -13,11 +14,110 @@
 class MoonshineModel
 {
    public:
+    /**
+     * @enum Precision
+     * @brief Variant of an ONNX model file, as produced by scripts/quantize_onnx.py.
+     */
+    enum class Precision
+    {
+        FP32,         ///< The float model, e.g. encode.onnx.
+        INT8_DYNAMIC, ///< INT8 weights, activations quantized per run (MatMulInteger), e.g. encode_int8.onnx.
+        INT8_STATIC,  ///< INT8 weights and calibrated activations (QDQ), e.g. encode_qdq.onnx.
+    };
+
+    /**
+     * @struct Profile
+     * @brief Precision of each session. preprocess.onnx is always loaded in float.
+     */
+    struct Profile
+    {
+        Precision encode = Precision::FP32;           ///< Precision of the encoding model.
+        Precision uncached_decode = Precision::FP32;  ///< Precision of the uncached decoding model.
+        Precision cached_decode = Precision::FP32;    ///< Precision of the cached decoding model.
+
+        /**
+         * @brief The same precision for all sessions.
+         */
+        static Profile all(Precision precision) { return {precision, precision, precision}; }
+    };
+
     /**
      * @brief Constructor for the MoonshineModel class.
      * @param models_dir The directory containing the ONNX model files.
+     * @param n_threads The number of intra-op threads used by each ONNX session.
+     * @param profile The precision of each session.
+     */
+    MoonshineModel(const std::string &models_dir, int n_threads, const Profile &profile);
+
+    /**
+     * @brief Constructor for the MoonshineModel class with the float models.
+     * @param models_dir The directory containing the ONNX model files.
+     * @param n_threads The number of intra-op threads used by each ONNX session.
+     */
+    explicit MoonshineModel(const std::string &models_dir, int n_threads = 4)
+        : MoonshineModel(models_dir, n_threads, Profile())
+    {
+    }
+
+    /**
+     * @brief File name of a model in the given precision, e.g. "encode_int8.onnx".
+     * @param name The model name without extension, e.g. "encode".
+     * @param precision The precision of the file.
      */
-    explicit MoonshineModel(const std::string &models_dir);
+    static std::string model_file(const std::string &name, Precision precision);
+
+    /**
+     * @brief Parse a precision name: "fp32", "int8" (dynamic) or "qdq" (static).
+     * @throws std::invalid_argument for an unknown name.
+     */
+    static Precision parse_precision(const std::string &name);
+
+    /**
+     * @struct Timings
+     * @brief Cumulative time spent in each stage of generate(), in microseconds.
+     */
+    struct Timings
+    {
+        int64_t t_preprocess_us = 0;  ///< Time spent in the preprocessing model.
+        int64_t t_encode_us = 0;      ///< Time spent in the encoding model.
+        int64_t t_decode_us = 0;      ///< Time spent in the uncached and cached decoding models.
+        int64_t n_generate = 0;       ///< Number of generate() calls.
+        int64_t n_decode = 0;         ///< Number of decoder runs.
+    };
+
+    /**
+     * @struct BucketStats
+     * @brief Preprocess + encode latency of the generate() calls padded to one bucket.
+     */
+    struct BucketStats
+    {
+        size_t n_samples = 0;    ///< Padded length of the bucket.
+        int64_t n_calls = 0;     ///< Number of generate() calls in the bucket.
+        int64_t t_total_us = 0;  ///< Total preprocess + encode time.
+        int64_t t_max_us = 0;    ///< Slowest preprocess + encode time.
+    };
+
+    /**
+     * @brief Pad the audio of generate() with silence to the shortest bucket that fits it.
+     *
+     * ONNX Runtime plans the allocations of a session per input shape, so a new audio length on every
+     * call re-plans preprocess and encode. With a small set of lengths the plans stay warm. The
+     * encoder output is cropped to the frames of the real audio before decoding, and max_len is
+     * derived from the real length. Longer audio than the largest bucket runs unpadded.
+     *
+     * Bucketing is off by default and is not transparent: the encoder attends over the whole
+     * input, so the silence changes the states of the real frames too, and the transcript can
+     * differ from an unpadded run. Check it against unpadded runs before turning it on.
+     * @param lengths Bucket lengths in samples, empty to disable bucketing.
+     * @param warmup Run every bucket once, so the first real call does not pay for the planning.
+     *               The warm-up runs are not counted in timings() and bucket_stats().
+     */
+    void set_buckets(const std::vector<size_t> &lengths, bool warmup = true);
+
+    /**
+     * @brief Per-bucket latency since set_buckets() or the last reset_timings().
+     */
+    const std::vector<BucketStats> &bucket_stats() const { return bucket_stats_; }
 
     /**
      * @brief Generate tokens from audio samples.
@@ -34,6 +134,16 @@ class MoonshineModel
      */
     std::string detokenize(const std::vector<int32_t> &tokens);
 
+    /**
+     * @brief Get the stage timings accumulated since construction or the last reset_timings().
+     */
+    const Timings &timings() const { return timings_; }
+
+    /**
+     * @brief Reset the accumulated stage timings.
+     */
+    void reset_timings();
+
    private:
     std::unique_ptr<Ort::Session> preprocess_;  ///< ONNX session for the preprocessing model.
     std::unique_ptr<Ort::Session> encode_;      ///< ONNX session for the encoding model.
@@ -42,6 +152,11 @@ class MoonshineModel
     std::unique_ptr<Ort::Session> cached_decode_;  ///< ONNX session for the cached decoding model.
     Ort::Env env_;                                 ///< ONNX Runtime environment.
     Ort::MemoryInfo memory_info_;                  ///< Memory information for ONNX Runtime.
+    int n_threads_;                                ///< Intra-op threads per session.
+    Profile profile_;                              ///< Precision of each session.
+    Timings timings_;                              ///< Accumulated stage timings.
+    std::vector<BucketStats> bucket_stats_;        ///< Buckets in increasing length, see set_buckets().
+    std::vector<float> padded_;                    ///< Audio padded to its bucket.
 
     /**
      * @brief Helper function to create an ONNX session.
@@ -0,0 +1,126 @@
+#include "silero_vad.hpp"
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <onnxruntime_cxx_api.h>
+
+static const std::vector<const char *> vad_input_names = {"input", "state", "sr"};
+static const std::vector<const char *> vad_output_names = {"output", "stateN"};
+
+SileroVad::SileroVad(const std::string &model_path, const Params &params)
+    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU)),
+      params_(params),
+      input_(CONTEXT_SIZE + CHUNK_SIZE, 0.0f),
+      state_(2 * 1 * 128, 0.0f)
+{
+    if (!std::filesystem::exists(model_path))
+    {
+        throw std::runtime_error("VAD model file not found: " + model_path);
+    }
+
+    this->env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "SileroVad");
+
+    // the model is tiny and runs once per 32 ms, a single thread is faster than waking a pool
+    Ort::SessionOptions session_options;
+    session_options.SetIntraOpNumThreads(1);
+    session_options.SetInterOpNumThreads(1);
+    session_options.SetExecutionMode(ORT_SEQUENTIAL);
+    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+
+#ifdef _WIN32
+    const std::wstring real_path = std::filesystem::path(model_path).wstring();
+#else
+    const std::string real_path = std::filesystem::path(model_path);
+#endif
+
+    session_ = std::make_unique<Ort::Session>(env_, real_path.c_str(), session_options);
+}
+
+float SileroVad::predict(const float *chunk)
+{
+    // the v5 model expects the last CONTEXT_SIZE samples of the previous chunk in front of the
+    // current one, like the OnnxWrapper of the Python package
+    std::copy(chunk, chunk + CHUNK_SIZE, input_.begin() + CONTEXT_SIZE);
+
+    int64_t sr = SAMPLE_RATE;
+    const std::vector<int64_t> input_shape = {1, (int64_t)input_.size()};
+    const std::vector<int64_t> state_shape = {2, 1, 128};
+    const std::vector<int64_t> sr_shape = {1};
+
+    std::vector<Ort::Value> inputs;
+    inputs.reserve(3);
+    inputs.push_back(Ort::Value::CreateTensor<float>(memory_info_, input_.data(), input_.size(),
+                                                     input_shape.data(), input_shape.size()));
+    inputs.push_back(Ort::Value::CreateTensor<float>(memory_info_, state_.data(), state_.size(),
+                                                     state_shape.data(), state_shape.size()));
+    inputs.push_back(Ort::Value::CreateTensor<int64_t>(memory_info_, &sr, 1, sr_shape.data(),
+                                                       sr_shape.size()));
+
+    auto outputs = session_->Run(Ort::RunOptions{nullptr}, vad_input_names.data(), inputs.data(),
+                                 inputs.size(), vad_output_names.data(), vad_output_names.size());
+
+    const float prob = outputs[0].GetTensorMutableData<float>()[0];
+    const float *state_n = outputs[1].GetTensorMutableData<float>();
+    std::copy(state_n, state_n + state_.size(), state_.begin());
+
+    std::copy(input_.end() - CONTEXT_SIZE, input_.end(), input_.begin());
+
+    return prob;
+}
+
+SileroVad::Event SileroVad::process(const float *chunk)
+{
+    last_prob_ = predict(chunk);
+
+    const int64_t min_silence_samples = (int64_t)params_.min_silence_ms * SAMPLE_RATE / 1000;
+
+    if (!triggered_)
+    {
+        if (last_prob_ >= params_.threshold)
+        {
+            triggered_ = true;
+            speech_samples_ = CHUNK_SIZE;
+            silence_samples_ = 0;
+            return Event::Start;
+        }
+        return Event::None;
+    }
+
+    speech_samples_ += CHUNK_SIZE;
+
+    // probabilities between the two thresholds neither end nor extend the speech, so that a
+    // segment is not cut by a single uncertain chunk and not kept alive by background noise
+    if (last_prob_ >= params_.threshold)
+    {
+        silence_samples_ = 0;
+    }
+    else if (last_prob_ < params_.neg_threshold || silence_samples_ > 0)
+    {
+        silence_samples_ += CHUNK_SIZE;
+    }
+
+    if (silence_samples_ >= min_silence_samples)
+    {
+        triggered_ = false;
+        return Event::End;
+    }
+
+    return Event::None;
+}
+
+bool SileroVad::long_enough() const
+{
+    const int64_t min_speech_samples = (int64_t)params_.min_speech_ms * SAMPLE_RATE / 1000;
+    return speech_samples_ - silence_samples_ >= min_speech_samples;
+}
+
+void SileroVad::reset()
+{
+    std::fill(input_.begin(), input_.end(), 0.0f);
+    std::fill(state_.begin(), state_.end(), 0.0f);
+
+    triggered_ = false;
+    last_prob_ = 0.0f;
+    speech_samples_ = 0;
+    silence_samples_ = 0;
+}
@@ -0,0 +1,124 @@
+// silero_vad.hpp
+#pragma once
+#include <onnxruntime_cxx_api.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+/**
+ * @class SileroVad
+ * @brief Streaming voice activity detector running the Silero VAD v5 ONNX model.
+ *
+ * Audio is fed in chunks of CHUNK_SIZE samples at 16 kHz. The recurrent state of the model is
+ * carried between chunks, so every call only costs one small forward pass. Speech starts when
+ * the probability reaches threshold and ends once it has stayed below neg_threshold for
+ * min_silence_ms, which keeps short pauses and noise bursts from toggling the state.
+ */
+class SileroVad
+{
+   public:
+    static constexpr int SAMPLE_RATE = 16000;  ///< The only sample rate supported by the wrapper.
+    static constexpr int CHUNK_SIZE = 512;     ///< Samples per process() call (32 ms).
+
+    /**
+     * @struct Params
+     * @brief Detection thresholds. The defaults match the VADIterator in moonshine-enhanced.
+     */
+    struct Params
+    {
+        float threshold = 0.5f;       ///< Probability at which speech starts.
+        float neg_threshold = 0.35f;  ///< Probability below which a chunk counts as silence.
+        int min_silence_ms = 300;     ///< Silence needed to end a segment.
+        int speech_pad_ms = 100;      ///< Audio kept before the start and after the end.
+        int min_speech_ms = 250;      ///< Segments shorter than this are rejected.
+    };
+
+    /**
+     * @enum Event
+     * @brief State change reported by process().
+     */
+    enum class Event
+    {
+        None,   ///< No change.
+        Start,  ///< Speech started with this chunk.
+        End,    ///< Speech ended; the last silence_samples() samples were silence.
+    };
+
+    /**
+     * @brief Constructor for the SileroVad class.
+     * @param model_path The path to the silero_vad.onnx model file.
+     * @param params Detection thresholds.
+     */
+    SileroVad(const std::string &model_path, const Params &params);
+
+    /**
+     * @brief Constructor for the SileroVad class with the default thresholds.
+     * @param model_path The path to the silero_vad.onnx model file.
+     */
+    explicit SileroVad(const std::string &model_path) : SileroVad(model_path, Params()) {}
+
+    /**
+     * @brief Run the model on one chunk and return its speech probability, without hysteresis.
+     * @param chunk CHUNK_SIZE normalized float32 samples.
+     */
+    float predict(const float *chunk);
+
+    /**
+     * @brief Run the model on one chunk and update the speech state.
+     * @param chunk CHUNK_SIZE normalized float32 samples.
+     * @return The state change caused by this chunk.
+     */
+    Event process(const float *chunk);
+
+    /**
+     * @brief Whether a speech segment is in progress.
+     */
+    bool triggered() const { return triggered_; }
+
+    /**
+     * @brief Probability of the last processed chunk.
+     */
+    float last_prob() const { return last_prob_; }
+
+    /**
+     * @brief Number of samples since the start of the current or last speech segment.
+     */
+    int64_t speech_samples() const { return speech_samples_; }
+
+    /**
+     * @brief Number of trailing silence samples of the current or last speech segment.
+     */
+    int64_t silence_samples() const { return silence_samples_; }
+
+    /**
+     * @brief Speech padding in samples.
+     */
+    int64_t pad_samples() const { return (int64_t)params_.speech_pad_ms * SAMPLE_RATE / 1000; }
+
+    /**
+     * @brief Whether the last segment was long enough to be speech (see Params::min_speech_ms).
+     */
+    bool long_enough() const;
+
+    /**
+     * @brief Clear the speech state and the recurrent state of the model.
+     */
+    void reset();
+
+   private:
+    static constexpr int CONTEXT_SIZE = 64;  ///< Samples of the previous chunk prepended to input.
+
+    Ort::Env env_;                   ///< ONNX Runtime environment.
+    Ort::MemoryInfo memory_info_;    ///< Memory information for ONNX Runtime.
+    std::unique_ptr<Ort::Session> session_;  ///< ONNX session for the VAD model.
+    Params params_;                  ///< Detection thresholds.
+
+    std::vector<float> input_;  ///< Context followed by the current chunk.
+    std::vector<float> state_;  ///< Recurrent state, shape [2, 1, 128].
+
+    bool triggered_ = false;
+    float last_prob_ = 0.0f;
+    int64_t speech_samples_ = 0;
+    int64_t silence_samples_ = 0;
+};
@@ -26,6 +26,36 @@ public class WhisperContextParams extends Structure {
     /** CUDA device to use (default = 0) */
     public int gpu_device;
 
+    /** Data type of the K cache, a ggml_type value (default = 1, F16) */
+    public int type_k;
+
+    /** Data type of the V cache, a ggml_type value (default = 1, F16). Quantized types require flash attention */
+    public int type_v;
+
+    /** Hex mask of the CPU cores to run on, e.g. "0xF0" (default = null, default affinity) */
+    public String cpu_mask;
+
+    /** Pin each thread to its own core from the mask (default = false) */
+    public CBool cpu_strict;
+
+    /** Thread priority, a ggml_sched_priority value (default = 0, normal) */
+    public int cpu_prio;
+
+    /** Polling level of idle threads, 0 - 100 (default = 50) */
+    public int cpu_poll;
+
+    /** Sidecar file with pre-repacked CPU weights, see whisper_save_repack_cache() (default = null) */
+    public String repack_cache;
+
+    /** Memory budget in MB for the cross-attention KV of recently encoded windows (default = 0, disabled) */
+    public int encoder_cache_mb;
+
+    /** Endpoint "host:port" of a ggml-rpc server for the conv and encoder graphs (default = null, local) */
+    public String rpc_server;
+
+    /** Tracing of the graphs and ops, whisper_trace_level (default = 0, disabled) */
+    public int trace;
+
     /** [EXPERIMENTAL] Enable token-level timestamps with DTW (default = false) */
     public CBool dtw_token_timestamps;
 
@@ -66,6 +96,16 @@ public class WhisperContextParams extends Structure {
             "use_gpu",
             "flash_attn",
             "gpu_device",
+            "type_k",
+            "type_v",
+            "cpu_mask",
+            "cpu_strict",
+            "cpu_prio",
+            "cpu_poll",
+            "repack_cache",
+            "encoder_cache_mb",
+            "rpc_server",
+            "trace",
             "dtw_token_timestamps",
             "dtw_aheads_preset",
             "dtw_n_top",
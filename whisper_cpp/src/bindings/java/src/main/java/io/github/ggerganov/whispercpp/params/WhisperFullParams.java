@@ -154,6 +154,19 @@ public class WhisperFullParams extends Structure {
     /** Regular expression matching tokens to suppress. */
     public String suppress_regex;
 
+    /** Restrict the output layer to these tokens, plus the special and timestamp tokens (null = full vocabulary). (int*) */
+    public Pointer vocab_shortlist;
+
+    public void setVocabShortlist(int[] tokens) {
+        Memory mem = new Memory(tokens.length * 4L);
+        mem.write(0, tokens, 0, tokens.length);
+        vocab_shortlist = mem;
+        vocab_shortlist_n = tokens.length;
+    }
+
+    /** Number of shortlisted tokens. */
+    public int vocab_shortlist_n;
+
     /** Tokens to provide to the whisper decoder as an initial prompt.
      * These are prepended to any existing text context from a previous call. */
     public String initial_prompt;
@@ -337,7 +350,7 @@ public class WhisperFullParams extends Structure {
                 "print_progress", "print_realtime", "print_timestamps",
                 "token_timestamps", "thold_pt", "thold_ptsum", "max_len",
                 "split_on_word", "max_tokens", "debug_mode", "audio_ctx", 
-                "tdrz_enable", "suppress_regex", "initial_prompt",
+                "tdrz_enable", "suppress_regex", "vocab_shortlist", "vocab_shortlist_n", "initial_prompt",
                 "prompt_tokens", "prompt_n_tokens", "language", "detect_language",
                 "suppress_blank", "suppress_nst", "temperature",
                 "max_initial_ts", "length_penalty", "temperature_inc",
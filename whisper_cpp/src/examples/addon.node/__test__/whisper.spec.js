@@ -1,8 +1,9 @@
 const { join } = require('path');
-const { whisper } = require('../../../build/Release/addon.node');
+const { whisper, load, unload } = require('../../../build/Release/addon.node');
 const { promisify } = require('util');
 
 const whisperAsync = promisify(whisper);
+const loadAsync = promisify(load);
 
 const commonParams = {
   language: 'en',
@@ -129,5 +130,24 @@ describe('Whisper.cpp Node.js addon with VAD support', () => {
     expect(Array.isArray(result.transcription)).toBe(true);
     expect(result.transcription.length).toBeGreaterThan(0);
   }, 30000);
+
+  test('Concurrent requests on a preloaded model', async () => {
+    const model = { model: commonParams.model, use_gpu: commonParams.use_gpu, flash_attn: commonParams.flash_attn, n_states: 2 };
+
+    await loadAsync(model);
+
+    const results = await Promise.all([1, 2, 3].map(() => whisperAsync({ ...commonParams, vad: false })));
+    for (const result of results) {
+      const text = result.transcription.map(segment => segment[2]).join(' ');
+      expect(text.toLowerCase()).toContain('ask not');
+    }
+
+    expect(unload(model)).toBe(true);
+    expect(unload(model)).toBe(false);
+  }, 60000);
+
+  test('Loading a missing model fails', async () => {
+    await expect(loadAsync({ model: 'non-existent-model.bin' })).rejects.toThrow();
+  }, 10000);
 });
 
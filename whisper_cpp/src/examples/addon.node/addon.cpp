@@ -10,6 +10,12 @@
 #include <cmath>
 #include <cstdint>
 #include <cfloat>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 
 struct whisper_params {
     int32_t n_threads    = std::min(4, (int32_t) std::thread::hardware_concurrency());
@@ -44,6 +50,8 @@ struct whisper_params {
     bool flash_attn     = false;
     bool comma_in_time  = true;
 
+    int32_t n_states    = 1; // size of the state pool of a loaded model, see whisper_model_entry
+
     std::string language = "en";
     std::string prompt;
     std::string model    = "../../ggml-large.bin";
@@ -70,11 +78,11 @@ struct whisper_print_user_data {
     const std::vector<std::vector<float>> * pcmf32s;
 };
 
-void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
+void whisper_print_segment_callback(struct whisper_context * /*ctx*/, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
     const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -90,8 +98,8 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps && !params.no_prints) {
@@ -126,7 +134,7 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
         // colorful print bug
         //
         if (!params.no_prints) {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
             printf("%s%s", speaker.c_str(), text);
         }
 
@@ -142,6 +150,135 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
 
 void cb_log_disable(enum ggml_log_level, const char *, void *) {}
 
+// a loaded model and a fixed pool of states to run requests on
+// the models stay loaded between calls, so that only the first request for a model pays for loading it
+struct whisper_model_entry {
+    whisper_context * ctx = nullptr;
+
+    std::vector<whisper_state *> states;
+
+    // the states that are not used by a request and the requests that wait for one
+    // only used on the main thread, so that no request blocks a thread of the libuv pool while it waits
+    std::vector<whisper_state *> idle;
+    std::deque<std::function<void(whisper_state *)>> waiting;
+
+    ~whisper_model_entry() {
+        for (auto * state : states) {
+            whisper_free_state(state);
+        }
+        whisper_free(ctx);
+    }
+
+    // starts the request with a free state, or queues it until a state is released
+    void acquire(std::function<void(whisper_state *)> start) {
+        if (idle.empty()) {
+            waiting.push_back(std::move(start));
+            return;
+        }
+
+        whisper_state * state = idle.back();
+        idle.pop_back();
+
+        start(state);
+    }
+
+    // hands the state over to the first queued request
+    void release(whisper_state * state) {
+        if (waiting.empty()) {
+            idle.push_back(state);
+            return;
+        }
+
+        auto start = std::move(waiting.front());
+        waiting.pop_front();
+
+        start(state);
+    }
+};
+
+using whisper_model_future = std::shared_future<std::shared_ptr<whisper_model_entry>>;
+
+// loaded models by model path and context params
+// an unloaded model is freed once the requests that are still using it are done
+static std::mutex g_models_mutex;
+static std::map<std::string, whisper_model_future> g_models;
+
+static std::string whisper_model_key(const whisper_params & params) {
+    return params.model + "|gpu=" + std::to_string(params.use_gpu) + "|fa=" + std::to_string(params.flash_attn);
+}
+
+static std::shared_ptr<whisper_model_entry> whisper_model_load(const whisper_params & params) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    auto entry = std::make_shared<whisper_model_entry>();
+
+    entry->ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
+    if (entry->ctx == nullptr) {
+        return nullptr;
+    }
+
+    for (int i = 0; i < std::max(1, params.n_states); ++i) {
+        whisper_state * state = whisper_init_state(entry->ctx);
+        if (state == nullptr) {
+            return nullptr;
+        }
+        entry->states.push_back(state);
+    }
+    entry->idle = entry->states;
+
+    return entry;
+}
+
+// returns the cached model for the params, loading it on first use
+// the model is loaded outside of g_models_mutex: requests for other models go on, and the requests for the same
+// model wait for the one load that is in progress
+static std::shared_ptr<whisper_model_entry> whisper_model_get(const whisper_params & params) {
+    const std::string key = whisper_model_key(params);
+
+    std::promise<std::shared_ptr<whisper_model_entry>> promise;
+    whisper_model_future future;
+    bool loading = false;
+    {
+        std::lock_guard<std::mutex> lock(g_models_mutex);
+
+        const auto it = g_models.find(key);
+        if (it != g_models.end()) {
+            future = it->second;
+        } else {
+            future = promise.get_future().share();
+            g_models[key] = future;
+            loading = true;
+        }
+    }
+
+    if (!loading) {
+        return future.get();
+    }
+
+    auto entry = whisper_model_load(params);
+    promise.set_value(entry);
+
+    // a failed load is not cached, so that the next request tries again
+    if (entry == nullptr) {
+        std::lock_guard<std::mutex> lock(g_models_mutex);
+
+        const auto it = g_models.find(key);
+        if (it != g_models.end() && it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready && it->second.get() == nullptr) {
+            g_models.erase(it);
+        }
+    }
+
+    return entry;
+}
+
+static bool whisper_model_unload(const whisper_params & params) {
+    std::lock_guard<std::mutex> lock(g_models_mutex);
+
+    return g_models.erase(whisper_model_key(params)) > 0;
+}
+
 struct whisper_result {
     std::vector<std::vector<std::string>> segments;
     std::string language;
@@ -149,8 +286,9 @@ struct whisper_result {
 
 class ProgressWorker : public Napi::AsyncWorker {
  public:
-    ProgressWorker(Napi::Function& callback, whisper_params params, Napi::Function progress_callback, Napi::Env env)
-        : Napi::AsyncWorker(callback), params(params), env(env) {
+    ProgressWorker(Napi::Function& callback, whisper_params params, Napi::Function progress_callback, Napi::Env env,
+                   std::shared_ptr<whisper_model_entry> model, whisper_state * state)
+        : Napi::AsyncWorker(callback), params(std::move(params)), env(env), model(std::move(model)), state(state) {
         // Create thread-safe function
         if (!progress_callback.IsEmpty()) {
             tsfn = Napi::ThreadSafeFunction::New(
@@ -178,6 +316,8 @@ class ProgressWorker : public Napi::AsyncWorker {
     void OnOK() override {
         Napi::HandleScope scope(Env());
 
+        release_state();
+
         if (params.detect_language) {
             Napi::Object resultObj = Napi::Object::New(Env());
             resultObj.Set("language", Napi::String::New(Env(), result.language));
@@ -200,6 +340,12 @@ class ProgressWorker : public Napi::AsyncWorker {
          Callback().Call({Env().Null(), returnObj});
     }
 
+    void OnError(const Napi::Error & e) override {
+        release_state();
+
+        Napi::AsyncWorker::OnError(e);
+    }
+
     // Progress callback function - using thread-safe function
     void OnProgress(int progress) {
         if (tsfn) {
@@ -218,6 +364,18 @@ class ProgressWorker : public Napi::AsyncWorker {
     Napi::Env env;
     Napi::ThreadSafeFunction tsfn;
 
+    // the model of the request and the state of its pool that the request runs on
+    std::shared_ptr<whisper_model_entry> model;
+    whisper_state * state;
+
+    // hands the state over to the next request for the model, runs on the main thread
+    void release_state() {
+        if (model != nullptr && state != nullptr) {
+            model->release(state);
+            state = nullptr;
+        }
+    }
+
     // Custom run function with progress callback support
     int run_with_progress(whisper_params &params, whisper_result & result) {
         if (params.no_prints) {
@@ -234,17 +392,17 @@ class ProgressWorker : public Napi::AsyncWorker {
             exit(0);
         }
 
-        // whisper init
-        struct whisper_context_params cparams = whisper_context_default_params();
-        cparams.use_gpu = params.use_gpu;
-        cparams.flash_attn = params.flash_attn;
-        struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
-
-        if (ctx == nullptr) {
+        // the model was loaded by ModelWorker, it stays loaded for the next requests
+        if (model == nullptr) {
             fprintf(stderr, "error: failed to initialize whisper context\n");
             return 3;
         }
 
+        struct whisper_context * ctx = model->ctx;
+
+        // the timings of the pooled state are printed per request
+        whisper_reset_timings_with_state(ctx, state);
+
         // If params.pcmf32 provides, set params.fname_inp as "buffer"
         if (!params.pcmf32.empty()) {
             fprintf(stderr, "info: using audio buffer as input\n");
@@ -355,7 +513,7 @@ class ProgressWorker : public Napi::AsyncWorker {
                 wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
                 wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
 
-                if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+                if (whisper_full_with_state(ctx, state, wparams, pcmf32.data(), pcmf32.size()) != 0) {
                     fprintf(stderr, "failed to process audio\n");
                     return 10;
                 }
@@ -363,28 +521,116 @@ class ProgressWorker : public Napi::AsyncWorker {
         }
 
         if (params.detect_language || params.language == "auto") {
-            result.language = whisper_lang_str(whisper_full_lang_id(ctx));
+            result.language = whisper_lang_str(whisper_full_lang_id_from_state(state));
         }
-        const int n_segments = whisper_full_n_segments(ctx);
+        const int n_segments = whisper_full_n_segments_from_state(state);
         result.segments.resize(n_segments);
 
         for (int i = 0; i < n_segments; ++i) {
-            const char * text = whisper_full_get_segment_text(ctx, i);
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
 
             result.segments[i].emplace_back(to_timestamp(t0, params.comma_in_time));
             result.segments[i].emplace_back(to_timestamp(t1, params.comma_in_time));
             result.segments[i].emplace_back(text);
         }
 
-        whisper_print_timings(ctx);
-        whisper_free(ctx);
+        whisper_print_timings_with_state(ctx, state);
 
         return 0;
     }
 };
 
+// loads the model of a whisper() request off the main thread, then runs the request on a free state of the model
+// or queues it until a state is released
+class ModelWorker : public Napi::AsyncWorker {
+ public:
+    ModelWorker(Napi::Function& callback, whisper_params params, Napi::Function progress_callback)
+        : Napi::AsyncWorker(callback), params(std::move(params)) {
+        if (!progress_callback.IsEmpty()) {
+            this->progress_callback = Napi::Persistent(progress_callback);
+        }
+    }
+
+    void Execute() override {
+        if (params.no_prints) {
+            whisper_log_set(cb_log_disable, NULL);
+        }
+
+        model = whisper_model_get(params);
+    }
+
+    void OnOK() override {
+        // this worker is destroyed after OnOK(), a queued request keeps its own references to the callbacks
+        auto callback = std::make_shared<Napi::FunctionReference>(Napi::Persistent(Callback().Value()));
+        auto progress = std::make_shared<Napi::FunctionReference>(std::move(progress_callback));
+        auto request  = std::make_shared<whisper_params>(std::move(params));
+
+        const Napi::Env env = Env();
+        const auto model = this->model;
+
+        auto start = [callback, progress, request, env, model](whisper_state * state) {
+            Napi::Function cb = callback->Value();
+            ProgressWorker* worker = new ProgressWorker(cb, std::move(*request), progress->Value(), env, model, state);
+            worker->Queue();
+        };
+
+        // reported by ProgressWorker as before
+        if (model == nullptr) {
+            start(nullptr);
+            return;
+        }
+
+        model->acquire(start);
+    }
+
+ private:
+    whisper_params params;
+    Napi::FunctionReference progress_callback;
+    std::shared_ptr<whisper_model_entry> model;
+};
+
+class LoadWorker : public Napi::AsyncWorker {
+ public:
+    LoadWorker(Napi::Function& callback, whisper_params params)
+        : Napi::AsyncWorker(callback), params(params) {}
+
+    void Execute() override {
+        if (params.no_prints) {
+            whisper_log_set(cb_log_disable, NULL);
+        }
+
+        if (whisper_model_get(params) == nullptr) {
+            SetError("failed to initialize whisper context from '" + params.model + "'");
+        }
+    }
+
+ private:
+    whisper_params params;
+};
+
+// model, use_gpu and flash_attn identify a loaded model, n_states is only used when it is loaded
+static void whisper_parse_model_params(const Napi::Object & obj, whisper_params & params) {
+  params.model = obj.Get("model").As<Napi::String>();
+
+  if (obj.Has("use_gpu") && obj.Get("use_gpu").IsBoolean()) {
+    params.use_gpu = obj.Get("use_gpu").As<Napi::Boolean>();
+  }
+
+  if (obj.Has("flash_attn") && obj.Get("flash_attn").IsBoolean()) {
+    params.flash_attn = obj.Get("flash_attn").As<Napi::Boolean>();
+  }
+
+  if (obj.Has("n_states") && obj.Get("n_states").IsNumber()) {
+    params.n_states = obj.Get("n_states").As<Napi::Number>();
+  }
+
+  if (obj.Has("no_prints") && obj.Get("no_prints").IsBoolean()) {
+    params.no_prints = obj.Get("no_prints").As<Napi::Boolean>();
+  }
+}
+
 Napi::Value whisper(const Napi::CallbackInfo& info) {
   Napi::Env env = info.Env();
   if (info.Length() <= 0 || !info[0].IsObject()) {
@@ -394,24 +640,10 @@ Napi::Value whisper(const Napi::CallbackInfo& info) {
 
   Napi::Object whisper_params = info[0].As<Napi::Object>();
   std::string language = whisper_params.Get("language").As<Napi::String>();
-  std::string model = whisper_params.Get("model").As<Napi::String>();
   std::string input = whisper_params.Get("fname_inp").As<Napi::String>();
-  
-  bool use_gpu = true;
-  if (whisper_params.Has("use_gpu") && whisper_params.Get("use_gpu").IsBoolean()) {
-    use_gpu = whisper_params.Get("use_gpu").As<Napi::Boolean>();
-  }
-  
-  bool flash_attn = false;
-  if (whisper_params.Has("flash_attn") && whisper_params.Get("flash_attn").IsBoolean()) {
-    flash_attn = whisper_params.Get("flash_attn").As<Napi::Boolean>();
-  }
-  
-  bool no_prints = false;
-  if (whisper_params.Has("no_prints") && whisper_params.Get("no_prints").IsBoolean()) {
-    no_prints = whisper_params.Get("no_prints").As<Napi::Boolean>();
-  }
-  
+
+  whisper_parse_model_params(whisper_params, params);
+
   bool no_timestamps = false;
   if (whisper_params.Has("no_timestamps") && whisper_params.Get("no_timestamps").IsBoolean()) {
     no_timestamps = whisper_params.Get("no_timestamps").As<Napi::Boolean>();
@@ -513,11 +745,7 @@ Napi::Value whisper(const Napi::CallbackInfo& info) {
   }
 
   params.language = language;
-  params.model = model;
   params.fname_inp.emplace_back(input);
-  params.use_gpu = use_gpu;
-  params.flash_attn = flash_attn;
-  params.no_prints = no_prints;
   params.no_timestamps = no_timestamps;
   params.audio_ctx = audio_ctx;
   params.pcmf32 = pcmf32_vec;
@@ -539,18 +767,55 @@ Napi::Value whisper(const Napi::CallbackInfo& info) {
   params.vad_samples_overlap = vad_samples_overlap;
 
   Napi::Function callback = info[1].As<Napi::Function>();
-  // Create a new Worker class with progress callback support
-  ProgressWorker* worker = new ProgressWorker(callback, params, progress_callback, env);
+  // Load the model, then run the request with progress callback support
+  ModelWorker* worker = new ModelWorker(callback, params, progress_callback);
   worker->Queue();
   return env.Undefined();
 }
 
+// load(params, callback): loads a model into the cache ahead of the first whisper() call for it
+Napi::Value load(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "object and callback expected").ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+  whisper_params params;
+  whisper_parse_model_params(info[0].As<Napi::Object>(), params);
+
+  Napi::Function callback = info[1].As<Napi::Function>();
+  LoadWorker* worker = new LoadWorker(callback, params);
+  worker->Queue();
+  return env.Undefined();
+}
+
+// unload(params): removes a model from the cache, returns false if it was not loaded
+Napi::Value unload(const Napi::CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (info.Length() <= 0 || !info[0].IsObject()) {
+    Napi::TypeError::New(env, "object expected").ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+  whisper_params params;
+  whisper_parse_model_params(info[0].As<Napi::Object>(), params);
+
+  return Napi::Boolean::New(env, whisper_model_unload(params));
+}
+
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
   exports.Set(
       Napi::String::New(env, "whisper"),
       Napi::Function::New(env, whisper)
   );
+  exports.Set(
+      Napi::String::New(env, "load"),
+      Napi::Function::New(env, load)
+  );
+  exports.Set(
+      Napi::String::New(env, "unload"),
+      Napi::Function::New(env, unload)
+  );
   return exports;
 }
 
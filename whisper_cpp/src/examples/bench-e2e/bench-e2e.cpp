@@ -0,0 +1,435 @@
+// End-to-end benchmark of the whisper_full() pipeline
+//
+// Runs full transcription over a set of WAV files at several thread counts and reports RTF, a simulated streaming
+// RTF (sRTF), a simulated user-perceived latency (UPL), the peak RSS and the per-stage timings as JSON.
+//
+// In compare mode, two such reports are matched by (file, n_threads) and regressions above a threshold are flagged.
+//
+#include "common-whisper.h"
+#include "common-ggml.h"
+#include "whisper.h"
+#include "json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using json = nlohmann::ordered_json;
+
+// command-line parameters
+struct whisper_params {
+    std::vector<int32_t> n_threads = { std::min(4, (int32_t) std::thread::hardware_concurrency()) };
+
+    int32_t n_repeat  = 1;
+    int32_t step_ms   = 3000;
+    int32_t length_ms = 10000;
+    int32_t keep_ms   = 200;
+
+    float threshold = 0.05f;
+
+    bool use_gpu    = true;
+    bool flash_attn = false;
+    bool no_stream  = false;
+
+    std::string model  = "models/ggml-base.en.bin";
+    std::string output = "";
+
+    std::string cache_type_k = "f16";
+    std::string cache_type_v = "f16";
+
+    std::vector<std::string> fname_inp = {};
+    std::vector<std::string> compare   = {};
+};
+
+static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
+
+static std::vector<int32_t> parse_int_list(const std::string & s) {
+    std::vector<int32_t> res;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        res.push_back(std::stoi(item));
+    }
+    return res;
+}
+
+static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-t"  || arg == "--threads")    { params.n_threads = parse_int_list(argv[++i]); }
+        else if (arg == "-r"  || arg == "--repeat")     { params.n_repeat  = std::stoi(argv[++i]); }
+        else if (arg == "-m"  || arg == "--model")      { params.model     = argv[++i]; }
+        else if (arg == "-f"  || arg == "--file")       { params.fname_inp.emplace_back(argv[++i]); }
+        else if (arg == "-o"  || arg == "--output")     { params.output    = argv[++i]; }
+        else if (             arg == "--step")          { params.step_ms   = std::stoi(argv[++i]); }
+        else if (             arg == "--length")        { params.length_ms = std::stoi(argv[++i]); }
+        else if (             arg == "--keep")          { params.keep_ms   = std::stoi(argv[++i]); }
+        else if (arg == "-ns" || arg == "--no-stream")  { params.no_stream = true; }
+        else if (arg == "-ng" || arg == "--no-gpu")     { params.use_gpu    = false; }
+        else if (arg == "-fa" || arg == "--flash-attn") { params.flash_attn = true; }
+        else if (arg == "-ctk"|| arg == "--cache-type-k") { params.cache_type_k = argv[++i]; }
+        else if (arg == "-ctv"|| arg == "--cache-type-v") { params.cache_type_v = argv[++i]; }
+        else if (             arg == "--threshold")     { params.threshold = std::stof(argv[++i]); }
+        else if (             arg == "--compare")       {
+            params.compare.emplace_back(argv[++i]);
+            params.compare.emplace_back(argv[++i]);
+        }
+        else if (arg[0] != '-') {
+            params.fname_inp.push_back(arg);
+        }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return true;
+}
+
+static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options] file0.wav file1.wav ...\n", argv[0]);
+    fprintf(stderr, "       %s --compare base.json new.json [--threshold F]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,        --help          [default] show this help message and exit\n");
+    fprintf(stderr, "  -t N,...,  --threads N,... [%-7d] comma-separated thread counts to benchmark\n", params.n_threads[0]);
+    fprintf(stderr, "  -r N,      --repeat N      [%-7d] number of runs per file, the fastest one is reported\n", params.n_repeat);
+    fprintf(stderr, "  -m FNAME,  --model FNAME   [%-7s] model path\n",                                 params.model.c_str());
+    fprintf(stderr, "  -f FNAME,  --file FNAME    [%-7s] input WAV file path\n",                        "");
+    fprintf(stderr, "  -o FNAME,  --output FNAME  [%-7s] write the JSON report to this file instead of stdout\n", params.output.c_str());
+    fprintf(stderr, "             --step N        [%-7d] streaming simulation: audio step size in ms\n",  params.step_ms);
+    fprintf(stderr, "             --length N      [%-7d] streaming simulation: audio window in ms\n",     params.length_ms);
+    fprintf(stderr, "             --keep N        [%-7d] streaming simulation: audio to keep from the previous step in ms\n", params.keep_ms);
+    fprintf(stderr, "  -ns,       --no-stream     [%-7s] skip the streaming simulation (no sRTF / UPL)\n", params.no_stream ? "true" : "false");
+    fprintf(stderr, "  -ng,       --no-gpu        [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
+    fprintf(stderr, "  -fa,       --flash-attn    [%-7s] enable flash attention\n",                      params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -ctk TYPE, --cache-type-k  [%-7s] KV cache data type for K\n",                   params.cache_type_k.c_str());
+    fprintf(stderr, "  -ctv TYPE, --cache-type-v  [%-7s] KV cache data type for V, quantized needs -fa\n", params.cache_type_v.c_str());
+    fprintf(stderr, "             --compare A B   [%-7s] compare two reports and flag regressions\n",    "");
+    fprintf(stderr, "             --threshold F   [%-7.2f] relative increase that counts as a regression\n", params.threshold);
+    fprintf(stderr, "\n");
+}
+
+// peak resident set size of the process in kB
+static int64_t get_peak_rss_kb() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return (int64_t) pmc.PeakWorkingSetSize / 1024;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (int64_t) usage.ru_maxrss / 1024;
+#else
+    return (int64_t) usage.ru_maxrss;
+#endif
+#endif
+}
+
+static double time_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string basename(const std::string & path) {
+    const size_t pos = path.find_last_of("/\\");
+    return pos == std::string::npos ? path : path.substr(pos + 1);
+}
+
+struct stream_result {
+    double t_compute_s = 0.0; // sum of the per-step compute times
+    double upl_s       = 0.0; // average user-perceived latency
+    int    n_steps     = 0;
+};
+
+// replay the audio the way whisper-stream consumes a live source and measure the latency it would have
+//
+// every step_ms a new chunk "arrives"; the last length_ms of audio (plus keep_ms of overlap) is transcribed as soon as
+// the previous step is done. the latency of a chunk is measured from the middle of the chunk to the end of its
+// transcription, on a virtual clock, so a slow device accumulates a backlog exactly as it would live
+static stream_result simulate_stream(whisper_context * ctx, whisper_full_params wparams, const std::vector<float> & pcmf32, const whisper_params & params) {
+    const int n_samples_step = (1e-3*params.step_ms  )*WHISPER_SAMPLE_RATE;
+    const int n_samples_len  = (1e-3*params.length_ms)*WHISPER_SAMPLE_RATE;
+    const int n_samples_keep = (1e-3*params.keep_ms  )*WHISPER_SAMPLE_RATE;
+
+    wparams.no_context       = true;
+    wparams.single_segment   = true;
+    wparams.max_tokens       = 0;
+
+    stream_result res;
+
+    double t_clock = 0.0; // virtual time at which the previous step finished
+    double upl_sum = 0.0;
+
+    const int n_samples = (int) pcmf32.size();
+    for (int i_end = std::min(n_samples_step, n_samples); ; i_end = std::min(i_end + n_samples_step, n_samples)) {
+        const int i_beg = std::max(0, i_end - n_samples_len - n_samples_keep);
+
+        const double t0 = time_s();
+        if (whisper_full(ctx, wparams, pcmf32.data() + i_beg, i_end - i_beg) != 0) {
+            fprintf(stderr, "%s: failed to process audio\n", __func__);
+            break;
+        }
+        const double t_compute = time_s() - t0;
+
+        const double t_arrive = double(i_end)/WHISPER_SAMPLE_RATE;
+        const double t_chunk  = double(std::min(n_samples_step, i_end))/WHISPER_SAMPLE_RATE;
+
+        t_clock = std::max(t_clock, t_arrive) + t_compute;
+
+        upl_sum          += t_clock - (t_arrive - 0.5*t_chunk);
+        res.t_compute_s  += t_compute;
+        res.n_steps      += 1;
+
+        if (i_end == n_samples) {
+            break;
+        }
+    }
+
+    res.upl_s = res.n_steps > 0 ? upl_sum/res.n_steps : 0.0;
+
+    return res;
+}
+
+static int run_compare(const whisper_params & params) {
+    json base;
+    json curr;
+
+    {
+        std::ifstream fin_base(params.compare[0]);
+        std::ifstream fin_curr(params.compare[1]);
+        if (!fin_base || !fin_curr) {
+            fprintf(stderr, "error: failed to open '%s' or '%s'\n", params.compare[0].c_str(), params.compare[1].c_str());
+            return 1;
+        }
+        try {
+            fin_base >> base;
+            fin_curr >> curr;
+        } catch (const std::exception & e) {
+            fprintf(stderr, "error: failed to parse report: %s\n", e.what());
+            return 1;
+        }
+    }
+
+    // lower is better for all of these
+    // the peak RSS is not compared, it is a single value of the whole process (see the report)
+    const char * metrics[] = { "rtf", "srtf", "upl_s", "t_mel_us", "t_preprocess_us", "t_encode_us", "t_decode_us" };
+
+    int n_regress = 0;
+    int n_matched = 0;
+
+    printf("%-20s %4s %-12s %12s %12s %8s\n", "file", "nth", "metric", "base", "new", "change");
+
+    for (const auto & rc : curr["results"]) {
+        for (const auto & rb : base["results"]) {
+            if (rb["file"] != rc["file"] || rb["n_threads"] != rc["n_threads"]) {
+                continue;
+            }
+
+            n_matched++;
+
+            for (const char * m : metrics) {
+                if (!rb.contains(m) || !rc.contains(m)) {
+                    continue;
+                }
+
+                const double vb = rb[m].get<double>();
+                const double vc = rc[m].get<double>();
+                if (vb <= 0.0) {
+                    continue;
+                }
+
+                const double change = vc/vb - 1.0;
+                const bool   regress = change > params.threshold;
+
+                n_regress += regress;
+
+                printf("%-20s %4d %-12s %12.4g %12.4g %+7.1f%%%s\n",
+                        rc["file"].get<std::string>().c_str(), rc["n_threads"].get<int>(), m, vb, vc, 100.0*change,
+                        regress ? "  REGRESSION" : "");
+            }
+            break;
+        }
+    }
+
+    printf("\n%d matched results, %d regressions above %.1f%%\n", n_matched, n_regress, 100.0*params.threshold);
+
+    return n_regress > 0 ? 2 : 0;
+}
+
+int main(int argc, char ** argv) {
+    ggml_backend_load_all();
+
+    whisper_params params;
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        return 1;
+    }
+
+    if (params.compare.size() == 2) {
+        return run_compare(params);
+    }
+
+    if (params.fname_inp.empty()) {
+        fprintf(stderr, "error: no input files specified\n");
+        whisper_print_usage(argc, argv, params);
+        return 2;
+    }
+
+    // whisper init
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+    cparams.type_k     = ggml_parse_type(params.cache_type_k.c_str());
+    cparams.type_v     = ggml_parse_type(params.cache_type_v.c_str());
+
+    if (cparams.type_k == GGML_TYPE_COUNT || cparams.type_v == GGML_TYPE_COUNT) {
+        return 3;
+    }
+
+    const double t_load_beg = time_s();
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 3;
+    }
+
+    const double t_load_s = time_s() - t_load_beg;
+
+    json report;
+
+    report["engine"]      = "whisper.cpp";
+    report["model"]       = basename(params.model);
+    report["system_info"] = whisper_print_system_info();
+    report["type_k"]      = ggml_type_name(cparams.type_k);
+    report["type_v"]      = ggml_type_name(cparams.type_v);
+    report["t_load_s"]    = t_load_s;
+    report["results"]     = json::array();
+
+    for (const auto & fname : params.fname_inp) {
+        std::vector<float> pcmf32;
+        std::vector<std::vector<float>> pcmf32s;
+
+        if (!::read_audio_data(fname, pcmf32, pcmf32s, false)) {
+            fprintf(stderr, "error: failed to read audio file '%s'\n", fname.c_str());
+            continue;
+        }
+
+        const double audio_s = double(pcmf32.size())/WHISPER_SAMPLE_RATE;
+
+        for (const int n_threads : params.n_threads) {
+            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+            wparams.n_threads        = n_threads;
+            wparams.print_progress   = false;
+            wparams.print_realtime   = false;
+            wparams.print_timestamps = false;
+
+            // full transcription - keep the fastest run
+            double t_best = -1.0;
+            json   timings;
+
+            for (int r = 0; r < params.n_repeat; ++r) {
+                whisper_reset_timings(ctx);
+
+                const double t0 = time_s();
+                if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+                    fprintf(stderr, "error: failed to process '%s'\n", fname.c_str());
+                    break;
+                }
+                const double t_run = time_s() - t0;
+
+                if (t_best < 0.0 || t_run < t_best) {
+                    t_best = t_run;
+
+                    whisper_timings * t = whisper_get_timings(ctx);
+                    timings = {
+                        { "t_mel_us",    t->t_mel_us    },
+                        { "t_sample_us", t->t_sample_us },
+                        { "t_encode_us", t->t_encode_us },
+                        { "t_decode_us", t->t_decode_us },
+                        { "t_batchd_us", t->t_batchd_us },
+                        { "t_prompt_us", t->t_prompt_us },
+                    };
+                    delete t;
+                }
+            }
+
+            if (t_best < 0.0) {
+                continue;
+            }
+
+            json res;
+
+            res["file"]      = basename(fname);
+            res["audio_s"]   = audio_s;
+            res["n_threads"] = n_threads;
+            res["t_total_s"] = t_best;
+            res["rtf"]       = t_best/audio_s;
+
+            if (!params.no_stream) {
+                const stream_result sr = simulate_stream(ctx, wparams, pcmf32, params);
+
+                res["srtf"]    = sr.t_compute_s/audio_s;
+                res["upl_s"]   = sr.upl_s;
+                res["n_steps"] = sr.n_steps;
+            }
+
+            res.update(timings);
+
+            fprintf(stderr, "%s: %-20s n_threads = %2d, RTF = %.3f", __func__, basename(fname).c_str(), n_threads, res["rtf"].get<double>());
+            if (!params.no_stream) {
+                fprintf(stderr, ", sRTF = %.3f, UPL = %.3f s", res["srtf"].get<double>(), res["upl_s"].get<double>());
+            }
+            fprintf(stderr, "\n");
+
+            report["results"].push_back(res);
+        }
+    }
+
+    whisper_free(ctx);
+
+    // the peak only grows within a process, so it is reported once for all results rather than per result
+    report["peak_rss_kb"] = get_peak_rss_kb();
+
+    const std::string out = report.dump(2);
+
+    if (params.output.empty()) {
+        printf("%s\n", out.c_str());
+    } else {
+        std::ofstream fout(params.output);
+        if (!fout) {
+            fprintf(stderr, "error: failed to open '%s' for writing\n", params.output.c_str());
+            return 4;
+        }
+        fout << out << std::endl;
+        fprintf(stderr, "%s: report written to '%s'\n", __func__, params.output.c_str());
+    }
+
+    return 0;
+}
@@ -1,12 +1,18 @@
 #include "common.h"
 #include "common-whisper.h"
+#include "common-ggml.h"
 
 #include "whisper.h"
 #include "grammar-parser.h"
 
+#include <algorithm>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -34,9 +40,11 @@ static void replace_all(std::string & s, const std::string & search, const std::
 struct whisper_params {
     int32_t n_threads     = std::min(4, (int32_t) std::thread::hardware_concurrency());
     int32_t n_processors  = 1;
+    int32_t n_jobs        = 1;
     int32_t offset_t_ms   = 0;
     int32_t offset_n      = 0;
     int32_t duration_ms   = 0;
+    int32_t audio_window_ms = 0;
     int32_t progress_step = 5;
     int32_t max_context   = -1;
     int32_t max_len       = 0;
@@ -78,6 +86,21 @@ struct whisper_params {
     bool flash_attn      = false;
     bool suppress_nst    = false;
 
+    std::string cache_type_k = "f16";
+    std::string cache_type_v = "f16";
+
+    std::string cpu_mask;
+    bool        cpu_strict = false;
+    int32_t     cpu_prio   = 0;
+    int32_t     cpu_poll   = 50;
+
+    std::string repack_cache;
+
+    std::string rpc_server;
+
+    std::string trace;
+    bool        trace_ops = false;
+
     std::string language  = "en";
     std::string prompt;
     std::string font_path = "/System/Library/Fonts/Supplemental/Courier New Bold.ttf";
@@ -91,6 +114,10 @@ struct whisper_params {
     // A regular expression that matches tokens to suppress
     std::string suppress_regex;
 
+    // words and phrases that the output layer is restricted to, one per line
+    std::string vocab_shortlist_file;
+    std::vector<whisper_token> vocab_shortlist;
+
     std::string openvino_encode_device = "CPU";
 
     std::string dtw = "";
@@ -109,6 +136,13 @@ struct whisper_params {
     float       vad_max_speech_duration_s = FLT_MAX;
     int         vad_speech_pad_ms = 30;
     float       vad_samples_overlap = 0.1f;
+
+    // Model cascade parameters
+    std::string cascade_model;
+    float       cascade_logprob_thold   = whisper_cascade_default_params().logprob_thold;
+    float       cascade_entropy_thold   = whisper_cascade_default_params().entropy_thold;
+    float       cascade_no_speech_thold = whisper_cascade_default_params().no_speech_thold;
+    int         cascade_pad_ms          = whisper_cascade_default_params().pad_ms;
 };
 
 static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -147,9 +181,11 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         #define ARGV_NEXT (((i + 1) < argc) ? argv[++i] : requires_value_error(arg))
         else if (arg == "-t"    || arg == "--threads")         { params.n_threads       = std::stoi(ARGV_NEXT); }
         else if (arg == "-p"    || arg == "--processors")      { params.n_processors    = std::stoi(ARGV_NEXT); }
+        else if (arg == "-j"    || arg == "--jobs")            { params.n_jobs          = std::stoi(ARGV_NEXT); }
         else if (arg == "-ot"   || arg == "--offset-t")        { params.offset_t_ms     = std::stoi(ARGV_NEXT); }
         else if (arg == "-on"   || arg == "--offset-n")        { params.offset_n        = std::stoi(ARGV_NEXT); }
         else if (arg == "-d"    || arg == "--duration")        { params.duration_ms     = std::stoi(ARGV_NEXT); }
+        else if (arg == "-aw"   || arg == "--audio-window")    { params.audio_window_ms = std::stoi(ARGV_NEXT); }
         else if (arg == "-mc"   || arg == "--max-context")     { params.max_context     = std::stoi(ARGV_NEXT); }
         else if (arg == "-ml"   || arg == "--max-len")         { params.max_len         = std::stoi(ARGV_NEXT); }
         else if (arg == "-bo"   || arg == "--best-of")         { params.best_of         = std::stoi(ARGV_NEXT); }
@@ -193,8 +229,19 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-ls"   || arg == "--log-score")       { params.log_score       = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (arg == "-ctk"  || arg == "--cache-type-k")    { params.cache_type_k    = ARGV_NEXT; }
+        else if (arg == "-ctv"  || arg == "--cache-type-v")    { params.cache_type_v    = ARGV_NEXT; }
+        else if (arg == "-C"    || arg == "--cpu-mask")        { params.cpu_mask        = ARGV_NEXT; }
+        else if (                  arg == "--cpu-strict")      { params.cpu_strict      = true; }
+        else if (                  arg == "--prio")            { params.cpu_prio        = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--poll")            { params.cpu_poll        = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--repack-cache")    { params.repack_cache    = ARGV_NEXT; }
+        else if (                  arg == "--rpc")             { params.rpc_server      = ARGV_NEXT; }
+        else if (                  arg == "--trace")           { params.trace           = ARGV_NEXT; }
+        else if (                  arg == "--trace-ops")       { params.trace_ops       = true; }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (                  arg == "--suppress-regex")  { params.suppress_regex  = ARGV_NEXT; }
+        else if (                  arg == "--vocab-shortlist") { params.vocab_shortlist_file = ARGV_NEXT; }
         else if (                  arg == "--grammar")         { params.grammar         = ARGV_NEXT; }
         else if (                  arg == "--grammar-rule")    { params.grammar_rule    = ARGV_NEXT; }
         else if (                  arg == "--grammar-penalty") { params.grammar_penalty = std::stof(ARGV_NEXT); }
@@ -207,6 +254,12 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-vmsd" || arg == "--vad-max-speech-duration-s")   { params.vad_max_speech_duration_s   = std::stof(ARGV_NEXT); }
         else if (arg == "-vp"   || arg == "--vad-speech-pad-ms")           { params.vad_speech_pad_ms           = std::stoi(ARGV_NEXT); }
         else if (arg == "-vo"   || arg == "--vad-samples-overlap")         { params.vad_samples_overlap         = std::stof(ARGV_NEXT); }
+        // Model cascade
+        else if (arg == "-cm"   || arg == "--cascade-model")           { params.cascade_model           = ARGV_NEXT; }
+        else if (arg == "-clpt" || arg == "--cascade-logprob-thold")   { params.cascade_logprob_thold   = std::stof(ARGV_NEXT); }
+        else if (arg == "-cet"  || arg == "--cascade-entropy-thold")   { params.cascade_entropy_thold   = std::stof(ARGV_NEXT); }
+        else if (arg == "-cnth" || arg == "--cascade-no-speech-thold") { params.cascade_no_speech_thold = std::stof(ARGV_NEXT); }
+        else if (arg == "-cp"   || arg == "--cascade-pad-ms")          { params.cascade_pad_ms          = std::stoi(ARGV_NEXT); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params);
@@ -226,9 +279,11 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -h,        --help              [default] show this help message and exit\n");
     fprintf(stderr, "  -t N,      --threads N         [%-7d] number of threads to use during computation\n",    params.n_threads);
     fprintf(stderr, "  -p N,      --processors N      [%-7d] number of processors to use during computation\n", params.n_processors);
+    fprintf(stderr, "  -j N,      --jobs N            [%-7d] number of input files to transcribe concurrently\n", params.n_jobs);
     fprintf(stderr, "  -ot N,     --offset-t N        [%-7d] time offset in milliseconds\n",                    params.offset_t_ms);
     fprintf(stderr, "  -on N,     --offset-n N        [%-7d] segment index offset\n",                           params.offset_n);
     fprintf(stderr, "  -d  N,     --duration N        [%-7d] duration of audio to process in milliseconds\n",   params.duration_ms);
+    fprintf(stderr, "  -aw N,     --audio-window N    [%-7d] decode the input in windows of N ms (0 - all at once)\n", params.audio_window_ms);
     fprintf(stderr, "  -mc N,     --max-context N     [%-7d] maximum number of text context tokens to store\n", params.max_context);
     fprintf(stderr, "  -ml N,     --max-len N         [%-7d] maximum segment length in characters\n",           params.max_len);
     fprintf(stderr, "  -sow,      --split-on-word     [%-7s] split on word rather than on token\n",             params.split_on_word ? "true" : "false");
@@ -272,8 +327,19 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -ls,       --log-score         [%-7s] log best decoder scores of tokens\n",              params.log_score?"true":"false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] disable GPU\n",                                    params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n",                                params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -ctk TYPE, --cache-type-k TYPE [%-7s] KV cache data type for K (f16, q8_0, ...)\n",    params.cache_type_k.c_str());
+    fprintf(stderr, "  -ctv TYPE, --cache-type-v TYPE [%-7s] KV cache data type for V, quantized needs -fa\n", params.cache_type_v.c_str());
+    fprintf(stderr, "  -C M,      --cpu-mask M        [%-7s] hex mask of the CPU cores to run on, e.g. 0xF0\n", params.cpu_mask.c_str());
+    fprintf(stderr, "             --cpu-strict        [%-7s] pin each thread to its own core from the mask\n", params.cpu_strict ? "true" : "false");
+    fprintf(stderr, "             --prio N            [%-7d] thread priority (-1 low, 0 normal, 1 medium, 2 high, 3 realtime)\n", params.cpu_prio);
+    fprintf(stderr, "             --poll N            [%-7d] polling level of idle threads (0 - 100)\n", params.cpu_poll);
+    fprintf(stderr, "             --repack-cache FNAME [%-7s] pre-repacked CPU weights (see whisper-repack-cache)\n", params.repack_cache.c_str());
+    fprintf(stderr, "             --rpc HOST:PORT     [%-7s] run the encoder on a ggml-rpc server\n", params.rpc_server.c_str());
+    fprintf(stderr, "             --trace FNAME       [%-7s] print a trace summary and save the trace as Chrome trace JSON\n", params.trace.c_str());
+    fprintf(stderr, "             --trace-ops         [%-7s] also time every ggml op (slower)\n", params.trace_ops ? "true" : "false");
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n",                     params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  --suppress-regex REGEX         [%-7s] regular expression matching tokens to suppress\n", params.suppress_regex.c_str());
+    fprintf(stderr, "  --vocab-shortlist FNAME        [%-7s] restrict the output to the words and phrases in FNAME, one per line\n", params.vocab_shortlist_file.c_str());
     fprintf(stderr, "  --grammar GRAMMAR              [%-7s] GBNF grammar to guide decoding\n",                 params.grammar.c_str());
     fprintf(stderr, "  --grammar-rule RULE            [%-7s] top-level GBNF grammar rule name\n",               params.grammar_rule.c_str());
     fprintf(stderr, "  --grammar-penalty N            [%-7.1f] scales down logits of nongrammar tokens\n",      params.grammar_penalty);
@@ -289,6 +355,13 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
                                                                                                                                   std::to_string(params.vad_max_speech_duration_s).c_str());
     fprintf(stderr, "  -vp N,     --vad-speech-pad-ms           N [%-7d] VAD speech padding (extend segments)\n",             params.vad_speech_pad_ms);
     fprintf(stderr, "  -vo N,     --vad-samples-overlap         N [%-7.2f] VAD samples overlap (seconds between segments)\n", params.vad_samples_overlap);
+    // Model cascade parameters
+    fprintf(stderr, "\nModel cascade options:\n");
+    fprintf(stderr, "  -cm FNAME, --cascade-model FNAME       [%-7s] larger model to re-decode uncertain segments with\n", params.cascade_model.c_str());
+    fprintf(stderr, "  -clpt N,   --cascade-logprob-thold N   [%-7.2f] re-decode below this average token log probability\n", params.cascade_logprob_thold);
+    fprintf(stderr, "  -cet N,    --cascade-entropy-thold N   [%-7.2f] re-decode below this token entropy (repetitions)\n", params.cascade_entropy_thold);
+    fprintf(stderr, "  -cnth N,   --cascade-no-speech-thold N [%-7.2f] re-decode above this no speech probability\n", params.cascade_no_speech_thold);
+    fprintf(stderr, "  -cp N,     --cascade-pad-ms N          [%-7d] audio context around a re-decoded segment\n", params.cascade_pad_ms);
     fprintf(stderr, "\n");
 }
 
@@ -299,7 +372,7 @@ struct whisper_print_user_data {
     int progress_prev;
 };
 
-static std::string estimate_diarization_speaker(std::vector<std::vector<float>> pcmf32s, int64_t t0, int64_t t1, bool id_only = false) {
+static std::string estimate_diarization_speaker(const std::vector<std::vector<float>> & pcmf32s, int64_t t0, int64_t t1, bool id_only = false) {
     std::string speaker = "";
     const int64_t n_samples = pcmf32s[0].size();
 
@@ -341,11 +414,11 @@ static void whisper_print_progress_callback(struct whisper_context * /*ctx*/, st
     }
 }
 
-static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
     const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -361,8 +434,8 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
@@ -374,15 +447,15 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
         }
 
         if (params.print_colors) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
                 const float  p    = whisper_full_get_token_p   (ctx, i, j);
 
                 const int col = std::max(0, std::min((int) k_colors.size() - 1, (int) (std::pow(p, 3)*float(k_colors.size()))));
@@ -390,15 +463,15 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
                 printf("%s%s%s%s", speaker.c_str(), k_colors[col].c_str(), text, "\033[0m");
             }
         } else if (params.print_confidence) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
                 const float  p    = whisper_full_get_token_p   (ctx, i, j);
 
                 int style_idx = 2;     // High confidence - dim
@@ -410,13 +483,13 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
                 printf("%s%s%s%s", speaker.c_str(), k_styles[style_idx].c_str(), text, "\033[0m");
             }
         } else {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
 
             printf("%s%s", speaker.c_str(), text);
         }
 
         if (params.tinydiarize) {
-            if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+            if (whisper_full_get_segment_speaker_turn_next_from_state(state, i)) {
                 printf("%s", params.tdrz_speaker_turn.c_str());
             }
         }
@@ -430,16 +503,16 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
     }
 }
 
-static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
+static void output_txt(struct whisper_context * /*ctx*/, struct whisper_state * state, std::ofstream & fout, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
             speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
         }
 
@@ -447,14 +520,14 @@ static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
-static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_vtt(struct whisper_context * /*ctx*/, struct whisper_state * state, std::ofstream & fout, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
     fout << "WEBVTT\n\n";
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
@@ -469,12 +542,12 @@ static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
-static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
+static void output_srt(struct whisper_context * /*ctx*/, struct whisper_state * state, std::ofstream & fout, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
@@ -551,8 +624,8 @@ static char * escape_double_quotes_in_csv(const char * str) {
     return escaped;
 }
 
-static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
+static void output_csv(struct whisper_context * /*ctx*/, struct whisper_state * state, std::ofstream & fout, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
     fout << "start,end,";
     if (params.diarize && pcmf32s.size() == 2)
     {
@@ -561,9 +634,9 @@ static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const
     fout << "text\n";
 
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
         char * text_escaped = escape_double_quotes_in_csv(text);
 
         //need to multiply times returned from whisper_full_get_segment_t{0,1}() by 10 to get milliseconds.
@@ -576,15 +649,15 @@ static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
-static void output_score(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & /*params*/, std::vector<std::vector<float>> /*pcmf32s*/) {
-    const int n_segments = whisper_full_n_segments(ctx);
+static void output_score(struct whisper_context * ctx, struct whisper_state * state, std::ofstream & fout, const whisper_params & /*params*/, const std::vector<std::vector<float>> & /*pcmf32s*/) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
     // fprintf(stderr,"segments: %d\n",n_segments);
     for (int i = 0; i < n_segments; ++i) {
-        const int n_tokens = whisper_full_n_tokens(ctx, i);
+        const int n_tokens = whisper_full_n_tokens_from_state(state, i);
         // fprintf(stderr,"tokens: %d\n",n_tokens);
         for (int j = 0; j < n_tokens; j++) {
-            auto token = whisper_full_get_token_text(ctx, i, j);
-            auto probability = whisper_full_get_token_p(ctx, i, j);
+            auto token = whisper_full_get_token_text_from_state(ctx, state, i, j);
+            auto probability = whisper_full_get_token_p_from_state(state, i, j);
             fout << token << '\t' << probability << std::endl;
             // fprintf(stderr,"token: %s %f\n",token,probability);
 	    }
@@ -593,9 +666,10 @@ static void output_score(struct whisper_context * ctx, std::ofstream & fout, con
 
 static void output_json(
              struct whisper_context * ctx,
+               struct whisper_state * state,
                       std::ofstream & fout,
                const whisper_params & params,
-    std::vector<std::vector<float>>   pcmf32s) {
+    const std::vector<std::vector<float>> & pcmf32s) {
     const bool full = params.output_jsn_full;
     int indent = 0;
 
@@ -703,16 +777,16 @@ static void output_json(
             value_b("translate", params.translate, true);
         end_obj(false);
         start_obj("result");
-            value_s("language", whisper_lang_str(whisper_full_lang_id(ctx)), true);
+            value_s("language", whisper_lang_str(whisper_full_lang_id_from_state(state)), true);
         end_obj(false);
         start_arr("transcription");
 
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
+                const char * text = whisper_full_get_segment_text_from_state(state, i);
 
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+                const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
 
                 start_obj(nullptr);
                     times_o(t0, t1, false);
@@ -720,9 +794,9 @@ static void output_json(
 
                     if (full) {
                         start_arr("tokens");
-                        const int n = whisper_full_n_tokens(ctx, i);
+                        const int n = whisper_full_n_tokens_from_state(state, i);
                         for (int j = 0; j < n; ++j) {
-                            auto token = whisper_full_get_token_data(ctx, i, j);
+                            auto token = whisper_full_get_token_data_from_state(state, i, j);
                             start_obj(nullptr);
                                 value_s("text", whisper_token_to_str(ctx, token.id), false);
                                 if(token.t0 > -1 && token.t1 > -1) {
@@ -742,7 +816,7 @@ static void output_json(
                     }
 
                     if (params.tinydiarize) {
-                        value_b("speaker_turn_next", whisper_full_get_segment_speaker_turn_next(ctx, i), true);
+                        value_b("speaker_turn_next", whisper_full_get_segment_speaker_turn_next_from_state(state, i), true);
                     }
                 end_obj(i == (n_segments - 1));
             }
@@ -754,7 +828,7 @@ static void output_json(
 // karaoke video generation
 // outputs a bash script that uses ffmpeg to generate a video with the subtitles
 // TODO: font parameter adjustments
-static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const char * fname_inp, float t_sec, const char * fname_out) {
+static bool output_wts(struct whisper_context * ctx, struct whisper_state * state, std::ofstream & fout, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s, const char * fname_inp, float t_sec, const char * fname_out) {
     static const char * font = params.font_path.c_str();
 
     std::ifstream fin(font);
@@ -768,15 +842,15 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
 
     fout << "ffmpeg -i " << fname_inp << " -f lavfi -i color=size=1200x120:duration=" << t_sec << ":rate=25:color=black -vf \"";
 
-    for (int i = 0; i < whisper_full_n_segments(ctx); i++) {
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+    for (int i = 0; i < whisper_full_n_segments_from_state(state); i++) {
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
 
-        const int n = whisper_full_n_tokens(ctx, i);
+        const int n = whisper_full_n_tokens_from_state(state, i);
 
         std::vector<whisper_token_data> tokens(n);
         for (int j = 0; j < n; ++j) {
-            tokens[j] = whisper_full_get_token_data(ctx, i, j);
+            tokens[j] = whisper_full_get_token_data_from_state(state, i, j);
         }
 
         if (i > 0) {
@@ -875,13 +949,13 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
     return true;
 }
 
-static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_lrc(struct whisper_context * /*ctx*/, struct whisper_state * state, std::ofstream & fout, const whisper_params & params, const std::vector<std::vector<float>> & pcmf32s) {
     fout << "[by:whisper.cpp]\n";
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t = whisper_full_get_segment_t0(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t = whisper_full_get_segment_t0_from_state(state, i);
 
         int64_t msec = t * 10;
         int64_t min = msec / (1000 * 60);
@@ -896,8 +970,8 @@ static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const
 
         if (params.diarize && pcmf32s.size() == 2)
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
             speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
         }
 
@@ -905,6 +979,353 @@ static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
+struct fout_factory {
+    std::string fname_out;
+    const size_t basename_length;
+    const bool is_stdout;
+    bool used_stdout;
+    decltype(whisper_print_segment_callback) * const print_segment_callback;
+    std::ofstream fout;
+
+    fout_factory (const std::string & fname_out_, const std::string & fname_inp, whisper_params & params) :
+            fname_out{!fname_out_.empty() ? fname_out_ : fname_inp},
+            basename_length{fname_out.size()},
+            is_stdout{fname_out == "-"},
+            used_stdout{},
+            print_segment_callback{is_stdout ? nullptr : whisper_print_segment_callback} {
+        if (!print_segment_callback) {
+            params.print_progress = false;
+        }
+    }
+
+    bool open(const char * ext, const char * function) {
+        if (is_stdout) {
+            if (used_stdout) {
+                fprintf(stderr, "warning: Not appending multiple file formats to stdout\n");
+                return false;
+            }
+
+            used_stdout = true;
+#ifdef _WIN32
+            fout = std::ofstream{"CON"};
+#else
+            fout = std::ofstream{"/dev/stdout"};
+#endif
+            // Not using fprintf stderr here because it might equal stdout
+            // Also assuming /dev is mounted
+            return true;
+        }
+
+        fname_out.resize(basename_length);
+        fname_out += ext;
+        fout = std::ofstream{fname_out};
+        if (!fout.is_open()) {
+            fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
+            return false;
+        }
+        fprintf(stderr, "%s: saving output to '%s'\n", function, fname_out.c_str());
+        return true;
+    }
+};
+
+// the decoding parameters shared by all input files
+// grammar_rules must outlive the returned parameters
+static whisper_full_params whisper_full_params_from(const whisper_params & params, std::vector<const whisper_grammar_element *> & grammar_rules) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    const bool use_grammar = (!params.grammar_parsed.rules.empty() && !params.grammar_rule.empty());
+    wparams.strategy = (params.beam_size > 1 || use_grammar) ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
+
+    wparams.print_realtime   = false;
+    wparams.print_progress   = params.print_progress;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.print_special    = params.print_special;
+    wparams.translate        = params.translate;
+    wparams.language         = params.language.c_str();
+    wparams.detect_language  = params.detect_language;
+    wparams.n_threads        = params.n_threads;
+    wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
+    wparams.offset_ms        = params.offset_t_ms;
+    wparams.duration_ms      = params.duration_ms;
+
+    wparams.token_timestamps = params.output_wts || params.output_jsn_full || params.max_len > 0;
+    wparams.thold_pt         = params.word_thold;
+    wparams.max_len          = params.output_wts && params.max_len == 0 ? 60 : params.max_len;
+    wparams.split_on_word    = params.split_on_word;
+    wparams.audio_ctx        = params.audio_ctx;
+
+    wparams.debug_mode       = params.debug_mode;
+
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+
+    wparams.suppress_regex   = params.suppress_regex.empty() ? nullptr : params.suppress_regex.c_str();
+
+    wparams.vocab_shortlist   = params.vocab_shortlist.empty() ? nullptr : params.vocab_shortlist.data();
+    wparams.vocab_shortlist_n = params.vocab_shortlist.size();
+
+    wparams.initial_prompt   = params.prompt.c_str();
+
+    wparams.greedy.best_of        = params.best_of;
+    wparams.beam_search.beam_size = params.beam_size;
+
+    wparams.temperature_inc  = params.no_fallback ? 0.0f : params.temperature_inc;
+    wparams.temperature      = params.temperature;
+
+    wparams.entropy_thold    = params.entropy_thold;
+    wparams.logprob_thold    = params.logprob_thold;
+    wparams.no_speech_thold  = params.no_speech_thold;
+
+    wparams.no_timestamps    = params.no_timestamps;
+
+    wparams.suppress_nst     = params.suppress_nst;
+
+    wparams.vad            = params.vad;
+    wparams.vad_model_path = params.vad_model.c_str();
+
+    wparams.vad_params.threshold               = params.vad_threshold;
+    wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
+    wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
+    wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
+    wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
+    wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+
+    const auto & grammar_parsed = params.grammar_parsed;
+    if (use_grammar) {
+        if (grammar_parsed.symbol_ids.find(params.grammar_rule) == grammar_parsed.symbol_ids.end()) {
+            fprintf(stderr, "%s: warning: grammar rule '%s' not found - skipping grammar sampling\n", __func__, params.grammar_rule.c_str());
+        } else {
+            wparams.grammar_rules = grammar_rules.data();
+            wparams.n_grammar_rules = grammar_rules.size();
+            wparams.i_start_rule = grammar_parsed.symbol_ids.at(params.grammar_rule);
+            wparams.grammar_penalty = params.grammar_penalty;
+        }
+    }
+
+    return wparams;
+}
+
+// write the requested output files of one input
+static void output_results(
+      struct whisper_context * ctx,
+        struct whisper_state * state,
+        const whisper_params & params,
+                fout_factory & fout_factory,
+           const std::string & fname_inp,
+    const std::vector<std::vector<float>> & pcmf32s,
+                      int64_t n_samples) {
+    // macros to stringify function name
+#define output_func(func, ext, param, ...) if (param && fout_factory.open(ext, #func)) {\
+    func(ctx, state, fout_factory.fout, params, __VA_ARGS__); \
+}
+#define output_ext(ext, ...) output_func(output_##ext, "." #ext, params.output_##ext, __VA_ARGS__)
+
+    output_ext(txt, pcmf32s);
+    output_ext(vtt, pcmf32s);
+    output_ext(srt, pcmf32s);
+    output_ext(wts, pcmf32s, fname_inp.c_str(), float(n_samples + 1000)/WHISPER_SAMPLE_RATE, fout_factory.fname_out.c_str());
+    output_ext(csv, pcmf32s);
+    output_func(output_json, ".json", params.output_jsn, pcmf32s);
+    output_ext(lrc, pcmf32s);
+    output_func(output_score, ".score.txt", params.log_score, pcmf32s);
+
+#undef output_ext
+#undef output_func
+
+    if (fout_factory.is_stdout && !fout_factory.used_stdout) {
+        fprintf(stderr, "warning: '--output-file -' used without any other '--output-*'");
+    }
+}
+
+// batch mode: a pool of states over the same model transcribes --jobs files at a time
+// a loader thread decodes the next files, longest first so that the workers finish at about the same time,
+// and the calling thread writes the outputs, so that neither decoding nor writing holds up the inference
+static int run_batch(struct whisper_context * ctx, whisper_params & params, std::vector<const whisper_grammar_element *> & grammar_rules) {
+    struct batch_job {
+        int f;
+
+        std::vector<float> pcmf32;               // mono-channel F32 PCM, released after the inference
+        std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
+        int64_t n_samples = 0;
+
+        bool ok = false;
+        whisper_state * state = nullptr;
+    };
+
+    const int n_files = params.fname_inp.size();
+    const int n_jobs  = std::min(params.n_jobs, n_files);
+
+    // the file size is a good enough proxy for the duration
+    std::vector<int64_t> fsize(n_files, 0);
+    for (int f = 0; f < n_files; ++f) {
+        if (params.fname_inp[f] != "-") {
+            std::ifstream fin(params.fname_inp[f], std::ios::binary | std::ios::ate);
+            fsize[f] = fin.is_open() ? (int64_t) fin.tellg() : 0;
+        }
+    }
+
+    std::vector<int> order(n_files);
+    for (int f = 0; f < n_files; ++f) {
+        order[f] = f;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return fsize[a] > fsize[b]; });
+
+    // one state more than workers, so that a worker does not wait for the writer to release one
+    std::vector<whisper_state *> states;
+    for (int i = 0; i < n_jobs + 1; ++i) {
+        whisper_state * state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper state\n");
+            for (auto * st : states) {
+                whisper_free_state(st);
+            }
+            return 3;
+        }
+        whisper_ctx_init_openvino_encoder_with_state(ctx, state, nullptr, params.openvino_encode_device.c_str(), nullptr);
+        states.push_back(state);
+    }
+
+    const whisper_full_params wparams = whisper_full_params_from(params, grammar_rules);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::deque<std::unique_ptr<batch_job>> decoded;     // loader -> workers
+    std::deque<std::unique_ptr<batch_job>> transcribed; // workers -> writer
+    std::vector<whisper_state *> states_free = states;
+
+    bool loaded_all = false;
+
+    const int64_t t_start_us = ggml_time_us();
+
+    std::thread loader([&]() {
+        for (int f : order) {
+            auto job = std::make_unique<batch_job>();
+            job->f  = f;
+            job->ok = ::read_audio_data(params.fname_inp[f], job->pcmf32, job->pcmf32s, params.diarize);
+            job->n_samples = job->pcmf32.size();
+            if (!job->ok) {
+                fprintf(stderr, "error: failed to read audio file '%s'\n", params.fname_inp[f].c_str());
+            }
+
+            // stay at most one file per worker ahead
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return (int) decoded.size() < n_jobs; });
+            decoded.push_back(std::move(job));
+            cv.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded_all = true;
+        cv.notify_all();
+    });
+
+    auto worker = [&]() {
+        while (true) {
+            std::unique_ptr<batch_job> job;
+            whisper_state * state = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return (!decoded.empty() && !states_free.empty()) || (decoded.empty() && loaded_all); });
+                if (decoded.empty()) {
+                    break;
+                }
+
+                job = std::move(decoded.front());
+                decoded.pop_front();
+
+                if (job->ok) {
+                    state = states_free.back();
+                    states_free.pop_back();
+                }
+                cv.notify_all();
+            }
+
+            if (job->ok) {
+                if (whisper_full_with_state(ctx, state, wparams, job->pcmf32.data(), job->pcmf32.size()) != 0) {
+                    fprintf(stderr, "error: failed to process audio file '%s'\n", params.fname_inp[job->f].c_str());
+                    job->ok = false;
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    states_free.push_back(state);
+                } else {
+                    job->state = state;
+                }
+                std::vector<float>().swap(job->pcmf32);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            transcribed.push_back(std::move(job));
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_jobs; ++i) {
+        workers.emplace_back(worker);
+    }
+
+    int ret = 0;
+    int64_t n_samples_total = 0;
+
+    for (int i = 0; i < n_files; ++i) {
+        std::unique_ptr<batch_job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return !transcribed.empty(); });
+            job = std::move(transcribed.front());
+            transcribed.pop_front();
+        }
+
+        if (!job->ok) {
+            ret = 10;
+            continue;
+        }
+
+        const auto & fname_inp = params.fname_inp[job->f];
+
+        if (!params.no_prints) {
+            fprintf(stderr, "%s: transcribed '%s' (%.1f sec)\n", __func__, fname_inp.c_str(), float(job->n_samples)/WHISPER_SAMPLE_RATE);
+        }
+
+        fout_factory fout_factory{job->f < (int) params.fname_out.size() ? params.fname_out[job->f] : "", fname_inp, params};
+
+        if (fout_factory.print_segment_callback) {
+            whisper_print_user_data user_data = { &params, &job->pcmf32s, 0 };
+            fout_factory.print_segment_callback(ctx, job->state, whisper_full_n_segments_from_state(job->state), &user_data);
+        }
+
+        output_results(ctx, job->state, params, fout_factory, fname_inp, job->pcmf32s, job->n_samples);
+
+        n_samples_total += job->n_samples;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        states_free.push_back(job->state);
+        cv.notify_all();
+    }
+
+    loader.join();
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    if (!params.no_prints) {
+        // the default state of ctx is not used, the timings are in the pool
+        for (int i = 0; i < (int) states.size(); ++i) {
+            fprintf(stderr, "\n%s: state %d:\n", __func__, i);
+            whisper_print_timings_with_state(ctx, states[i]);
+        }
+
+        const float t_sec = (ggml_time_us() - t_start_us)/1e6f;
+        fprintf(stderr, "\n%s: transcribed %d files (%.1f sec of audio) in %.1f sec with %d jobs, RTF = %.3f\n", __func__,
+                n_files, float(n_samples_total)/WHISPER_SAMPLE_RATE, t_sec, n_jobs, t_sec*WHISPER_SAMPLE_RATE/std::max<int64_t>(1, n_samples_total));
+    }
+
+    for (auto * state : states) {
+        whisper_free_state(state);
+    }
+
+    return ret;
+}
 
 static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
 
@@ -994,6 +1415,26 @@ int main(int argc, char ** argv) {
 
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
+    cparams.type_k     = ggml_parse_type(params.cache_type_k.c_str());
+    cparams.type_v     = ggml_parse_type(params.cache_type_v.c_str());
+    cparams.cpu_mask   = params.cpu_mask.empty() ? nullptr : params.cpu_mask.c_str();
+    cparams.cpu_strict = params.cpu_strict;
+    cparams.cpu_prio   = params.cpu_prio;
+    cparams.cpu_poll   = params.cpu_poll;
+
+    cparams.repack_cache = params.repack_cache.empty() ? nullptr : params.repack_cache.c_str();
+    cparams.rpc_server   = params.rpc_server.empty()   ? nullptr : params.rpc_server.c_str();
+
+    if (params.trace_ops) {
+        cparams.trace = WHISPER_TRACE_OPS;
+    } else if (!params.trace.empty()) {
+        cparams.trace = WHISPER_TRACE_GRAPHS;
+    }
+
+    if (cparams.type_k == GGML_TYPE_COUNT || cparams.type_v == GGML_TYPE_COUNT) {
+        fprintf(stderr, "error: unknown KV cache type '%s' / '%s'\n", params.cache_type_k.c_str(), params.cache_type_v.c_str());
+        return 3;
+    }
 
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
@@ -1028,6 +1469,28 @@ int main(int argc, char ** argv) {
     // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
     whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
 
+    // the larger model of the cascade - the repack cache and the DTW heads belong to the first model
+    struct whisper_context * ctx_cascade = nullptr;
+
+    if (!params.cascade_model.empty()) {
+        cparams.repack_cache         = nullptr;
+        cparams.dtw_token_timestamps = false;
+
+        ctx_cascade = whisper_init_from_file_with_params(params.cascade_model.c_str(), cparams);
+
+        if (ctx_cascade == nullptr) {
+            fprintf(stderr, "error: failed to initialize the cascade whisper context\n");
+            return 3;
+        }
+
+        if (params.n_processors > 1 || params.audio_window_ms > 0 || params.n_jobs > 1) {
+            fprintf(stderr, "%s: WARNING: --processors, --audio-window and --jobs are ignored with --cascade-model\n", __func__);
+            params.n_processors    = 1;
+            params.audio_window_ms = 0;
+            params.n_jobs          = 1;
+        }
+    }
+
     if (!params.grammar.empty()) {
         auto & grammar = params.grammar_parsed;
         if (is_file_exist(params.grammar.c_str())) {
@@ -1043,6 +1506,8 @@ int main(int argc, char ** argv) {
         // will be empty (default) if there are parse errors
         if (grammar.rules.empty()) {
             fprintf(stderr, "error: failed to parse grammar \"%s\"\n", params.grammar.c_str());
+            whisper_free(ctx_cascade);
+            whisper_free(ctx);
             return 4;
         } else {
             fprintf(stderr, "%s: grammar:\n", __func__);
@@ -1051,74 +1516,97 @@ int main(int argc, char ** argv) {
         }
     }
 
-    for (int f = 0; f < (int) params.fname_inp.size(); ++f) {
-        const auto & fname_inp = params.fname_inp[f];
-        struct fout_factory {
-            std::string fname_out;
-            const size_t basename_length;
-            const bool is_stdout;
-            bool used_stdout;
-            decltype(whisper_print_segment_callback) * const print_segment_callback;
-            std::ofstream fout;
-
-            fout_factory (const std::string & fname_out_, const std::string & fname_inp, whisper_params & params) :
-                    fname_out{!fname_out_.empty() ? fname_out_ : fname_inp},
-                    basename_length{fname_out.size()},
-                    is_stdout{fname_out == "-"},
-                    used_stdout{},
-                    print_segment_callback{is_stdout ? nullptr : whisper_print_segment_callback} {
-                if (!print_segment_callback) {
-                    params.print_progress = false;
-                }
-            }
+    if (!params.vocab_shortlist_file.empty()) {
+        std::ifstream ifs(params.vocab_shortlist_file);
+        if (!ifs) {
+            fprintf(stderr, "error: failed to open vocabulary shortlist '%s'\n", params.vocab_shortlist_file.c_str());
+            whisper_free(ctx_cascade);
+            whisper_free(ctx);
+            return 4;
+        }
 
-            bool open(const char * ext, const char * function) {
-                if (is_stdout) {
-                    if (used_stdout) {
-                        fprintf(stderr, "warning: Not appending multiple file formats to stdout\n");
-                        return false;
-                    }
+        std::vector<whisper_token> tokens(whisper_n_text_ctx(ctx));
 
-                    used_stdout = true;
-#ifdef _WIN32
-                    fout = std::ofstream{"CON"};
-#else
-                    fout = std::ofstream{"/dev/stdout"};
-#endif
-                    // Not using fprintf stderr here because it might equal stdout
-                    // Also assuming /dev is mounted
-                    return true;
-                }
+        std::string line;
+        while (std::getline(ifs, line)) {
+            if (line.empty()) {
+                continue;
+            }
 
-                fname_out.resize(basename_length);
-                fname_out += ext;
-                fout = std::ofstream{fname_out};
-                if (!fout.is_open()) {
-                    fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
-                    return false;
+            // the tokens of a word differ at the start of the text and after a space
+            for (const auto & text : { line, " " + line }) {
+                const int n = whisper_tokenize(ctx, text.c_str(), tokens.data(), tokens.size());
+                if (n > 0) {
+                    params.vocab_shortlist.insert(params.vocab_shortlist.end(), tokens.begin(), tokens.begin() + n);
                 }
-                fprintf(stderr, "%s: saving output to '%s'\n", function, fname_out.c_str());
-                return true;
             }
-        } fout_factory{f < (int) params.fname_out.size() ? params.fname_out[f] : "", fname_inp, params};
+        }
 
-        std::vector<float> pcmf32;               // mono-channel F32 PCM
-        std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
+        fprintf(stderr, "%s: vocabulary shortlist of %zu tokens from '%s'\n", __func__, params.vocab_shortlist.size(), params.vocab_shortlist_file.c_str());
+    }
 
-        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
-            fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
-            continue;
+    auto grammar_rules = params.grammar_parsed.c_rules();
+
+    if (!whisper_is_multilingual(ctx)) {
+        if (params.language != "en" || params.translate) {
+            params.language = "en";
+            params.translate = false;
+            fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
+        }
+    }
+    if (params.detect_language) {
+        params.language = "auto";
+    }
+
+    if (params.n_jobs > 1 && params.fname_inp.size() > 1) {
+        if (params.n_processors > 1 || params.audio_window_ms > 0) {
+            fprintf(stderr, "%s: WARNING: --processors and --audio-window are ignored with --jobs\n", __func__);
+        }
+        if (cparams.trace != WHISPER_TRACE_NONE) {
+            fprintf(stderr, "%s: WARNING: --trace and --trace-ops are ignored with --jobs\n", __func__);
+        }
+
+        if (!params.no_prints) {
+            fprintf(stderr, "\n");
+            fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
+                    params.n_threads*params.n_jobs, std::thread::hardware_concurrency(), whisper_print_system_info());
+            fprintf(stderr, "\n");
+            fprintf(stderr, "%s: processing %d files, %d jobs of %d threads, lang = %s, task = %s ...\n",
+                    __func__, (int) params.fname_inp.size(), params.n_jobs, params.n_threads,
+                    params.language.c_str(), params.translate ? "translate" : "transcribe");
+            fprintf(stderr, "\n");
         }
 
-        if (!whisper_is_multilingual(ctx)) {
-            if (params.language != "en" || params.translate) {
-                params.language = "en";
-                params.translate = false;
-                fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
+        const int ret = run_batch(ctx, params, grammar_rules);
+
+        whisper_free(ctx_cascade);
+        whisper_free(ctx);
+
+        return ret;
+    }
+
+    for (int f = 0; f < (int) params.fname_inp.size(); ++f) {
+        const auto & fname_inp = params.fname_inp[f];
+
+        fout_factory fout_factory{f < (int) params.fname_out.size() ? params.fname_out[f] : "", fname_inp, params};
+
+        std::vector<float> pcmf32;               // mono-channel F32 PCM
+        std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
+
+        // with --audio-window the input is decoded while it is being transcribed instead of up front
+        audio_reader * reader = nullptr;
+        if (params.audio_window_ms > 0) {
+            if (params.diarize || params.n_processors > 1) {
+                fprintf(stderr, "%s: WARNING: --audio-window is not supported with --diarize or --processors > 1, reading the whole input\n", __func__);
+            } else if ((reader = audio_reader_open(fname_inp)) == nullptr) {
+                fprintf(stderr, "error: failed to open audio file '%s'\n", fname_inp.c_str());
+                continue;
             }
         }
-        if (params.detect_language) {
-            params.language = "auto";
+
+        if (reader == nullptr && !::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
+            fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
+            continue;
         }
 
         if (!params.no_prints) {
@@ -1129,8 +1617,12 @@ int main(int argc, char ** argv) {
 
             // print some info about the processing
             fprintf(stderr, "\n");
-            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+            if (reader) {
+                fprintf(stderr, "%s: processing '%s' (in %.1f sec windows), ", __func__, fname_inp.c_str(), params.audio_window_ms/1000.0f);
+            } else {
+                fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), ", __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE);
+            }
+            fprintf(stderr, "%d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
                     params.n_threads, params.n_processors, params.beam_size, params.best_of,
                     params.language.c_str(),
                     params.translate ? "translate" : "transcribe",
@@ -1145,79 +1637,15 @@ int main(int argc, char ** argv) {
             fprintf(stderr, "\n");
         }
 
+        // number of input samples, only known at the end when the input is read in windows
+        int64_t n_samples = pcmf32.size();
+
         // run the inference
         {
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            const bool use_grammar = (!params.grammar_parsed.rules.empty() && !params.grammar_rule.empty());
-            wparams.strategy = (params.beam_size > 1 || use_grammar) ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
-
-            wparams.print_realtime   = false;
-            wparams.print_progress   = params.print_progress;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.print_special    = params.print_special;
-            wparams.translate        = params.translate;
-            wparams.language         = params.language.c_str();
-            wparams.detect_language  = params.detect_language;
-            wparams.n_threads        = params.n_threads;
-            wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
-            wparams.offset_ms        = params.offset_t_ms;
-            wparams.duration_ms      = params.duration_ms;
-
-            wparams.token_timestamps = params.output_wts || params.output_jsn_full || params.max_len > 0;
-            wparams.thold_pt         = params.word_thold;
-            wparams.max_len          = params.output_wts && params.max_len == 0 ? 60 : params.max_len;
-            wparams.split_on_word    = params.split_on_word;
-            wparams.audio_ctx        = params.audio_ctx;
-
-            wparams.debug_mode       = params.debug_mode;
-
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
-
-            wparams.suppress_regex   = params.suppress_regex.empty() ? nullptr : params.suppress_regex.c_str();
-
-            wparams.initial_prompt   = params.prompt.c_str();
-
-            wparams.greedy.best_of        = params.best_of;
-            wparams.beam_search.beam_size = params.beam_size;
-
-            wparams.temperature_inc  = params.no_fallback ? 0.0f : params.temperature_inc;
-            wparams.temperature      = params.temperature;
-
-            wparams.entropy_thold    = params.entropy_thold;
-            wparams.logprob_thold    = params.logprob_thold;
-            wparams.no_speech_thold  = params.no_speech_thold;
-
-            wparams.no_timestamps    = params.no_timestamps;
-
-            wparams.suppress_nst     = params.suppress_nst;
-
-            wparams.vad            = params.vad;
-            wparams.vad_model_path = params.vad_model.c_str();
-
-            wparams.vad_params.threshold               = params.vad_threshold;
-            wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
-            wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
-            wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
-            wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
-            wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+            whisper_full_params wparams = whisper_full_params_from(params, grammar_rules);
 
             whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
 
-            const auto & grammar_parsed = params.grammar_parsed;
-            auto grammar_rules = grammar_parsed.c_rules();
-
-            if (use_grammar) {
-                if (grammar_parsed.symbol_ids.find(params.grammar_rule) == grammar_parsed.symbol_ids.end()) {
-                    fprintf(stderr, "%s: warning: grammar rule '%s' not found - skipping grammar sampling\n", __func__, params.grammar_rule.c_str());
-                } else {
-                    wparams.grammar_rules = grammar_rules.data();
-                    wparams.n_grammar_rules = grammar_rules.size();
-                    wparams.i_start_rule = grammar_parsed.symbol_ids.at(params.grammar_rule);
-                    wparams.grammar_penalty = params.grammar_penalty;
-                }
-            }
-
             // this callback is called on each new segment
             if (!wparams.print_realtime) {
                 wparams.new_segment_callback           = fout_factory.print_segment_callback;
@@ -1254,41 +1682,72 @@ int main(int argc, char ** argv) {
                 wparams.abort_callback_user_data = &is_aborted;
             }
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            if (reader) {
+                const auto read_callback = [](float * samples, int n_max, void * user_data) {
+                    return audio_reader_read((audio_reader *) user_data, samples, n_max);
+                };
+
+                const int ret = whisper_full_from_reader(ctx, wparams, read_callback, reader, params.audio_window_ms);
+
+                n_samples = audio_reader_n_samples(reader);
+                audio_reader_close(reader);
+
+                if (ret != 0) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    whisper_free(ctx_cascade);
+                    whisper_free(ctx);
+                    return 10;
+                }
+            } else if (ctx_cascade) {
+                whisper_cascade_params cascade_params = whisper_cascade_default_params();
+
+                cascade_params.logprob_thold   = params.cascade_logprob_thold;
+                cascade_params.entropy_thold   = params.cascade_entropy_thold;
+                cascade_params.no_speech_thold = params.cascade_no_speech_thold;
+                cascade_params.pad_ms          = params.cascade_pad_ms;
+
+                if (whisper_full_cascade(ctx, ctx_cascade, wparams, cascade_params, pcmf32.data(), pcmf32.size()) != 0) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    whisper_free(ctx_cascade);
+                    whisper_free(ctx);
+                    return 10;
+                }
+            } else if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                whisper_free(ctx_cascade);
+                whisper_free(ctx);
                 return 10;
             }
         }
 
-        // output stuff
-        {
-            // macros to stringify function name
-#define output_func(func, ext, param, ...) if (param && fout_factory.open(ext, #func)) {\
-    func(ctx, fout_factory.fout, params, __VA_ARGS__); \
-}
-#define output_ext(ext, ...) output_func(output_##ext, "." #ext, params.output_##ext, __VA_ARGS__)
-
-            output_ext(txt, pcmf32s);
-            output_ext(vtt, pcmf32s);
-            output_ext(srt, pcmf32s);
-            output_ext(wts, pcmf32s, fname_inp.c_str(), float(pcmf32.size() + 1000)/WHISPER_SAMPLE_RATE, fout_factory.fname_out.c_str());
-            output_ext(csv, pcmf32s);
-            output_func(output_json, ".json", params.output_jsn, pcmf32s);
-            output_ext(lrc, pcmf32s);
-            output_func(output_score, ".score.txt", params.log_score, pcmf32s);
+        output_results(ctx, whisper_get_state(ctx), params, fout_factory, fname_inp, pcmf32s, n_samples);
+    }
 
-#undef output_ext
-#undef output_func
+    if (!params.no_prints) {
+        whisper_print_timings(ctx);
 
-            if (fout_factory.is_stdout && !fout_factory.used_stdout) {
-                fprintf(stderr, "warning: '--output-file -' used without any other '--output-*'");
-            }
+        if (ctx_cascade) {
+            fprintf(stderr, "\n%s: cascade model:\n", __func__);
+            whisper_print_timings(ctx_cascade);
         }
     }
 
-    if (!params.no_prints) {
-        whisper_print_timings(ctx);
+    if (cparams.trace != WHISPER_TRACE_NONE) {
+        fprintf(stderr, "\n%s", whisper_trace_summary(ctx));
+
+        if (ctx_cascade) {
+            fprintf(stderr, "\n%s: cascade model:\n%s", __func__, whisper_trace_summary(ctx_cascade));
+        }
+
+        if (!params.trace.empty()) {
+            if (whisper_trace_save_chrome(ctx, params.trace.c_str())) {
+                fprintf(stderr, "%s: saved the trace to '%s'\n", __func__, params.trace.c_str());
+            } else {
+                fprintf(stderr, "%s: failed to save the trace to '%s'\n", __func__, params.trace.c_str());
+            }
+        }
     }
+    whisper_free(ctx_cascade);
     whisper_free(ctx);
 
     return 0;
@@ -289,6 +289,12 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
         max_len = std::max(max_len, (int) cmd.size());
     }
 
+    // only the allowed tokens are scored, so the output layer of the decoder is restricted to them
+    std::vector<whisper_token> vocab_shortlist;
+    for (const auto & tokens : allowed_tokens) {
+        vocab_shortlist.insert(vocab_shortlist.end(), tokens.begin(), tokens.end());
+    }
+
     fprintf(stderr, "%s: allowed commands [ tokens ]:\n", __func__);
     fprintf(stderr, "\n");
     for (int i = 0; i < (int) allowed_commands.size(); ++i) {
@@ -337,19 +343,19 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
     std::vector<float> pcmf32_cur;
     std::vector<float> pcmf32_prompt;
 
+    audio_vad vad(audio, 2000, 1000, params.freq_thold);
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
         is_running = sdl_poll_events();
 
-        // delay
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-        audio.get(2000, pcmf32_cur);
-
-        if (::vad_simple(pcmf32_cur, WHISPER_SAMPLE_RATE, 1000, params.vad_thold, params.freq_thold, params.print_energy)) {
+        // wait for new audio
+        if (vad.poll(params.vad_thold, params.print_energy)) {
             fprintf(stdout, "%s: Speech detected! Processing ...\n", __func__);
 
+            audio.get(2000, pcmf32_cur);
+
             const auto t_start = std::chrono::high_resolution_clock::now();
 
             whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
@@ -370,6 +376,9 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
             wparams.prompt_tokens    = k_tokens.data();
             wparams.prompt_n_tokens  = k_tokens.size();
 
+            wparams.vocab_shortlist   = vocab_shortlist.data();
+            wparams.vocab_shortlist_n = vocab_shortlist.size();
+
             // run the transformer and a single decoding pass
             if (whisper_full(ctx, wparams, pcmf32_cur.data(), pcmf32_cur.size()) != 0) {
                 fprintf(stderr, "%s: ERROR: whisper_full() failed\n", __func__);
@@ -458,6 +467,7 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
             }
 
             audio.clear();
+            vad.reset();
         }
     }
 
@@ -483,14 +493,13 @@ static int always_prompt_transcription(struct whisper_context * ctx, audio_async
     fprintf(stderr, "\n");
     fprintf(stderr, "%s: always-prompt mode\n", __func__);
 
+    audio_vad vad(audio, 2000, 1000, params.freq_thold);
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
         is_running = sdl_poll_events();
 
-        // delay
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
         if (ask_prompt) {
             fprintf(stdout, "\n");
             fprintf(stdout, "%s: The prompt is: '%s%s%s'\n", __func__, "\033[1m", k_prompt.c_str(), "\033[0m");
@@ -500,9 +509,8 @@ static int always_prompt_transcription(struct whisper_context * ctx, audio_async
         }
 
         {
-            audio.get(2000, pcmf32_cur);
-
-            if (::vad_simple(pcmf32_cur, WHISPER_SAMPLE_RATE, 1000, params.vad_thold, params.freq_thold, params.print_energy)) {
+            // wait for new audio
+            if (vad.poll(params.vad_thold, params.print_energy)) {
                 fprintf(stdout, "%s: Speech detected! Processing ...\n", __func__);
 
                 int64_t t_ms = 0;
@@ -540,6 +548,7 @@ static int always_prompt_transcription(struct whisper_context * ctx, audio_async
                 fprintf(stdout, "\n");
 
                 audio.clear();
+                vad.reset();
             }
         }
     }
@@ -574,14 +583,13 @@ static int process_general_transcription(struct whisper_context * ctx, audio_asy
     fprintf(stderr, "\n");
     fprintf(stderr, "%s: general-purpose mode\n", __func__);
 
+    audio_vad vad(audio, 2000, 1000, params.freq_thold);
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
         is_running = sdl_poll_events();
 
-        // delay
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
         if (ask_prompt) {
             fprintf(stdout, "\n");
             fprintf(stdout, "%s: Say the following phrase: '%s%s%s'\n", __func__, "\033[1m", k_prompt.c_str(), "\033[0m");
@@ -591,9 +599,8 @@ static int process_general_transcription(struct whisper_context * ctx, audio_asy
         }
 
         {
-            audio.get(2000, pcmf32_cur);
-
-            if (::vad_simple(pcmf32_cur, WHISPER_SAMPLE_RATE, 1000, params.vad_thold, params.freq_thold, params.print_energy)) {
+            // wait for new audio
+            if (vad.poll(params.vad_thold, params.print_energy)) {
                 fprintf(stdout, "%s: Speech detected! Processing ...\n", __func__);
 
                 int64_t t_ms = 0;
@@ -679,6 +686,7 @@ static int process_general_transcription(struct whisper_context * ctx, audio_asy
                 }
 
                 audio.clear();
+                vad.reset();
             }
         }
     }
@@ -8,6 +8,9 @@
 
 enum ggml_ftype ggml_parse_ftype(const char * str);
 
+// parse a tensor type name such as "f16" or "q8_0", returns GGML_TYPE_COUNT if unknown
+enum ggml_type ggml_parse_type(const char * str);
+
 void ggml_print_ftypes(FILE * fp = stderr);
 
 bool ggml_common_quantize_0(
@@ -1,5 +1,6 @@
 #include "common-sdl.h"
 
+#include <chrono>
 #include <cstdio>
 
 audio_async::audio_async(int len_ms) {
@@ -164,7 +165,11 @@ void audio_async::callback(uint8_t * stream, int len) {
         }
         m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
         m_audio_len = std::min(m_audio_len + n_samples, m_audio.size());
+
+        m_n_captured += n_samples;
     }
+
+    m_cv.notify_all();
 }
 
 void audio_async::get(int ms, std::vector<float> & result) {
@@ -210,6 +215,68 @@ void audio_async::get(int ms, std::vector<float> & result) {
     }
 }
 
+uint64_t audio_async::n_captured() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_n_captured;
+}
+
+audio_async::view audio_async::get_view(uint64_t since) {
+    view result;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    result.end = m_n_captured;
+
+    if (m_audio.empty() || since >= m_n_captured) {
+        return result;
+    }
+
+    const size_t n_samples = (size_t) std::min<uint64_t>(m_n_captured - since, m_audio_len);
+
+    const size_t s0 = (m_audio_pos + m_audio.size() - n_samples) % m_audio.size();
+
+    if (s0 + n_samples > m_audio.size()) {
+        result.data[0] = &m_audio[s0];
+        result.size[0] = m_audio.size() - s0;
+        result.data[1] = &m_audio[0];
+        result.size[1] = n_samples - result.size[0];
+    } else {
+        result.data[0] = &m_audio[s0];
+        result.size[0] = n_samples;
+    }
+
+    return result;
+}
+
+bool audio_async::wait(uint64_t since, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&] { return m_n_captured > since; });
+}
+
+audio_vad::audio_vad(audio_async & audio, int window_ms, int last_ms, float freq_thold)
+    : m_audio(audio), m_vad(audio.sample_rate(), window_ms, last_ms, freq_thold) {
+    m_n_seen = m_audio.n_captured();
+}
+
+bool audio_vad::poll(float vad_thold, bool verbose, int timeout_ms) {
+    m_audio.wait(m_n_seen, timeout_ms);
+
+    m_last = m_audio.get_view(m_n_seen);
+    for (int i = 0; i < 2; ++i) {
+        m_vad.push(m_last.data[i], m_last.size[i]);
+    }
+    m_n_seen = m_last.end;
+
+    return m_vad.detect(vad_thold, verbose);
+}
+
+void audio_vad::reset() {
+    m_vad.reset();
+    m_n_seen = m_audio.n_captured();
+}
+
 bool sdl_poll_events() {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
@@ -1,9 +1,12 @@
 #pragma once
 
+#include "common.h"
+
 #include <SDL.h>
 #include <SDL_audio.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <vector>
 #include <mutex>
@@ -31,6 +34,30 @@ public:
     // get audio data from the circular buffer
     void get(int ms, std::vector<float> & audio);
 
+    // read-only view of audio in the circular buffer, as up to two contiguous spans - no copy is made
+    // the samples stay valid until they are overwritten, i.e. while less than len_ms minus the length of the view
+    // of new audio has been captured
+    struct view {
+        const float * data[2] = { nullptr, nullptr };
+        size_t        size[2] = { 0, 0 };
+
+        uint64_t end = 0; // capture position after the last sample
+
+        size_t n_samples() const { return size[0] + size[1]; }
+    };
+
+    int sample_rate() const { return m_sample_rate; }
+
+    // number of samples captured since init()
+    uint64_t n_captured();
+
+    // view of the samples captured after position since, limited to the audio since the last clear()
+    view get_view(uint64_t since);
+
+    // block until audio after position since is captured or timeout_ms has passed
+    // returns false on timeout
+    bool wait(uint64_t since, int timeout_ms);
+
 private:
     SDL_AudioDeviceID m_dev_id_in = 0;
 
@@ -40,9 +67,43 @@ private:
     std::atomic_bool m_running;
     std::mutex       m_mutex;
 
+    std::condition_variable m_cv;
+
     std::vector<float> m_audio;
     size_t             m_audio_pos = 0;
     size_t             m_audio_len = 0;
+    uint64_t           m_n_captured = 0;
+};
+
+//
+// Streaming VAD front end
+//
+// Instead of copying the last seconds of audio and re-filtering them on every poll, feeds only the newly captured
+// samples to a vad_energy straight from the capture buffer, and sleeps until the capture callback delivers more
+//
+
+class audio_vad {
+public:
+    audio_vad(audio_async & audio, int window_ms, int last_ms, float freq_thold);
+
+    // wait up to timeout_ms for new audio and feed it to the VAD
+    // returns true if the end of speech is detected (see vad_energy::detect())
+    bool poll(float vad_thold, bool verbose, int timeout_ms = 100);
+
+    // drop the audio seen so far - call after audio_async::clear()
+    void reset();
+
+    // the audio fed by the last poll()
+    const audio_async::view & last() const { return m_last; }
+
+    const vad_energy & vad() const { return m_vad; }
+
+private:
+    audio_async & m_audio;
+    vad_energy    m_vad;
+
+    uint64_t          m_n_seen = 0;
+    audio_async::view m_last;
 };
 
 // Return false if need to quit
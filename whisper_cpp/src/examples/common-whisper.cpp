@@ -133,6 +133,215 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
     return true;
 }
 
+struct audio_reader {
+    ma_decoder decoder;
+    bool has_decoder = false;
+
+    // stdin, or the output of an ffmpeg process (raw F32 PCM, decoded without miniaudio)
+    FILE * fin     = nullptr;
+    bool   is_pipe = false;
+
+    // encoded bytes supplied by the caller instead of fin (see audio_reader_open_stream())
+    std::function<size_t(void *, size_t)> read_bytes;
+
+    // stdin cannot seek, so the bytes read while miniaudio probes the formats are kept to be read again
+    std::vector<uint8_t> head;
+    bool   keep_head = true;
+    size_t pos       = 0;
+
+    int64_t n_samples = 0;
+};
+
+static ma_result audio_reader_on_read(ma_decoder * decoder, void * buf, size_t n, size_t * n_read) {
+    audio_reader * reader = (audio_reader *) decoder->pUserData;
+
+    if (!reader->keep_head && !reader->head.empty() && reader->pos >= reader->head.size()) {
+        std::vector<uint8_t>().swap(reader->head);
+    }
+
+    size_t n_done = 0;
+    if (reader->pos < reader->head.size()) {
+        n_done = std::min(n, reader->head.size() - reader->pos);
+        memcpy(buf, reader->head.data() + reader->pos, n_done);
+    }
+    if (n_done < n) {
+        const size_t n_new = reader->read_bytes ? reader->read_bytes((uint8_t *) buf + n_done, n - n_done)
+                                                : fread((uint8_t *) buf + n_done, 1, n - n_done, reader->fin);
+        if (reader->keep_head) {
+            reader->head.insert(reader->head.end(), (uint8_t *) buf + n_done, (uint8_t *) buf + n_done + n_new);
+        }
+        n_done += n_new;
+    }
+    reader->pos += n_done;
+
+    *n_read = n_done;
+
+    return n_done == 0 && n > 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+static ma_result audio_reader_on_seek(ma_decoder * decoder, ma_int64 offset, ma_seek_origin origin) {
+    audio_reader * reader = (audio_reader *) decoder->pUserData;
+
+    int64_t target = offset;
+    if (origin == ma_seek_origin_current) {
+        target += reader->pos;
+    } else if (origin != ma_seek_origin_start) {
+        return MA_NOT_IMPLEMENTED;
+    }
+
+    if (target < 0) {
+        return MA_INVALID_ARGS;
+    }
+
+    // backwards only within the kept bytes, forwards by reading and discarding
+    if ((size_t) target <= reader->head.size() && (reader->keep_head || (size_t) target >= reader->pos)) {
+        reader->pos = target;
+        return MA_SUCCESS;
+    }
+    if ((size_t) target < reader->pos) {
+        return MA_NOT_IMPLEMENTED;
+    }
+
+    uint8_t buf[4096];
+    while (reader->pos < (size_t) target) {
+        size_t n_read = 0;
+        audio_reader_on_read(decoder, buf, std::min(sizeof(buf), (size_t) target - reader->pos), &n_read);
+        if (n_read == 0) {
+            return MA_AT_END;
+        }
+    }
+
+    return MA_SUCCESS;
+}
+
+audio_reader * audio_reader_open(const std::string & fname, bool ffmpeg) {
+    audio_reader * reader = new audio_reader;
+
+    const ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 1, WHISPER_SAMPLE_RATE);
+
+    ma_result result;
+
+    if (fname == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        reader->fin = stdin;
+
+        if ((result = ma_decoder_init(audio_reader_on_read, audio_reader_on_seek, reader, &decoder_config, &reader->decoder)) != MA_SUCCESS) {
+            fprintf(stderr, "error: failed to open audio data from stdin (%s)\n", ma_result_description(result));
+            delete reader;
+            return nullptr;
+        }
+
+        // the format is known, drop the probed bytes once they have been consumed
+        reader->keep_head = false;
+        reader->has_decoder = true;
+    } else if ((result = ma_decoder_init_file(fname.c_str(), &decoder_config, &reader->decoder)) == MA_SUCCESS) {
+        reader->has_decoder = true;
+    } else if (ffmpeg) {
+        const std::string cmd = "ffmpeg -nostdin -loglevel error -i \"" + fname + "\" -f f32le -ac 1 -ar " + std::to_string(WHISPER_SAMPLE_RATE) + " -";
+#ifdef _WIN32
+        reader->fin = _popen(cmd.c_str(), "rb");
+#else
+        reader->fin = popen(cmd.c_str(), "r");
+#endif
+        if (reader->fin == nullptr) {
+            fprintf(stderr, "error: failed to run '%s'\n", cmd.c_str());
+            delete reader;
+            return nullptr;
+        }
+        reader->is_pipe = true;
+    } else if ((result = ma_decoder_init_memory(fname.c_str(), fname.size(), &decoder_config, &reader->decoder)) == MA_SUCCESS) {
+        reader->has_decoder = true;
+    } else {
+        fprintf(stderr, "error: failed to read audio data (%s)\n", ma_result_description(result));
+        delete reader;
+        return nullptr;
+    }
+
+    return reader;
+}
+
+audio_reader * audio_reader_open_stream(std::function<size_t(void * buf, size_t n)> read_bytes) {
+    audio_reader * reader = new audio_reader;
+
+    reader->read_bytes = std::move(read_bytes);
+
+    const ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 1, WHISPER_SAMPLE_RATE);
+
+    ma_result result;
+    if ((result = ma_decoder_init(audio_reader_on_read, audio_reader_on_seek, reader, &decoder_config, &reader->decoder)) != MA_SUCCESS) {
+        fprintf(stderr, "error: failed to open the audio stream (%s)\n", ma_result_description(result));
+        delete reader;
+        return nullptr;
+    }
+
+    reader->keep_head = false;
+    reader->has_decoder = true;
+
+    return reader;
+}
+
+int audio_reader_read(audio_reader * reader, float * samples, int n_max) {
+    if (reader->has_decoder) {
+        ma_uint64 frames_read = 0;
+        const ma_result result = ma_decoder_read_pcm_frames(&reader->decoder, samples, n_max, &frames_read);
+        if (result != MA_SUCCESS && result != MA_AT_END) {
+            fprintf(stderr, "error: failed to read the frames of the audio data (%s)\n", ma_result_description(result));
+            return -1;
+        }
+
+        reader->n_samples += frames_read;
+
+        return (int) frames_read;
+    }
+
+    if (reader->fin == nullptr) {
+        return 0;
+    }
+
+    const size_t n_read = fread(samples, sizeof(float), n_max, reader->fin);
+    if (n_read == 0) {
+        // the exit status tells a truncated conversion from the end of the input
+#ifdef _WIN32
+        const int status = _pclose(reader->fin);
+#else
+        const int status = pclose(reader->fin);
+#endif
+        reader->fin = nullptr;
+        if (status != 0) {
+            fprintf(stderr, "error: ffmpeg conversion failed (status %d)\n", status);
+            return -1;
+        }
+        return 0;
+    }
+
+    reader->n_samples += n_read;
+
+    return (int) n_read;
+}
+
+int64_t audio_reader_n_samples(const audio_reader * reader) {
+    return reader->n_samples;
+}
+
+void audio_reader_close(audio_reader * reader) {
+    if (reader == nullptr) {
+        return;
+    }
+    if (reader->has_decoder) {
+        ma_decoder_uninit(&reader->decoder);
+    }
+    if (reader->is_pipe && reader->fin) {
+#ifdef _WIN32
+        _pclose(reader->fin);
+#else
+        pclose(reader->fin);
+#endif
+    }
+    delete reader;
+}
+
 //  500 -> 00:05.000
 // 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma) {
@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <functional>
 
 // Read WAV audio file and store the PCM data into pcmf32
 // fname can be a buffer of WAV data instead of a filename
@@ -14,6 +15,27 @@ bool read_audio_data(
         std::vector<std::vector<float>> & pcmf32s,
         bool stereo);
 
+// Pull-based audio decoder that yields mono F32 PCM at WHISPER_SAMPLE_RATE in chunks, so that long inputs
+// never have to be decoded into memory at once (see whisper_full_from_reader())
+// fname can be a file, "-" for stdin or a buffer of audio data, as for read_audio_data(); a buffer must
+// outlive the reader
+// If ffmpeg is set, inputs that cannot be decoded natively are converted by an ffmpeg process through a pipe
+struct audio_reader;
+
+audio_reader * audio_reader_open(const std::string & fname, bool ffmpeg = false);
+
+// same as audio_reader_open("-"), but the encoded bytes are pulled from read_bytes instead of stdin
+// read_bytes(buf, n) blocks until it can write at least one byte to buf, and returns 0 at the end of the input
+audio_reader * audio_reader_open_stream(std::function<size_t(void * buf, size_t n)> read_bytes);
+
+// read up to n_max samples - returns the number of samples read, 0 at the end of the input or -1 on error
+int audio_reader_read(audio_reader * reader, float * samples, int n_max);
+
+// total number of samples read so far
+int64_t audio_reader_n_samples(const audio_reader * reader);
+
+void audio_reader_close(audio_reader * reader);
+
 // convert timestamp to string, 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma = false);
 
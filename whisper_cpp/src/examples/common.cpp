@@ -645,6 +645,96 @@ bool vad_simple(std::vector<float> & pcmf32, int sample_rate, int last_ms, float
     return true;
 }
 
+vad_energy::vad_energy(int sample_rate, int window_ms, int last_ms, float freq_thold) {
+    n_window = std::max<size_t>(1, ((size_t) sample_rate * window_ms) / 1000);
+    n_last   = std::max<size_t>(1, ((size_t) sample_rate * last_ms)   / 1000);
+
+    alpha = 0.0f;
+    if (freq_thold > 0.0f) {
+        const float rc = 1.0f / (2.0f * M_PI * freq_thold);
+        const float dt = 1.0f / sample_rate;
+        alpha = rc / (rc + dt);
+    }
+
+    hist.resize(n_window);
+}
+
+void vad_energy::push(const float * samples, size_t n_samples) {
+    for (size_t i = 0; i < n_samples; ++i) {
+        float y = samples[i];
+        if (alpha > 0.0f) {
+            y = alpha * (y_prev + samples[i] - x_prev);
+            x_prev = samples[i];
+            y_prev = y;
+        }
+
+        const float e = fabsf(y);
+
+        // the sample that leaves the window and the one that leaves its last part
+        if (hist_len == n_window) {
+            sum_all -= hist[hist_pos];
+        }
+        if (hist_len >= n_last) {
+            sum_last -= hist[(hist_pos + n_window - n_last) % n_window];
+        }
+
+        hist[hist_pos] = e;
+        hist_pos = (hist_pos + 1) % n_window;
+        hist_len = std::min(hist_len + 1, n_window);
+
+        sum_all  += e;
+        sum_last += e;
+
+        // re-sum once per window to cancel the rounding drift of the running sums
+        if (hist_pos == 0 && hist_len == n_window) {
+            sum_all  = 0.0;
+            sum_last = 0.0;
+            for (size_t j = 0; j < n_window; ++j) {
+                sum_all += hist[j];
+                if (j >= n_window - n_last) {
+                    sum_last += hist[j];
+                }
+            }
+        }
+    }
+}
+
+void vad_energy::reset() {
+    x_prev = 0.0f;
+    y_prev = 0.0f;
+
+    hist_pos = 0;
+    hist_len = 0;
+
+    sum_all  = 0.0;
+    sum_last = 0.0;
+}
+
+float vad_energy::energy_all() const {
+    return hist_len > 0 ? std::max(0.0, sum_all) / hist_len : 0.0f;
+}
+
+float vad_energy::energy_last() const {
+    const size_t n = std::min(hist_len, n_last);
+    return n > 0 ? std::max(0.0, sum_last) / n : 0.0f;
+}
+
+bool vad_energy::detect(float vad_thold, bool verbose) const {
+    if (n_last >= hist_len) {
+        // not enough samples - assume no speech
+        return false;
+    }
+
+    const float e_all  = energy_all();
+    const float e_last = energy_last();
+
+    if (verbose) {
+        fprintf(stderr, "%s: energy_all: %f, energy_last: %f, vad_thold: %f\n", __func__, e_all, e_last, vad_thold);
+    }
+
+    return e_last <= vad_thold*e_all;
+}
+
 float similarity(const std::string & s0, const std::string & s1) {
     const size_t len0 = s0.size() + 1;
     const size_t len1 = s1.size() + 1;
@@ -248,6 +248,45 @@ bool vad_simple(
         float freq_thold,
         bool  verbose);
 
+// Incremental version of vad_simple() for a continuous stream of audio
+// Keeps the state of the high-pass filter and the energy of the last window_ms of audio, so that each call to push()
+// costs only the newly captured samples instead of re-filtering and re-summing the whole window
+class vad_energy {
+public:
+    vad_energy(int sample_rate, int window_ms, int last_ms, float freq_thold);
+
+    // append new samples
+    void push(const float * samples, size_t n_samples);
+
+    // forget all audio, e.g. after the capture buffer was cleared
+    void reset();
+
+    // same rule as vad_simple(): true if the energy of the last last_ms dropped to vad_thold times the energy of the
+    // window, i.e. the end of speech - false if there is not enough audio yet
+    bool detect(float vad_thold, bool verbose) const;
+
+    // mean absolute amplitude of the filtered window / of its last last_ms
+    float energy_all()  const;
+    float energy_last() const;
+
+private:
+    size_t n_window;
+    size_t n_last;
+
+    // coefficient of the first-order high-pass filter (0 - disabled)
+    float alpha;
+    float x_prev = 0.0f;
+    float y_prev = 0.0f;
+
+    // absolute filtered amplitudes of the window, as a circular buffer
+    std::vector<float> hist;
+    size_t hist_pos = 0;
+    size_t hist_len = 0;
+
+    double sum_all  = 0.0;
+    double sum_last = 0.0;
+};
+
 // compute similarity between two strings using Levenshtein distance
 float similarity(const std::string & s0, const std::string & s1);
 
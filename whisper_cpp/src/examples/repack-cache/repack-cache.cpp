@@ -0,0 +1,49 @@
+#include "whisper.h"
+#include "ggml.h"
+#include "ggml-backend.h"
+
+#include <cstdio>
+#include <string>
+
+// load a model once, converting its weights for the CPU_REPACK / AMX buffer types, and store the result in a sidecar file
+int main(int argc, char ** argv) {
+    ggml_backend_load_all();
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s model.bin [model.bin.repack]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string fname_model = argv[1];
+    const std::string fname_cache = argc == 3 ? argv[2] : fname_model + ".repack";
+
+    // the repacked layouts are used only for weights that are kept on the CPU
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = false;
+
+    const int64_t t_start_us = ggml_time_us();
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(fname_model.c_str(), cparams);
+    if (ctx == nullptr) {
+        fprintf(stderr, "%s: failed to load model from '%s'\n", __func__, fname_model.c_str());
+        return 1;
+    }
+
+    const int64_t t_load_us = ggml_time_us() - t_start_us;
+
+    const int n_tensors = whisper_save_repack_cache(ctx, fname_cache.c_str());
+
+    whisper_free(ctx);
+
+    if (n_tensors < 0) {
+        return 1;
+    }
+
+    if (n_tensors == 0) {
+        fprintf(stderr, "%s: no weights of '%s' are repacked on this CPU - the cache is not needed\n", __func__, fname_model.c_str());
+    }
+
+    printf("%s: load time = %8.2f ms, wrote %d tensors to '%s'\n", __func__, t_load_us/1000.0f, n_tensors, fname_cache.c_str());
+
+    return 0;
+}
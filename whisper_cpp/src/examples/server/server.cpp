@@ -8,8 +8,13 @@
 #include <cfloat>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <list>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -60,11 +65,17 @@ struct server_params
     std::string public_path = "examples/server/public";
     std::string request_path = "";
     std::string inference_path = "/inference";
+    std::string stream_path = "/stream";
 
     int32_t port          = 8080;
     int32_t read_timeout  = 600;
     int32_t write_timeout = 600;
 
+    int32_t audio_window_ms = 0;
+
+    // number of /inference responses kept for repeated requests (0 - disabled)
+    int32_t result_cache_size = 0;
+
     bool ffmpeg_converter = false;
 };
 
@@ -118,6 +129,10 @@ struct whisper_params {
 
     std::string openvino_encode_device = "CPU";
 
+    std::string repack_cache = "";
+
+    int32_t encoder_cache_mb = 0;
+
     std::string dtw = "";
 
     // Voice Activity Detection (VAD) parameters
@@ -173,12 +188,17 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  --public PATH,                 [%-7s] Path to the public folder\n", sparams.public_path.c_str());
     fprintf(stderr, "  --request-path PATH,           [%-7s] Request path for all requests\n", sparams.request_path.c_str());
     fprintf(stderr, "  --inference-path PATH,         [%-7s] Inference path for all requests\n", sparams.inference_path.c_str());
+    fprintf(stderr, "  --stream-path PATH,            [%-7s] Path of the streaming endpoint (server-sent events)\n", sparams.stream_path.c_str());
     fprintf(stderr, "  --convert,                     [%-7s] Convert audio to WAV, requires ffmpeg on the server\n", sparams.ffmpeg_converter ? "true" : "false");
+    fprintf(stderr, "  --audio-window N,              [%-7d] Decode uploads in windows of N ms while transcribing (0 - all at once)\n", sparams.audio_window_ms);
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n", params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  -nth N,    --no-speech-thold N [%-7.2f] no speech threshold\n",   params.no_speech_thold);
     fprintf(stderr, "  -nc,       --no-context        [%-7s] do not use previous audio context\n", params.no_context ? "true" : "false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] do not use gpu\n", params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n", params.flash_attn ? "true" : "false");
+    fprintf(stderr, "             --repack-cache FNAME [%-7s] pre-repacked CPU weights (see whisper-repack-cache)\n", params.repack_cache.c_str());
+    fprintf(stderr, "  --result-cache N,              [%-7d] number of responses cached for repeated requests (0 - disabled)\n", sparams.result_cache_size);
+    fprintf(stderr, "  --encoder-cache MB,            [%-7d] memory for the encoder output of repeated audio (0 - disabled)\n", params.encoder_cache_mb);
     fprintf(stderr, "  -nlp,      --no-language-probabilities [%-7s] exclude language probabilities from verbose_json output\n", params.no_language_probabilities ? "true" : "false");
     // Voice Activity Detection (VAD) parameters
     fprintf(stderr, "\nVoice Activity Detection (VAD) options:\n");
@@ -236,6 +256,7 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (arg == "-dtw"  || arg == "--dtw")             { params.dtw             = argv[++i]; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (                  arg == "--repack-cache")    { params.repack_cache    = argv[++i]; }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (arg == "-nth"  || arg == "--no-speech-thold") { params.no_speech_thold = std::stof(argv[++i]); }
         else if (arg == "-nc"   || arg == "--no-context")      { params.no_context      = true; }
@@ -247,7 +268,11 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (                  arg == "--public")          { sparams.public_path = argv[++i]; }
         else if (                  arg == "--request-path")    { sparams.request_path = argv[++i]; }
         else if (                  arg == "--inference-path")  { sparams.inference_path = argv[++i]; }
+        else if (                  arg == "--stream-path")     { sparams.stream_path = argv[++i]; }
         else if (                  arg == "--convert")         { sparams.ffmpeg_converter     = true; }
+        else if (                  arg == "--audio-window")    { sparams.audio_window_ms      = std::stoi(argv[++i]); }
+        else if (                  arg == "--result-cache")    { sparams.result_cache_size    = std::stoi(argv[++i]); }
+        else if (                  arg == "--encoder-cache")   { params.encoder_cache_mb      = std::stoi(argv[++i]); }
 
         // Voice Activity Detection (VAD)
         else if (                  arg == "--vad")                         { params.vad                         = true; }
@@ -268,6 +293,226 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
     return true;
 }
 
+// LRU cache of complete /inference responses, keyed by the decoded audio and the request parameters
+// only used with no_context: otherwise the response depends on the text of the previous requests
+struct result_cache {
+    struct entry {
+        uint64_t    key;
+        std::string body;
+        std::string content_type;
+    };
+
+    size_t n_max = 0;
+
+    int64_t n_hit  = 0;
+    int64_t n_miss = 0;
+
+    // most recently used first
+    std::list<entry> entries;
+
+    std::mutex mutex;
+
+    bool get(uint64_t key, std::string & body, std::string & content_type) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->key == key) {
+                body         = it->body;
+                content_type = it->content_type;
+
+                entries.splice(entries.begin(), entries, it);
+                n_hit++;
+
+                return true;
+            }
+        }
+
+        n_miss++;
+
+        return false;
+    }
+
+    void put(uint64_t key, const std::string & body, const std::string & content_type) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        entries.push_front({ key, body, content_type });
+        while (entries.size() > n_max) {
+            entries.pop_back();
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        entries.clear();
+    }
+};
+
+// FNV-1a of the decoded audio and of all request parameters that can change the response
+uint64_t result_cache_key(const std::vector<float> & pcmf32, const std::vector<std::vector<float>> & pcmf32s, const whisper_params & params) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    const auto hash = [&](const void * data, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            h ^= ((const uint8_t *) data)[i];
+            h *= 0x100000001b3ULL;
+        }
+    };
+
+    hash(pcmf32.data(), pcmf32.size()*sizeof(float));
+    for (const auto & channel : pcmf32s) {
+        hash(channel.data(), channel.size()*sizeof(float));
+    }
+
+    const std::string params_str = json{
+        {"offset_t_ms",     params.offset_t_ms},
+        {"offset_n",        params.offset_n},
+        {"duration_ms",     params.duration_ms},
+        {"max_context",     params.max_context},
+        {"max_len",         params.max_len},
+        {"best_of",         params.best_of},
+        {"beam_size",       params.beam_size},
+        {"audio_ctx",       params.audio_ctx},
+        {"word_thold",      params.word_thold},
+        {"entropy_thold",   params.entropy_thold},
+        {"logprob_thold",   params.logprob_thold},
+        {"temperature",     params.temperature},
+        {"temperature_inc", params.temperature_inc},
+        {"no_speech_thold", params.no_speech_thold},
+        {"translate",       params.translate},
+        {"detect_language", params.detect_language},
+        {"diarize",         params.diarize},
+        {"tinydiarize",     params.tinydiarize},
+        {"split_on_word",   params.split_on_word},
+        {"no_timestamps",   params.no_timestamps},
+        {"suppress_nst",    params.suppress_nst},
+        {"no_context",      params.no_context},
+        {"language",        params.language},
+        {"prompt",          params.prompt},
+        {"response_format", params.response_format},
+        {"no_language_probabilities",   params.no_language_probabilities},
+        {"vad",                         params.vad},
+        {"vad_threshold",               params.vad_threshold},
+        {"vad_min_speech_duration_ms",  params.vad_min_speech_duration_ms},
+        {"vad_min_silence_duration_ms", params.vad_min_silence_duration_ms},
+        {"vad_max_speech_duration_s",   params.vad_max_speech_duration_s},
+        {"vad_speech_pad_ms",           params.vad_speech_pad_ms},
+        {"vad_samples_overlap",         params.vad_samples_overlap},
+    }.dump();
+
+    hash(params_str.data(), params_str.size());
+
+    return h;
+}
+
+// a request to the streaming endpoint - the request body is handed to the audio decoder while it is
+// uploaded, and the segments are handed back to the response as server-sent events
+struct stream_session {
+    whisper_params params;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    // encoded audio received but not decoded yet
+    std::string audio;
+    size_t      audio_pos = 0;
+    bool        audio_end = false;
+
+    // formatted events that have not been sent yet, the last one is pushed with done set
+    std::deque<std::string> events;
+    bool done = false;
+
+    // the response ended before the transcription, e.g. because the client disconnected
+    std::atomic<bool> cancelled{false};
+
+    std::thread worker;
+
+    void push_audio(const char * data, size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // nobody reads the rest of the upload after a decoding error
+        if (done) {
+            return;
+        }
+
+        // drop the decoded part once it dominates the buffer
+        if (audio_pos > audio.size()/2) {
+            audio.erase(0, audio_pos);
+            audio_pos = 0;
+        }
+        audio.append(data, n);
+
+        cv.notify_all();
+    }
+
+    void end_audio() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        audio_end = true;
+
+        cv.notify_all();
+    }
+
+    // blocks until some audio has been received - returns 0 at the end of the upload
+    size_t pull_audio(void * buf, size_t n) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        cv.wait(lock, [&] { return audio_pos < audio.size() || audio_end; });
+
+        n = std::min(n, audio.size() - audio_pos);
+        memcpy(buf, audio.data() + audio_pos, n);
+        audio_pos += n;
+
+        return n;
+    }
+
+    void push_event(const char * name, const json & data, bool last = false) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        events.push_back(std::string("event: ") + name + "\ndata: " + data.dump(-1, ' ', false, json::error_handler_t::replace) + "\n\n");
+        done = done || last;
+
+        cv.notify_all();
+    }
+
+    // waits up to a second for the next event - returns false if there is none yet
+    bool pop_event(std::string & event, bool & last) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (!cv.wait_for(lock, std::chrono::seconds(1), [&] { return !events.empty(); })) {
+            return false;
+        }
+
+        event = std::move(events.front());
+        events.pop_front();
+        last = done && events.empty();
+
+        return true;
+    }
+};
+
+void stream_segment_callback(struct whisper_context * /*ctx*/, struct whisper_state * state, int n_new, void * user_data) {
+    stream_session * session = (stream_session *) user_data;
+
+    const int n_segments = whisper_full_n_segments_from_state(state);
+
+    for (int i = n_segments - n_new; i < n_segments; ++i) {
+        json segment = json{
+            {"id", i},
+            {"text", whisper_full_get_segment_text_from_state(state, i)},
+        };
+
+        if (!session->params.no_timestamps) {
+            segment["start"] = whisper_full_get_segment_t0_from_state(state, i) * 0.01;
+            segment["end"]   = whisper_full_get_segment_t1_from_state(state, i) * 0.01;
+        }
+
+        segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob_from_state(state, i);
+
+        session->push_event("segment", segment);
+    }
+}
+
 struct whisper_print_user_data {
     const whisper_params * params;
 
@@ -468,146 +713,213 @@ bool parse_str_to_bool(const std::string & s) {
     return false;
 }
 
+// request parameters are multipart form fields, or query parameters for the streaming endpoint
+bool has_field(const Request & req, const std::string & name) {
+    return req.has_file(name) || req.has_param(name);
+}
+
+std::string get_field(const Request & req, const std::string & name) {
+    return req.has_file(name) ? req.get_file_value(name).content : req.get_param_value(name);
+}
+
 void get_req_parameters(const Request & req, whisper_params & params)
 {
-    if (req.has_file("offset_t"))
+    if (has_field(req, "offset_t"))
     {
-        params.offset_t_ms = std::stoi(req.get_file_value("offset_t").content);
+        params.offset_t_ms = std::stoi(get_field(req, "offset_t"));
     }
-    if (req.has_file("offset_n"))
+    if (has_field(req, "offset_n"))
     {
-        params.offset_n = std::stoi(req.get_file_value("offset_n").content);
+        params.offset_n = std::stoi(get_field(req, "offset_n"));
     }
-    if (req.has_file("duration"))
+    if (has_field(req, "duration"))
     {
-        params.duration_ms = std::stoi(req.get_file_value("duration").content);
+        params.duration_ms = std::stoi(get_field(req, "duration"));
     }
-    if (req.has_file("max_context"))
+    if (has_field(req, "max_context"))
     {
-        params.max_context = std::stoi(req.get_file_value("max_context").content);
+        params.max_context = std::stoi(get_field(req, "max_context"));
     }
-    if (req.has_file("max_len"))
+    if (has_field(req, "max_len"))
     {
-        params.max_len = std::stoi(req.get_file_value("max_len").content);
+        params.max_len = std::stoi(get_field(req, "max_len"));
     }
-    if (req.has_file("best_of"))
+    if (has_field(req, "best_of"))
     {
-        params.best_of = std::stoi(req.get_file_value("best_of").content);
+        params.best_of = std::stoi(get_field(req, "best_of"));
     }
-    if (req.has_file("beam_size"))
+    if (has_field(req, "beam_size"))
     {
-        params.beam_size = std::stoi(req.get_file_value("beam_size").content);
+        params.beam_size = std::stoi(get_field(req, "beam_size"));
     }
-    if (req.has_file("audio_ctx"))
+    if (has_field(req, "audio_ctx"))
     {
-        params.audio_ctx = std::stof(req.get_file_value("audio_ctx").content);
+        params.audio_ctx = std::stof(get_field(req, "audio_ctx"));
     }
-    if (req.has_file("word_thold"))
+    if (has_field(req, "word_thold"))
     {
-        params.word_thold = std::stof(req.get_file_value("word_thold").content);
+        params.word_thold = std::stof(get_field(req, "word_thold"));
     }
-    if (req.has_file("entropy_thold"))
+    if (has_field(req, "entropy_thold"))
     {
-        params.entropy_thold = std::stof(req.get_file_value("entropy_thold").content);
+        params.entropy_thold = std::stof(get_field(req, "entropy_thold"));
     }
-    if (req.has_file("logprob_thold"))
+    if (has_field(req, "logprob_thold"))
     {
-        params.logprob_thold = std::stof(req.get_file_value("logprob_thold").content);
+        params.logprob_thold = std::stof(get_field(req, "logprob_thold"));
     }
-    if (req.has_file("debug_mode"))
+    if (has_field(req, "debug_mode"))
     {
-        params.debug_mode = parse_str_to_bool(req.get_file_value("debug_mode").content);
+        params.debug_mode = parse_str_to_bool(get_field(req, "debug_mode"));
     }
-    if (req.has_file("translate"))
+    if (has_field(req, "translate"))
     {
-        params.translate = parse_str_to_bool(req.get_file_value("translate").content);
+        params.translate = parse_str_to_bool(get_field(req, "translate"));
     }
-    if (req.has_file("diarize"))
+    if (has_field(req, "diarize"))
     {
-        params.diarize = parse_str_to_bool(req.get_file_value("diarize").content);
+        params.diarize = parse_str_to_bool(get_field(req, "diarize"));
     }
-    if (req.has_file("tinydiarize"))
+    if (has_field(req, "tinydiarize"))
     {
-        params.tinydiarize = parse_str_to_bool(req.get_file_value("tinydiarize").content);
+        params.tinydiarize = parse_str_to_bool(get_field(req, "tinydiarize"));
     }
-    if (req.has_file("split_on_word"))
+    if (has_field(req, "split_on_word"))
     {
-        params.split_on_word = parse_str_to_bool(req.get_file_value("split_on_word").content);
+        params.split_on_word = parse_str_to_bool(get_field(req, "split_on_word"));
     }
-    if (req.has_file("no_timestamps"))
+    if (has_field(req, "no_timestamps"))
     {
-        params.no_timestamps = parse_str_to_bool(req.get_file_value("no_timestamps").content);
+        params.no_timestamps = parse_str_to_bool(get_field(req, "no_timestamps"));
     }
-    if (req.has_file("language"))
+    if (has_field(req, "language"))
     {
-        params.language = req.get_file_value("language").content;
+        params.language = get_field(req, "language");
     }
-    if (req.has_file("detect_language"))
+    if (has_field(req, "detect_language"))
     {
-        params.detect_language = parse_str_to_bool(req.get_file_value("detect_language").content);
+        params.detect_language = parse_str_to_bool(get_field(req, "detect_language"));
     }
-    if (req.has_file("prompt"))
+    if (has_field(req, "prompt"))
     {
-        params.prompt = req.get_file_value("prompt").content;
+        params.prompt = get_field(req, "prompt");
     }
-    if (req.has_file("response_format"))
+    if (has_field(req, "response_format"))
     {
-        params.response_format = req.get_file_value("response_format").content;
+        params.response_format = get_field(req, "response_format");
     }
-    if (req.has_file("temperature"))
+    if (has_field(req, "temperature"))
     {
-        params.temperature = std::stof(req.get_file_value("temperature").content);
+        params.temperature = std::stof(get_field(req, "temperature"));
     }
-    if (req.has_file("temperature_inc"))
+    if (has_field(req, "temperature_inc"))
     {
-        params.temperature_inc = std::stof(req.get_file_value("temperature_inc").content);
+        params.temperature_inc = std::stof(get_field(req, "temperature_inc"));
     }
-    if (req.has_file("suppress_non_speech"))
+    if (has_field(req, "suppress_non_speech"))
     {
-        params.suppress_nst = parse_str_to_bool(req.get_file_value("suppress_non_speech").content);
+        params.suppress_nst = parse_str_to_bool(get_field(req, "suppress_non_speech"));
     }
-    if (req.has_file("suppress_nst"))
+    if (has_field(req, "suppress_nst"))
     {
-        params.suppress_nst = parse_str_to_bool(req.get_file_value("suppress_nst").content);
+        params.suppress_nst = parse_str_to_bool(get_field(req, "suppress_nst"));
     }
-    if (req.has_file("no_context"))
+    if (has_field(req, "no_context"))
     {
-        params.no_context = parse_str_to_bool(req.get_file_value("no_context").content);
+        params.no_context = parse_str_to_bool(get_field(req, "no_context"));
     }
-    if (req.has_file("vad"))
+    if (has_field(req, "vad"))
     {
-        params.vad = parse_str_to_bool(req.get_file_value("vad").content);
+        params.vad = parse_str_to_bool(get_field(req, "vad"));
     }
-    if (req.has_file("vad_threshold"))
+    if (has_field(req, "vad_threshold"))
     {
-        params.vad_threshold = std::stof(req.get_file_value("vad_threshold").content);
+        params.vad_threshold = std::stof(get_field(req, "vad_threshold"));
     }
-    if (req.has_file("vad_min_speech_duration_ms"))
+    if (has_field(req, "vad_min_speech_duration_ms"))
     {
-        params.vad_min_speech_duration_ms = std::stof(req.get_file_value("vad_min_speech_duration_ms").content);
+        params.vad_min_speech_duration_ms = std::stof(get_field(req, "vad_min_speech_duration_ms"));
     }
-    if (req.has_file("vad_min_silence_duration_ms"))
+    if (has_field(req, "vad_min_silence_duration_ms"))
     {
-        params.vad_min_silence_duration_ms = std::stof(req.get_file_value("vad_min_silence_duration_ms").content);
+        params.vad_min_silence_duration_ms = std::stof(get_field(req, "vad_min_silence_duration_ms"));
     }
-    if (req.has_file("vad_max_speech_duration_s"))
+    if (has_field(req, "vad_max_speech_duration_s"))
     {
-        params.vad_max_speech_duration_s = std::stof(req.get_file_value("vad_max_speech_duration_s").content);
+        params.vad_max_speech_duration_s = std::stof(get_field(req, "vad_max_speech_duration_s"));
     }
-    if (req.has_file("vad_speech_pad_ms"))
+    if (has_field(req, "vad_speech_pad_ms"))
     {
-        params.vad_speech_pad_ms = std::stoi(req.get_file_value("vad_speech_pad_ms").content);
+        params.vad_speech_pad_ms = std::stoi(get_field(req, "vad_speech_pad_ms"));
     }
-    if (req.has_file("vad_samples_overlap"))
+    if (has_field(req, "vad_samples_overlap"))
     {
-        params.vad_samples_overlap = std::stof(req.get_file_value("vad_samples_overlap").content);
+        params.vad_samples_overlap = std::stof(get_field(req, "vad_samples_overlap"));
     }
-    if (req.has_file("no_language_probabilities"))
+    if (has_field(req, "no_language_probabilities"))
     {
-        params.no_language_probabilities = parse_str_to_bool(req.get_file_value("no_language_probabilities").content);
+        params.no_language_probabilities = parse_str_to_bool(get_field(req, "no_language_probabilities"));
     }
 }
 
+// whisper_full() parameters of a request, without the callbacks
+// the strings are not copied, so params must outlive the result
+whisper_full_params get_full_params(const whisper_params & params) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.strategy = params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
+
+    wparams.print_realtime   = false;
+    wparams.print_progress   = params.print_progress;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.print_special    = params.print_special;
+    wparams.translate        = params.translate;
+    wparams.language         = params.language.c_str();
+    wparams.detect_language  = params.detect_language;
+    wparams.n_threads        = params.n_threads;
+    wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
+    wparams.offset_ms        = params.offset_t_ms;
+    wparams.duration_ms      = params.duration_ms;
+
+    wparams.thold_pt         = params.word_thold;
+    wparams.max_len          = params.max_len == 0 ? 60 : params.max_len;
+    wparams.split_on_word    = params.split_on_word;
+    wparams.audio_ctx        = params.audio_ctx;
+
+    wparams.debug_mode       = params.debug_mode;
+
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+
+    wparams.initial_prompt   = params.prompt.c_str();
+
+    wparams.greedy.best_of        = params.best_of;
+    wparams.beam_search.beam_size = params.beam_size;
+
+    wparams.temperature      = params.temperature;
+    wparams.no_speech_thold = params.no_speech_thold;
+    wparams.temperature_inc  = params.temperature_inc;
+    wparams.entropy_thold    = params.entropy_thold;
+    wparams.logprob_thold    = params.logprob_thold;
+
+    wparams.no_timestamps    = params.no_timestamps;
+    wparams.token_timestamps = !params.no_timestamps && params.response_format == vjson_format;
+    wparams.no_context       = params.no_context;
+
+    wparams.suppress_nst     = params.suppress_nst;
+
+    wparams.vad              = params.vad;
+    wparams.vad_model_path   = params.vad_model.c_str();
+
+    wparams.vad_params.threshold               = params.vad_threshold;
+    wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
+    wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
+    wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
+    wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
+    wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+
+    return wparams;
+}
+
 }  // namespace
 
 int main(int argc, char ** argv) {
@@ -644,6 +956,10 @@ int main(int argc, char ** argv) {
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
 
+    cparams.repack_cache = params.repack_cache.empty() ? nullptr : params.repack_cache.c_str();
+
+    cparams.encoder_cache_mb = params.encoder_cache_mb;
+
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
         cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
@@ -749,6 +1065,13 @@ int main(int argc, char ** argv) {
     -F response_format="json"
         </pre>
 
+        <h2>/stream</h2>
+        <pre>
+    curl -N 127.0.0.1:)" + std::to_string(sparams.port) + R"(/stream?temperature=0.0 \
+    -H "Content-Type: audio/wav" \
+    --data-binary "@&lt;file-path&gt;"
+        </pre>
+
         <h2>/load</h2>
         <pre>
     curl 127.0.0.1:)" + std::to_string(sparams.port) + R"(/load \
@@ -784,6 +1107,13 @@ int main(int argc, char ** argv) {
     // store default params so we can reset after each inference request
     whisper_params default_params = params;
 
+    result_cache results;
+    results.n_max = std::max(0, sparams.result_cache_size);
+
+    // snapshot of the encoder cache statistics of the current context, taken after each inference
+    std::mutex encoder_stats_mutex;
+    whisper_encoder_cache_stats encoder_stats = whisper_get_encoder_cache_stats(ctx);
+
     // this is only called if no index.html is found in the public --path
     svr->Get(sparams.request_path + "/", [&](const Request &, Response &res){
         res.set_content(default_content, "text/html");
@@ -817,7 +1147,30 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (sparams.ffmpeg_converter) {
+        // with --audio-window the upload is decoded while it is being transcribed, and ffmpeg output is
+        // read from a pipe instead of a converted temporary file
+        audio_reader * reader = nullptr;
+        std::string reader_temp_filename;
+
+        if (sparams.audio_window_ms > 0 && !params.diarize && params.n_processors == 1) {
+            if (sparams.ffmpeg_converter) {
+                reader_temp_filename = generate_temp_filename("whisper-server", "");
+                std::ofstream temp_file{reader_temp_filename, std::ios::binary};
+                temp_file << audio_file.content;
+                temp_file.close();
+            }
+
+            reader = audio_reader_open(sparams.ffmpeg_converter ? reader_temp_filename : audio_file.content, sparams.ffmpeg_converter);
+            if (reader == nullptr) {
+                fprintf(stderr, "error: failed to read audio data\n");
+                const std::string error_resp = "{\"error\":\"failed to read audio data\"}";
+                res.set_content(error_resp, "application/json");
+                if (!reader_temp_filename.empty()) {
+                    std::remove(reader_temp_filename.c_str());
+                }
+                return;
+            }
+        } else if (sparams.ffmpeg_converter) {
             // if file is not wav, convert to wav
             // write to temporary file
             const std::string temp_filename = generate_temp_filename("whisper-server", ".wav");
@@ -855,6 +1208,25 @@ int main(int argc, char ** argv) {
 
         printf("Successfully loaded %s\n", filename.c_str());
 
+        // serve repeated requests from the result cache - uploads read in windows are never cached.
+        // with the text context of the previous requests the response is not a function of the key,
+        // and a hit would also skip the update of that context, so only no_context requests are cached
+        const bool use_result_cache = reader == nullptr && results.n_max > 0 && params.no_context;
+
+        uint64_t result_key = 0;
+        if (use_result_cache) {
+            result_key = result_cache_key(pcmf32, pcmf32s, params);
+
+            std::string body;
+            std::string content_type;
+            if (results.get(result_key, body, content_type)) {
+                printf("Serving %s from the result cache\n", filename.c_str());
+                res.set_content(body, content_type);
+                params = default_params;
+                return;
+            }
+        }
+
         // print system information
         {
             fprintf(stderr, "\n");
@@ -875,8 +1247,12 @@ int main(int argc, char ** argv) {
             if (params.detect_language) {
                 params.language = "auto";
             }
-            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, filename.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+            if (reader) {
+                fprintf(stderr, "%s: processing '%s' (in %.1f sec windows), ", __func__, filename.c_str(), sparams.audio_window_ms/1000.0f);
+            } else {
+                fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), ", __func__, filename.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE);
+            }
+            fprintf(stderr, "%d threads, %d processors, lang = %s, task = %s, %stimestamps = %d ...\n",
                     params.n_threads, params.n_processors,
                     params.language.c_str(),
                     params.translate ? "translate" : "transcribe",
@@ -886,60 +1262,13 @@ int main(int argc, char ** argv) {
             fprintf(stderr, "\n");
         }
 
+        // number of input samples, only known at the end when the upload is read in windows
+        int64_t n_samples = pcmf32.size();
+
         // run the inference
         {
             printf("Running whisper.cpp inference on %s\n", filename.c_str());
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            wparams.strategy = params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
-
-            wparams.print_realtime   = false;
-            wparams.print_progress   = params.print_progress;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.print_special    = params.print_special;
-            wparams.translate        = params.translate;
-            wparams.language         = params.language.c_str();
-            wparams.detect_language  = params.detect_language;
-            wparams.n_threads        = params.n_threads;
-            wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
-            wparams.offset_ms        = params.offset_t_ms;
-            wparams.duration_ms      = params.duration_ms;
-
-            wparams.thold_pt         = params.word_thold;
-            wparams.max_len          = params.max_len == 0 ? 60 : params.max_len;
-            wparams.split_on_word    = params.split_on_word;
-            wparams.audio_ctx        = params.audio_ctx;
-
-            wparams.debug_mode       = params.debug_mode;
-
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
-
-            wparams.initial_prompt   = params.prompt.c_str();
-
-            wparams.greedy.best_of        = params.best_of;
-            wparams.beam_search.beam_size = params.beam_size;
-
-            wparams.temperature      = params.temperature;
-            wparams.no_speech_thold = params.no_speech_thold;
-            wparams.temperature_inc  = params.temperature_inc;
-            wparams.entropy_thold    = params.entropy_thold;
-            wparams.logprob_thold    = params.logprob_thold;
-
-            wparams.no_timestamps    = params.no_timestamps;
-            wparams.token_timestamps = !params.no_timestamps && params.response_format == vjson_format;
-            wparams.no_context       = params.no_context;
-
-            wparams.suppress_nst     = params.suppress_nst;
-
-            wparams.vad              = params.vad;
-            wparams.vad_model_path   = params.vad_model.c_str();
-
-            wparams.vad_params.threshold               = params.vad_threshold;
-            wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
-            wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
-            wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
-            wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
-            wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+            whisper_full_params wparams = get_full_params(params);
 
             whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
 
@@ -962,7 +1291,25 @@ int main(int argc, char ** argv) {
             };
             wparams.abort_callback_user_data = (void*)&req;
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            int ret = 0;
+            if (reader) {
+                const auto read_callback = [](float * samples, int n_max, void * user_data) {
+                    return audio_reader_read((audio_reader *) user_data, samples, n_max);
+                };
+
+                ret = whisper_full_from_reader(ctx, wparams, read_callback, reader, sparams.audio_window_ms);
+
+                n_samples = audio_reader_n_samples(reader);
+                audio_reader_close(reader);
+
+                if (!reader_temp_filename.empty()) {
+                    std::remove(reader_temp_filename.c_str());
+                }
+            } else {
+                ret = whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors);
+            }
+
+            if (ret != 0) {
                 // handle failure or early abort
                 if (req.is_connection_closed()) {
                     // log client disconnect
@@ -977,6 +1324,9 @@ int main(int argc, char ** argv) {
                 res.set_content(error_resp, "application/json");
                 return;
             }
+
+            std::lock_guard<std::mutex> lock(encoder_stats_mutex);
+            encoder_stats = whisper_get_encoder_cache_stats(ctx);
         }
 
         // return results to user
@@ -1034,7 +1384,7 @@ int main(int argc, char ** argv) {
             json jres = json{
                 {"task", params.translate ? "translate" : "transcribe"},
                 {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
-                {"duration", float(pcmf32.size())/WHISPER_SAMPLE_RATE},
+                {"duration", float(n_samples)/WHISPER_SAMPLE_RATE},
                 {"text", results},
                 {"segments", json::array()}
             };
@@ -1108,9 +1458,135 @@ int main(int argc, char ** argv) {
                             "application/json");
         }
 
+        if (use_result_cache) {
+            results.put(result_key, res.body, res.get_header_value("Content-Type"));
+        }
+
         // reset params to their defaults
         params = default_params;
     });
+    svr->Options(sparams.request_path + sparams.stream_path, [&](const Request &, Response &){
+    });
+
+    // the request body is the audio file itself and the parameters are passed in the query string, so that the
+    // upload can be transcribed in windows of --audio-window ms while it is being received
+    svr->Post(sparams.request_path + sparams.stream_path, [&](const Request &req, Response &res, const ContentReader &content_reader){
+        if (req.is_multipart_form_data()) {
+            fprintf(stderr, "error: multipart request to the streaming endpoint\n");
+            res.set_content("{\"error\":\"send the audio as the request body, with the parameters in the query string\"}", "application/json");
+            return;
+        }
+
+        auto session = std::make_shared<stream_session>();
+
+        session->params = default_params;
+        get_req_parameters(req, session->params);
+
+        printf("Received stream request\n");
+
+        // the model is locked by the transcription thread, so that requests queue up while their upload is buffered
+        session->worker = std::thread([&, session]() {
+            std::lock_guard<std::mutex> lock(whisper_mutex);
+
+            if (session->cancelled) {
+                return;
+            }
+
+            auto & params = session->params;
+
+            if (!whisper_is_multilingual(ctx)) {
+                params.language  = "en";
+                params.translate = false;
+            }
+            if (params.detect_language) {
+                params.language = "auto";
+            }
+
+            audio_reader * reader = audio_reader_open_stream([session](void * buf, size_t n) {
+                return session->pull_audio(buf, n);
+            });
+            if (reader == nullptr) {
+                fprintf(stderr, "error: failed to read audio data\n");
+                session->push_event("error", json{{"error", "failed to read audio data"}}, true);
+                return;
+            }
+
+            whisper_full_params wparams = get_full_params(params);
+
+            wparams.new_segment_callback           = stream_segment_callback;
+            wparams.new_segment_callback_user_data = session.get();
+
+            wparams.abort_callback = [](void * user_data) {
+                return ((stream_session *) user_data)->cancelled.load();
+            };
+            wparams.abort_callback_user_data = session.get();
+
+            const auto read_callback = [](float * samples, int n_max, void * user_data) {
+                return audio_reader_read((audio_reader *) user_data, samples, n_max);
+            };
+
+            const int ret = whisper_full_from_reader(ctx, wparams, read_callback, reader, sparams.audio_window_ms);
+
+            const int64_t n_samples = audio_reader_n_samples(reader);
+            audio_reader_close(reader);
+
+            {
+                std::lock_guard<std::mutex> lock(encoder_stats_mutex);
+                encoder_stats = whisper_get_encoder_cache_stats(ctx);
+            }
+
+            if (ret != 0) {
+                if (!session->cancelled) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                }
+                session->push_event("error", json{{"error", "failed to process audio"}}, true);
+                return;
+            }
+
+            session->push_event("done", json{
+                {"task", params.translate ? "translate" : "transcribe"},
+                {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
+                {"duration", float(n_samples)/WHISPER_SAMPLE_RATE},
+            }, true);
+        });
+
+        const bool received = content_reader([&](const char * data, size_t data_length) {
+            session->push_audio(data, data_length);
+            return true;
+        });
+        session->end_audio();
+
+        if (!received) {
+            fprintf(stderr, "client disconnected, aborted processing\n");
+            session->cancelled = true;
+            session->worker.join();
+            res.status = 499;
+            res.set_content("{\"error\":\"client disconnected\"}", "application/json");
+            return;
+        }
+
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider("text/event-stream",
+            [session](size_t /*offset*/, DataSink & sink) {
+                std::string event;
+                bool last = false;
+                if (!session->pop_event(event, last)) {
+                    return true;
+                }
+                if (!sink.write(event.data(), event.size())) {
+                    return false;
+                }
+                if (last) {
+                    sink.done();
+                }
+                return true;
+            },
+            [session](bool /*success*/) {
+                session->cancelled = true;
+                session->worker.join();
+            });
+    });
+
     svr->Post(sparams.request_path + "/load", [&](const Request &req, Response &res){
         std::lock_guard<std::mutex> lock(whisper_mutex);
         state.store(SERVER_STATE_LOADING_MODEL);
@@ -1145,6 +1621,13 @@ int main(int argc, char ** argv) {
         // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
         whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
 
+        // the cached results belong to the previous model
+        results.clear();
+        {
+            std::lock_guard<std::mutex> lock(encoder_stats_mutex);
+            encoder_stats = whisper_get_encoder_cache_stats(ctx);
+        }
+
         state.store(SERVER_STATE_READY);
         const std::string success = "Load was successful!";
         res.set_content(success, "application/text");
@@ -1163,6 +1646,42 @@ int main(int argc, char ** argv) {
         }
     });
 
+    // cache statistics in the Prometheus text format
+    svr->Get(sparams.request_path + "/metrics", [&](const Request &, Response &res){
+        struct metric {
+            std::string name;
+            std::string type;
+            std::string help;
+            int64_t     value;
+        };
+
+        std::vector<metric> metrics;
+
+        {
+            std::lock_guard<std::mutex> lock(results.mutex);
+            metrics.push_back({ "whisper_result_cache_hits_total",   "counter", "Requests served from the result cache",     (int64_t) results.n_hit });
+            metrics.push_back({ "whisper_result_cache_misses_total", "counter", "Requests not found in the result cache",    (int64_t) results.n_miss });
+            metrics.push_back({ "whisper_result_cache_entries",      "gauge",   "Responses in the result cache",             (int64_t) results.entries.size() });
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(encoder_stats_mutex);
+            metrics.push_back({ "whisper_encoder_cache_hits_total",   "counter", "Encoder windows served from the encoder cache since the model was loaded", (int64_t) encoder_stats.n_hit });
+            metrics.push_back({ "whisper_encoder_cache_misses_total", "counter", "Encoder windows computed since the model was loaded",                    (int64_t) encoder_stats.n_miss });
+            metrics.push_back({ "whisper_encoder_cache_entries",      "gauge",   "Windows in the encoder cache",                                           (int64_t) encoder_stats.n_entries });
+            metrics.push_back({ "whisper_encoder_cache_bytes",        "gauge",   "Memory used by the encoder cache",                                       (int64_t) encoder_stats.size });
+        }
+
+        std::stringstream ss;
+        for (const auto & m : metrics) {
+            ss << "# HELP " << m.name << " " << m.help << "\n";
+            ss << "# TYPE " << m.name << " " << m.type << "\n";
+            ss << m.name << " " << m.value << "\n";
+        }
+
+        res.set_content(ss.str(), "text/plain; version=0.0.4");
+    });
+
     svr->set_exception_handler([](const Request &, Response &res, std::exception_ptr ep) {
         const char fmt[] = "500 Internal Server Error\n%s";
         char buf[BUFSIZ];
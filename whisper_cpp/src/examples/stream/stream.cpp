@@ -7,6 +7,7 @@
 #include "common-whisper.h"
 #include "whisper.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <fstream>
@@ -37,6 +38,7 @@ struct whisper_params {
     bool save_audio    = false; // save audio to wav file
     bool use_gpu       = true;
     bool flash_attn    = false;
+    bool stable_prefix = false;
 
     std::string language  = "en";
     std::string model     = "models/ggml-base.en.bin";
@@ -74,6 +76,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-sa"   || arg == "--save-audio")    { params.save_audio    = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")        { params.use_gpu       = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")    { params.flash_attn    = true; }
+        else if (arg == "-sp"   || arg == "--stable-prefix") { params.stable_prefix = true; }
 
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
@@ -112,9 +115,53 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -sa,      --save-audio    [%-7s] save the recorded audio to a file\n",              params.save_audio ? "true" : "false");
     fprintf(stderr, "  -ng,      --no-gpu        [%-7s] disable GPU inference\n",                          params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn    [%-7s] flash attention during inference\n",               params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -sp,      --stable-prefix [%-7s] commit the text on which consecutive steps agree\n", params.stable_prefix ? "true" : "false");
     fprintf(stderr, "\n");
 }
 
+// state of the terminal output in stable-prefix mode
+struct stream_output {
+    std::string line; // committed text on the current line
+
+    std::ofstream * fout = nullptr;
+};
+
+static void stream_token_callback(
+        struct whisper_context * ctx,
+    const whisper_token_data * tokens_committed,
+                           int   n_committed,
+    const whisper_token_data * tokens_tentative,
+                           int   n_tentative,
+                         void * user_data) {
+    stream_output & out = *(stream_output *) user_data;
+
+    std::string text_committed;
+    for (int i = 0; i < n_committed; ++i) {
+        text_committed += whisper_token_to_str(ctx, tokens_committed[i].id);
+    }
+
+    std::string text_tentative;
+    for (int i = 0; i < n_tentative; ++i) {
+        text_tentative += whisper_token_to_str(ctx, tokens_tentative[i].id);
+    }
+
+    if (out.fout && out.fout->is_open()) {
+        *out.fout << text_committed << std::flush;
+    }
+
+    out.line += text_committed;
+
+    // the committed text is final - move it to its own line once it gets long
+    if (out.line.size() > 80) {
+        printf("\33[2K\r%s\n", out.line.c_str());
+        out.line.clear();
+    }
+
+    // the tentative text is printed in gray and overwritten on the next step
+    printf("\33[2K\r%s\033[90m%s\033[0m", out.line.c_str(), text_tentative.c_str());
+    fflush(stdout);
+}
+
 int main(int argc, char ** argv) {
     ggml_backend_load_all();
 
@@ -134,6 +181,11 @@ int main(int argc, char ** argv) {
 
     const bool use_vad = n_samples_step <= 0; // sliding window mode uses VAD
 
+    if (use_vad && params.stable_prefix) {
+        fprintf(stderr, "error: --stable-prefix requires --step > 0\n");
+        return 1;
+    }
+
     const int n_new_line = !use_vad ? std::max(1, params.length_ms / params.step_ms - 1) : 1; // number of steps to print new line
 
     params.no_timestamps  = !use_vad;
@@ -228,12 +280,43 @@ int main(int argc, char ** argv) {
 
         wavWriter.open(filename, WHISPER_SAMPLE_RATE, 16, 1);
     }
+    // in stable-prefix mode, the library keeps the audio window and commits the text that stops changing
+    stream_output stream_out;
+    stream_out.fout = &fout;
+
+    struct whisper_stream * stream = nullptr;
+    if (params.stable_prefix) {
+        whisper_stream_params sparams = whisper_stream_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+        sparams.wparams.print_special    = params.print_special;
+        sparams.wparams.translate        = params.translate;
+        sparams.wparams.language         = params.language.c_str();
+        sparams.wparams.n_threads        = params.n_threads;
+        sparams.wparams.audio_ctx        = params.audio_ctx;
+        sparams.wparams.temperature_inc  = params.no_fallback ? 0.0f : sparams.wparams.temperature_inc;
+        sparams.wparams.beam_search.beam_size = params.beam_size;
+
+        sparams.max_window_ms = std::min(params.length_ms, 25000);
+
+        sparams.token_callback           = stream_token_callback;
+        sparams.token_callback_user_data = &stream_out;
+
+        stream = whisper_stream_init(ctx, sparams);
+        if (stream == nullptr) {
+            fprintf(stderr, "error: failed to initialize the stream\n");
+            return 2;
+        }
+    }
+
     printf("[Start speaking]\n");
     fflush(stdout);
 
     auto t_last  = std::chrono::high_resolution_clock::now();
     const auto t_start = t_last;
 
+    // in VAD mode, the end of speech is detected incrementally on the newly captured audio
+    audio_vad vad(audio, 2000, 1000, params.freq_thold);
+
     // main audio loop
     while (is_running) {
         if (params.save_audio) {
@@ -255,6 +338,8 @@ int main(int argc, char ** argv) {
                 if (!is_running) {
                     break;
                 }
+                const uint64_t n_captured = audio.n_captured();
+
                 audio.get(params.step_ms, pcmf32_new);
 
                 if ((int) pcmf32_new.size() > 2*n_samples_step) {
@@ -268,7 +353,17 @@ int main(int argc, char ** argv) {
                     break;
                 }
 
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                // sleep until the capture callback delivers more audio
+                audio.wait(n_captured, 100);
+            }
+
+            if (stream) {
+                whisper_stream_push(stream, pcmf32_new.data(), pcmf32_new.size());
+                if (whisper_stream_process(stream) < 0) {
+                    fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                    return 6;
+                }
+                continue;
             }
 
             const int n_samples_new = pcmf32_new.size();
@@ -288,25 +383,23 @@ int main(int argc, char ** argv) {
 
             pcmf32_old = pcmf32;
         } else {
-            const auto t_now  = std::chrono::high_resolution_clock::now();
-            const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
+            const bool speech_end = vad.poll(params.vad_thold, false);
 
-            if (t_diff < 2000) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-                continue;
+            if (params.save_audio) {
+                for (int i = 0; i < 2; ++i) {
+                    wavWriter.write(vad.last().data[i], vad.last().size[i]);
+                }
             }
 
-            audio.get(2000, pcmf32_new);
-
-            if (::vad_simple(pcmf32_new, WHISPER_SAMPLE_RATE, 1000, params.vad_thold, params.freq_thold, false)) {
-                audio.get(params.length_ms, pcmf32);
-            } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            const auto t_now  = std::chrono::high_resolution_clock::now();
+            const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
 
+            if (t_diff < 2000 || !speech_end) {
                 continue;
             }
 
+            audio.get(params.length_ms, pcmf32);
+
             t_last = t_now;
         }
 
@@ -428,6 +521,12 @@ int main(int argc, char ** argv) {
 
     audio.pause();
 
+    if (stream) {
+        whisper_stream_flush(stream);
+        whisper_stream_free(stream);
+        printf("\n");
+    }
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
@@ -7,6 +7,7 @@
 #include "whisper.h"
 #include "llama.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <fstream>
@@ -61,6 +62,7 @@ struct whisper_params {
     int32_t audio_ctx  = 0;
     int32_t n_gpu_layers = 999;
     int32_t seed = 0;
+    int32_t spec_interval_ms = 1000;
     int32_t top_k = 5;
     int32_t min_keep = 1;
     float top_p = 0.80f;
@@ -77,6 +79,7 @@ struct whisper_params {
     bool verbose_prompt = false;
     bool use_gpu        = true;
     bool flash_attn     = false;
+    bool spec_prefill   = false;
 
     std::string person      = "Georgi";
     std::string bot_name    = "LLaMA";
@@ -122,6 +125,8 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-vp"  || arg == "--verbose-prompt") { params.verbose_prompt = true; }
         else if (arg == "-ng"  || arg == "--no-gpu")         { params.use_gpu        = false; }
         else if (arg == "-fa"  || arg == "--flash-attn")     { params.flash_attn     = true; }
+        else if (arg == "-sp"  || arg == "--spec-prefill")   { params.spec_prefill   = true; }
+        else if (arg == "-spi" || arg == "--spec-interval")  { params.spec_interval_ms = std::stoi(argv[++i]); }
         else if (arg == "-p"   || arg == "--person")         { params.person         = argv[++i]; }
         else if (arg == "-bn"   || arg == "--bot-name")      { params.bot_name       = argv[++i]; }
         else if (arg == "--session")                         { params.path_session   = argv[++i]; }
@@ -176,6 +181,8 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -vp,      --verbose-prompt [%-7s] print prompt at start\n",                       params.verbose_prompt ? "true" : "false");
     fprintf(stderr, "  -ng,      --no-gpu         [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn     [%-7s] flash attention\n",                             params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -sp,      --spec-prefill   [%-7s] prefill LLaMA with partial transcripts while speaking\n", params.spec_prefill ? "true" : "false");
+    fprintf(stderr, "  -spi N,   --spec-interval N [%-6d] interval between partial transcripts in milliseconds\n", params.spec_interval_ms);
     fprintf(stderr, "  -p NAME,  --person NAME    [%-7s] person name (for prompt selection)\n",          params.person.c_str());
     fprintf(stderr, "  -bn NAME, --bot-name NAME  [%-7s] bot name (to display)\n",                       params.bot_name.c_str());
     fprintf(stderr, "  -w TEXT,  --wake-command T [%-7s] wake-up command to listen for\n",               params.wake_cmd.c_str());
@@ -270,6 +277,47 @@ static std::vector<std::string> get_words(const std::string &txt) {
     return words;
 }
 
+// strip the wake-up command and any annotations / unsupported characters from the transcribed text
+static std::string clean_text_heard(const std::string & all_heard, int wake_cmd_length, std::string & wake_cmd_heard) {
+    const auto words = get_words(all_heard);
+
+    std::string text_heard;
+
+    wake_cmd_heard.clear();
+
+    for (int i = 0; i < (int) words.size(); ++i) {
+        if (i < wake_cmd_length) {
+            wake_cmd_heard += words[i] + " ";
+        } else {
+            text_heard += words[i] + " ";
+        }
+    }
+
+    // remove text between brackets using regex
+    {
+        std::regex re("\\[.*?\\]");
+        text_heard = std::regex_replace(text_heard, re, "");
+    }
+
+    // remove text between brackets using regex
+    {
+        std::regex re("\\(.*?\\)");
+        text_heard = std::regex_replace(text_heard, re, "");
+    }
+
+    // remove all characters, except for letters, numbers, punctuation and ':', '\'', '-', ' '
+    text_heard = std::regex_replace(text_heard, std::regex("[^a-zA-Z0-9åäöÅÄÖ\\.,\\?!\\s\\:\\'\\-]"), "");
+
+    // take first line
+    text_heard = text_heard.substr(0, text_heard.find_first_of('\n'));
+
+    // remove leading and trailing whitespace
+    text_heard = std::regex_replace(text_heard, std::regex("^\\s+"), "");
+    text_heard = std::regex_replace(text_heard, std::regex("\\s+$"), "");
+
+    return text_heard;
+}
+
 const std::string k_prompt_whisper = R"(A conversation with a person called {1}.)";
 
 const std::string k_prompt_llama = R"(Text transcript of a never ending dialog, where {0} interacts with an AI assistant named {1}.
@@ -556,11 +604,29 @@ int main(int argc, char ** argv) {
 
     std::vector<llama_token> embd;
 
+    // tokens of the partial transcript that are already in the KV cache at positions [n_past, n_past + embd_spec.size())
+    std::vector<llama_token> embd_spec;
+    std::vector<float> pcmf32_spec;
+
+    float energy_floor = 0.0f;
+
+    auto t_spec_last = std::chrono::high_resolution_clock::now();
+
+    // drop the speculatively prefilled tokens from the KV cache
+    const auto spec_rollback = [&]() {
+        if (!embd_spec.empty()) {
+            llama_memory_seq_rm(llama_get_memory(ctx_llama), 0, n_past, -1);
+            embd_spec.clear();
+        }
+    };
+
     // reverse prompts for detecting when it's time to stop speaking
     std::vector<std::string> antiprompts = {
         params.person + chat_symb,
     };
 
+    audio_vad vad(audio, 2000, 1250, params.freq_thold);
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
@@ -570,15 +636,10 @@ int main(int argc, char ** argv) {
             break;
         }
 
-        // delay
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
         int64_t t_ms = 0;
 
         {
-            audio.get(2000, pcmf32_cur);
-
-            if (::vad_simple(pcmf32_cur, WHISPER_SAMPLE_RATE, 1250, params.vad_thold, params.freq_thold, params.print_energy) || force_speak) {
+            if (vad.poll(params.vad_thold, params.print_energy) || force_speak) {
                 //fprintf(stdout, "%s: Speech detected! Processing ...\n", __func__);
 
                 audio.get(params.voice_ms, pcmf32_cur);
@@ -589,25 +650,17 @@ int main(int argc, char ** argv) {
                     all_heard = ::trim(::transcribe(ctx_wsp, params, pcmf32_cur, prompt_whisper, prob0, t_ms));
                 }
 
-                const auto words = get_words(all_heard);
-
                 std::string wake_cmd_heard;
-                std::string text_heard;
-
-                for (int i = 0; i < (int) words.size(); ++i) {
-                    if (i < wake_cmd_length) {
-                        wake_cmd_heard += words[i] + " ";
-                    } else {
-                        text_heard += words[i] + " ";
-                    }
-                }
+                std::string text_heard = clean_text_heard(all_heard, wake_cmd_length, wake_cmd_heard);
 
                 // check if audio starts with the wake-up command if enabled
                 if (use_wake_cmd) {
                     const float sim = similarity(wake_cmd_heard, wake_cmd);
 
                     if ((sim < 0.7f) || (text_heard.empty())) {
+                        spec_rollback();
                         audio.clear();
+                        vad.reset();
                         continue;
                     }
                 }
@@ -617,33 +670,13 @@ int main(int argc, char ** argv) {
                     speak_with_file(params.speak, params.heard_ok, params.speak_file, voice_id);
                 }
 
-                // remove text between brackets using regex
-                {
-                    std::regex re("\\[.*?\\]");
-                    text_heard = std::regex_replace(text_heard, re, "");
-                }
-
-                // remove text between brackets using regex
-                {
-                    std::regex re("\\(.*?\\)");
-                    text_heard = std::regex_replace(text_heard, re, "");
-                }
-
-                // remove all characters, except for letters, numbers, punctuation and ':', '\'', '-', ' '
-                text_heard = std::regex_replace(text_heard, std::regex("[^a-zA-Z0-9åäöÅÄÖ\\.,\\?!\\s\\:\\'\\-]"), "");
-
-                // take first line
-                text_heard = text_heard.substr(0, text_heard.find_first_of('\n'));
-
-                // remove leading and trailing whitespace
-                text_heard = std::regex_replace(text_heard, std::regex("^\\s+"), "");
-                text_heard = std::regex_replace(text_heard, std::regex("\\s+$"), "");
-
                 const std::vector<llama_token> tokens = llama_tokenize(ctx_llama, text_heard.c_str(), false);
 
                 if (text_heard.empty() || tokens.empty() || force_speak) {
                     //fprintf(stdout, "%s: Heard nothing, skipping ...\n", __func__);
+                    spec_rollback();
                     audio.clear();
+                    vad.reset();
 
                     continue;
                 }
@@ -657,6 +690,34 @@ int main(int argc, char ** argv) {
 
                 embd = ::llama_tokenize(ctx_llama, text_heard, false);
 
+                // keep the speculatively prefilled tokens that agree with the final transcript and roll back the
+                // diverging suffix - at least the last token is always evaluated again to get fresh logits
+                if (!embd_spec.empty()) {
+                    size_t n_common = 0;
+                    if (n_past + (int) embd.size() <= n_ctx) {
+                        while (n_common < embd_spec.size() && n_common + 1 < embd.size() && embd_spec[n_common] == embd[n_common]) {
+                            n_common++;
+                        }
+                    }
+
+                    llama_memory_seq_rm(llama_get_memory(ctx_llama), 0, n_past + n_common, -1);
+
+                    if (params.print_energy) {
+                        fprintf(stderr, "%s: reusing %zu / %zu prefilled tokens\n", __func__, n_common, embd.size());
+                    }
+
+                    if (!path_session.empty()) {
+                        session_tokens.insert(session_tokens.end(), embd.begin(), embd.begin() + n_common);
+                        n_session_consumed = session_tokens.size();
+                    }
+
+                    embd_inp.insert(embd_inp.end(), embd.begin(), embd.begin() + n_common);
+                    n_past += n_common;
+
+                    embd.erase(embd.begin(), embd.begin() + n_common);
+                    embd_spec.clear();
+                }
+
                 // Append the new input tokens to the session_tokens vector
                 if (!path_session.empty()) {
                     session_tokens.insert(session_tokens.end(), tokens.begin(), tokens.end());
@@ -788,6 +849,79 @@ int main(int argc, char ** argv) {
                 speak_with_file(params.speak, text_to_speak, params.speak_file, voice_id);
 
                 audio.clear();
+                vad.reset();
+            } else if (params.spec_prefill && n_session_consumed >= (int) session_tokens.size()) {
+                // the speaker has not finished yet - track the background energy level and, while it is exceeded,
+                // transcribe the audio so far and prefill LLaMA with it so that only the tail remains to be
+                // evaluated once the end of speech is detected
+                const float energy = vad.vad().energy_last();
+
+                if (energy_floor <= 0.0f || energy < energy_floor) {
+                    energy_floor = energy;
+                } else {
+                    energy_floor += 0.002f*(energy - energy_floor);
+                }
+
+                const auto t_now = std::chrono::high_resolution_clock::now();
+                const auto t_since = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_spec_last).count();
+
+                if (energy > energy_floor/params.vad_thold && t_since >= params.spec_interval_ms) {
+                    t_spec_last = t_now;
+
+                    audio.get(params.voice_ms, pcmf32_spec);
+
+                    float prob_spec = 0.0f;
+
+                    const std::string all_heard = ::trim(::transcribe(ctx_wsp, params, pcmf32_spec, prompt_whisper, prob_spec, t_ms));
+
+                    std::string wake_cmd_heard;
+                    const std::string text_heard = clean_text_heard(all_heard, wake_cmd_length, wake_cmd_heard);
+
+                    std::vector<llama_token> tokens;
+                    if (!text_heard.empty()) {
+                        tokens = ::llama_tokenize(ctx_llama, " " + text_heard, false);
+                    }
+
+                    // the last word of a partial transcript is the least stable - hold it back
+                    if (!tokens.empty()) {
+                        tokens.pop_back();
+                    }
+
+                    if (n_past + (int) tokens.size() < n_ctx) {
+                        size_t n_common = 0;
+                        while (n_common < embd_spec.size() && n_common < tokens.size() && embd_spec[n_common] == tokens[n_common]) {
+                            n_common++;
+                        }
+
+                        if (n_common < embd_spec.size()) {
+                            llama_memory_seq_rm(llama_get_memory(ctx_llama), 0, n_past + n_common, -1);
+                            embd_spec.resize(n_common);
+                        }
+
+                        if (n_common < tokens.size()) {
+                            batch.n_tokens = tokens.size() - n_common;
+
+                            for (int i = 0; i < batch.n_tokens; i++) {
+                                batch.token[i]     = tokens[n_common + i];
+                                batch.pos[i]       = n_past + n_common + i;
+                                batch.n_seq_id[i]  = 1;
+                                batch.seq_id[i][0] = 0;
+                                batch.logits[i]    = false;
+                            }
+
+                            if (llama_decode(ctx_llama, batch)) {
+                                fprintf(stderr, "%s : failed to decode\n", __func__);
+                                return 1;
+                            }
+
+                            embd_spec.insert(embd_spec.end(), tokens.begin() + n_common, tokens.end());
+                        }
+
+                        if (params.print_energy) {
+                            fprintf(stderr, "%s: prefilled %zu tokens (%zu reused), whisper %d ms\n", __func__, embd_spec.size(), n_common, (int) t_ms);
+                        }
+                    }
+                }
             }
         }
     }
@@ -530,6 +530,9 @@ extern "C" {
 
         GGML_OP_GLU,
 
+        // appended to keep the ids of the other ops (they are part of the ABI and of the ggml-rpc protocol)
+        GGML_OP_CONV_1D,
+
         GGML_OP_COUNT,
     };
 
@@ -1775,6 +1778,29 @@ extern "C" {
             int                   s,  // stride
             int                   d); // dilation
 
+    // conv_1d computed directly, without materializing the im2col matrix in the graph
+    // a:      convolution kernel [K, IC, OC] (F16 or F32)
+    // b:      data [L, IC] (F32)
+    // result: [OL, OC]
+    GGML_API struct ggml_tensor * ggml_conv_1d_direct(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,   // convolution kernel
+            struct ggml_tensor  * b,   // data
+            int                   s0,  // stride
+            int                   p0,  // padding
+            int                   d0); // dilation
+
+    // gelu(ggml_conv_1d_direct(a, b) + c), fused into a single op
+    // c: bias [1, OC] (F32)
+    GGML_API struct ggml_tensor * ggml_conv_1d_direct_bias_gelu(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,   // convolution kernel
+            struct ggml_tensor  * b,   // data
+            struct ggml_tensor  * c,   // bias
+            int                   s0,  // stride
+            int                   p0,  // padding
+            int                   d0); // dilation
+
     // depthwise
     // TODO: this is very likely wrong for some cases! - needs more testing
     GGML_API struct ggml_tensor * ggml_conv_1d_dw(
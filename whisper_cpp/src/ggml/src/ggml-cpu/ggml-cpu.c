@@ -1858,6 +1858,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_conv_transpose_1d(params, tensor);
             } break;
+        case GGML_OP_CONV_1D:
+            {
+                ggml_compute_forward_conv_1d(params, tensor);
+            } break;
         case GGML_OP_IM2COL:
             {
                 ggml_compute_forward_im2col(params, tensor);
@@ -2236,6 +2240,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_IM2COL_BACK:
         case GGML_OP_CONV_2D:
         case GGML_OP_CONV_2D_DW:
+        case GGML_OP_CONV_1D:
         case GGML_OP_CONV_TRANSPOSE_1D:
         case GGML_OP_CONV_TRANSPOSE_2D:
             {
@@ -2753,6 +2758,13 @@ struct ggml_cplan ggml_graph_plan(
                             GGML_ABORT("fatal error");
                         }
                     } break;
+                case GGML_OP_CONV_1D:
+                    {
+                        const int64_t n_patch = node->src[0]->ne[0]*node->src[0]->ne[1]; // K*IC
+                        const size_t  ts      = ggml_type_size(node->src[0]->type);
+
+                        cur = (ggml_conv_1d_tile_size(n_patch, ts)*n_patch*ts + CACHE_LINE_SIZE)*n_tasks;
+                    } break;
                 case GGML_OP_CONV_2D:
                     {
                         cur = GGML_IM2COL_WORK_SIZE;
@@ -2776,7 +2788,7 @@ struct ggml_cplan ggml_graph_plan(
                         const int64_t ne10 = node->src[1]->ne[0]; // DK
                         const int64_t ne20 = node->src[2]->ne[0]; // DV
 
-                        cur = sizeof(float)*(1*ne10 + 2*ne20)*n_tasks; // 1x head size K + 2x head size V (per thread)
+                        cur = sizeof(float)*ggml_flash_attn_ext_work_size(ne10, ne20)*n_tasks;
                     } break;
                 case GGML_OP_FLASH_ATTN_BACK:
                     {
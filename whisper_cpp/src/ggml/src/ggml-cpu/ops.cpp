@@ -6581,6 +6581,113 @@ void ggml_compute_forward_conv_transpose_1d(
     }
 }
 
+// ggml_compute_forward_conv_1d
+
+// direct 1D convolution with optional fused bias + GELU
+// the output positions are split into tiles; for each tile the thread builds the im2col patches in its own
+// slice of the work buffer (sized to stay in L2) and then computes all output channels of the tile from it
+static void ggml_compute_forward_conv_1d_impl(const ggml_compute_params * params,
+                                              const ggml_tensor *         kernel,  // [K, IC, OC]
+                                              const ggml_tensor *         src,     // [L, IC]
+                                              const ggml_tensor *         bias,    // [1, OC] or NULL
+                                              ggml_tensor *               dst,     // [OL, OC]
+                                              ggml_type                   kernel_type) {
+
+    GGML_ASSERT(ggml_is_contiguous(kernel));
+    GGML_ASSERT(kernel_type == GGML_TYPE_F16 || kernel_type == GGML_TYPE_F32);
+    GGML_ASSERT(kernel->type == kernel_type);
+    GGML_ASSERT(src->nb[0] == sizeof(float));
+    GGML_ASSERT(dst->nb[0] == sizeof(float));
+
+    const int32_t stride    = dst->op_params[0];
+    const int32_t pad       = dst->op_params[1];
+    const int32_t dilation  = dst->op_params[2];
+    const bool    fuse_gelu = dst->op_params[3] != 0;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t knl_w = kernel->ne[0];
+    const int64_t c_in  = kernel->ne[1];
+    const int64_t c_out = kernel->ne[2];
+    const int64_t src_w = src->ne[0];
+    const int64_t dst_w = dst->ne[0];
+
+    const int64_t knl_n     = knl_w * c_in;
+    const size_t  type_size = ggml_type_size(kernel_type);
+
+    // use smaller tiles than the work buffer allows if needed, so that every thread gets a few of them
+    const int64_t tile_max = ggml_conv_1d_tile_size(knl_n, type_size);
+    const int64_t tile_w   = std::max<int64_t>(1, std::min(tile_max, (dst_w + 4*nth - 1) / (4*nth)));
+    const int64_t tile_n   = (dst_w + tile_w - 1) / tile_w;
+
+    char * tmp = (char *) params->wdata + ith * (tile_max * knl_n * type_size + CACHE_LINE_SIZE);
+
+    for (int64_t tile = ith; tile < tile_n; tile += nth) {
+        const int64_t x0 = tile * tile_w;
+        const int64_t nx = std::min(tile_w, dst_w - x0);
+
+        // im2col for the tile: patch[i][ic*K + kx] = src[ic][(x0 + i)*stride + kx*dilation - pad]
+        for (int64_t i = 0; i < nx; ++i) {
+            char * patch = tmp + i * knl_n * type_size;
+
+            for (int64_t ic = 0; ic < c_in; ++ic) {
+                const float * src_row = (const float *) ((const char *) src->data + ic * src->nb[1]);
+
+                for (int64_t kx = 0; kx < knl_w; ++kx) {
+                    const int64_t sx = (x0 + i) * stride + kx * dilation - pad;
+
+                    const float src_val = sx < 0 || sx >= src_w ? 0.0f : src_row[sx];
+
+                    const int64_t dst_idx = ic * knl_w + kx;
+                    if (kernel_type == GGML_TYPE_F32) {
+                        ((float *) patch)[dst_idx] = src_val;
+                    } else {
+                        ((ggml_fp16_t *) patch)[dst_idx] = GGML_CPU_FP32_TO_FP16(src_val);
+                    }
+                }
+            }
+        }
+
+        // each kernel row stays in L1 while it is applied to all patches of the tile
+        for (int64_t oc = 0; oc < c_out; ++oc) {
+            char  * knl_row = (char *) kernel->data + oc * kernel->nb[2];
+            float * dst_row = (float *) ((char *) dst->data + oc * dst->nb[1]) + x0;
+
+            for (int64_t i = 0; i < nx; ++i) {
+                char * patch = tmp + i * knl_n * type_size;
+                if (kernel_type == GGML_TYPE_F32) {
+                    ggml_vec_dot_f32(knl_n, dst_row + i, 0, (float *) knl_row, 0, (float *) patch, 0, 1);
+                } else {
+                    ggml_vec_dot_f16(knl_n, dst_row + i, 0, (ggml_fp16_t *) knl_row, 0, (ggml_fp16_t *) patch, 0, 1);
+                }
+            }
+
+            if (bias) {
+                const float b = *(const float *) ((const char *) bias->data + oc * bias->nb[1]);
+                for (int64_t i = 0; i < nx; ++i) {
+                    dst_row[i] += b;
+                }
+            }
+
+            if (fuse_gelu) {
+                ggml_vec_gelu_f32(nx, dst_row, dst_row);
+            }
+        }
+    }
+}
+
+void ggml_compute_forward_conv_1d(
+        const ggml_compute_params * params,
+        ggml_tensor * dst) {
+
+    const ggml_tensor * src0 = dst->src[0];
+    const ggml_tensor * src1 = dst->src[1];
+    const ggml_tensor * src2 = dst->src[2];
+
+    ggml_compute_forward_conv_1d_impl(params, src0, src1, src2, dst, src0->type);
+}
+
 // ggml_compute_forward_im2col_f32
 // src0: kernel [OC, IC, KH, KW]
 // src1: image [N, IC, IH, IW]
@@ -8206,6 +8313,286 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     }
 }
 
+// c[i*ldc + j] (+)= sum_p a[i*lda + p]*b[p*ldb + j] for R rows and 2 SIMD vectors of columns
+// the block is accumulated in registers over the whole k, so every vector loaded from b is used for R rows and no
+// horizontal sums are needed
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE)
+template <int R>
+static inline void ggml_flash_attn_ext_gemm_block(
+        int64_t k,
+        const float * GGML_RESTRICT a, int64_t lda,
+        const float * GGML_RESTRICT b, int64_t ldb,
+              float * GGML_RESTRICT c, int64_t ldc, bool accumulate) {
+    GGML_F32_VEC acc[R][2];
+
+    for (int r = 0; r < R; ++r) {
+        for (int h = 0; h < 2; ++h) {
+            acc[r][h] = accumulate ? GGML_F32_VEC_LOAD(c + r*ldc + h*GGML_F32_EPR) : GGML_F32_VEC_ZERO;
+        }
+    }
+
+    for (int64_t p = 0; p < k; ++p) {
+        const GGML_F32_VEC b0 = GGML_F32_VEC_LOAD(b + p*ldb);
+        const GGML_F32_VEC b1 = GGML_F32_VEC_LOAD(b + p*ldb + GGML_F32_EPR);
+
+        for (int r = 0; r < R; ++r) {
+            const GGML_F32_VEC ar = GGML_F32_VEC_SET1(a[r*lda + p]);
+
+            acc[r][0] = GGML_F32_VEC_FMA(acc[r][0], b0, ar);
+            acc[r][1] = GGML_F32_VEC_FMA(acc[r][1], b1, ar);
+        }
+    }
+
+    for (int r = 0; r < R; ++r) {
+        for (int h = 0; h < 2; ++h) {
+            GGML_F32_VEC_STORE(c + r*ldc + h*GGML_F32_EPR, acc[r][h]);
+        }
+    }
+}
+#endif
+
+// c[i*ldc + j] (+)= sum_p a[i*lda + p]*b[p*ldb + j] for i < m, j < n, p < k
+static void ggml_flash_attn_ext_gemm(
+        int64_t m, int64_t n, int64_t k,
+        const float * GGML_RESTRICT a, int64_t lda,
+        const float * GGML_RESTRICT b, int64_t ldb,
+              float * GGML_RESTRICT c, int64_t ldc, bool accumulate) {
+    int64_t j0 = 0;
+
+#if defined(GGML_SIMD) && !defined(__ARM_FEATURE_SVE)
+    for (; j0 + 2*GGML_F32_EPR <= n; j0 += 2*GGML_F32_EPR) {
+        int64_t i = 0;
+        for (; i + 4 <= m; i += 4) {
+            ggml_flash_attn_ext_gemm_block<4>(k, a + i*lda, lda, b + j0, ldb, c + i*ldc + j0, ldc, accumulate);
+        }
+        for (; i < m; ++i) {
+            ggml_flash_attn_ext_gemm_block<1>(k, a + i*lda, lda, b + j0, ldb, c + i*ldc + j0, ldc, accumulate);
+        }
+    }
+#endif
+
+    // leftover columns
+    for (int64_t i = 0; i < m; ++i) {
+        for (int64_t j = j0; j < n; ++j) {
+            float sum = accumulate ? c[i*ldc + j] : 0.0f;
+            for (int64_t p = 0; p < k; ++p) {
+                sum += a[i*lda + p]*b[p*ldb + j];
+            }
+            c[i*ldc + j] = sum;
+        }
+    }
+}
+
+// tiled variant for F16 K and V with many query rows per head, like the encoder self-attention
+// the threads take blocks of GGML_FA_TILE_Q query rows of one head and stream K and V through them in tiles of
+// GGML_FA_TILE_KV rows. each K and V tile is converted to F32 once and stays in cache while it is used by all query
+// rows of the block, instead of being read again for every row. Q*K^T and P*V of a tile are small matrix products
+// (see ggml_flash_attn_ext_gemm) and the softmax is computed online per tile
+static void ggml_compute_forward_flash_attn_ext_f16_tiled(
+        const ggml_compute_params * params,
+        const ggml_tensor * q,
+        const ggml_tensor * k,
+        const ggml_tensor * v,
+        const ggml_tensor * mask,
+        ggml_tensor * dst) {
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t DK = nek0;
+    const int64_t DV = nev0;
+    const int64_t N  = neq1;
+
+    GGML_ASSERT(ne0 == DV);
+    GGML_ASSERT(ne2 == N);
+
+    GGML_ASSERT(q->type == GGML_TYPE_F32);
+    GGML_ASSERT(k->type == GGML_TYPE_F16);
+    GGML_ASSERT(v->type == GGML_TYPE_F16);
+
+    // input tensor rows must be contiguous
+    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    GGML_ASSERT(neq0 == DK);
+    GGML_ASSERT(nbq1 % sizeof(float) == 0);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    // broadcast factors
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    const int64_t rv2 = neq2/nev2;
+    const int64_t rv3 = neq3/nev3;
+
+    float scale         = 1.0f;
+    float max_bias      = 0.0f;
+    float logit_softcap = 0.0f;
+
+    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+
+    if (logit_softcap != 0) {
+        scale /= logit_softcap;
+    }
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    // blocks of query rows per head and in total
+    const int64_t nblk = (neq1 + GGML_FA_TILE_Q - 1)/GGML_FA_TILE_Q;
+    const int64_t nu   = nblk*neq2*neq3;
+
+    float * KQ  = (float *) params->wdata + ith*ggml_flash_attn_ext_work_size(DK, DV); // [GGML_FA_TILE_Q][GGML_FA_TILE_KV]
+    float * VKQ = KQ  + GGML_FA_TILE_Q*GGML_FA_TILE_KV;                                // [GGML_FA_TILE_Q][DV] FP32 accumulators
+    float * M   = VKQ + GGML_FA_TILE_Q*DV;                                             // [GGML_FA_TILE_Q] maximum KQ values
+    float * S   = M   + GGML_FA_TILE_Q;                                                // [GGML_FA_TILE_Q] sums
+    float * K32 = S   + GGML_FA_TILE_Q;                                                // [DK][GGML_FA_TILE_KV] transposed
+    float * V32 = K32 + GGML_FA_TILE_KV*DK;                                            // [GGML_FA_TILE_KV][DV]
+
+    const ggml_fp16_t * mp[GGML_FA_TILE_Q];
+
+    for (int64_t iu = ith; iu < nu; iu += nth) {
+        // q indices
+        const int64_t iq3 = iu/(nblk*neq2);
+        const int64_t iq2 = (iu - iq3*nblk*neq2)/nblk;
+        const int64_t iq1 = (iu - iq3*nblk*neq2 - iq2*nblk)*GGML_FA_TILE_Q; // first row of the block
+
+        const int nq = (int) MIN(GGML_FA_TILE_Q, neq1 - iq1);
+
+        const uint32_t h = iq2; // head index
+        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+        // k indices
+        const int64_t ik3 = iq3 / rk3;
+        const int64_t ik2 = iq2 / rk2;
+
+        // v indices
+        const int64_t iv3 = iq3 / rv3;
+        const int64_t iv2 = iq2 / rv2;
+
+        const float * pq = (const float *) ((const char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3));
+
+        for (int i = 0; i < nq; ++i) {
+            mp[i] = mask ? (const ggml_fp16_t *) ((const char *) mask->data + (iq1 + i)*mask->nb[1] + (iq2%mask->ne[2])*mask->nb[2] + (iq3%mask->ne[3])*mask->nb[3]) : NULL;
+
+            M[i] = -INFINITY;
+            S[i] = 0.0f;
+        }
+
+        memset(VKQ, 0, nq*DV*sizeof(float));
+
+        for (int64_t ic0 = 0; ic0 < nek1; ic0 += GGML_FA_TILE_KV) {
+            const int nk = (int) MIN(GGML_FA_TILE_KV, nek1 - ic0);
+
+            // skip tiles that are masked out for all rows of the block, e.g. the padding of the KV cache
+            if (mask) {
+                bool masked = true;
+                for (int i = 0; i < nq && masked; ++i) {
+                    for (int j = 0; j < nk; ++j) {
+                        if (GGML_CPU_FP16_TO_FP32(mp[i][ic0 + j]) != -INFINITY) {
+                            masked = false;
+                            break;
+                        }
+                    }
+                }
+                if (masked) {
+                    continue;
+                }
+            }
+
+            for (int j = 0; j < nk; ++j) {
+                const ggml_fp16_t * k_data = (const ggml_fp16_t *) ((const char *) k->data + ((ic0 + j)*nbk1 + ik2*nbk2 + ik3*nbk3));
+                const ggml_fp16_t * v_data = (const ggml_fp16_t *) ((const char *) v->data + ((ic0 + j)*nbv1 + iv2*nbv2 + iv3*nbv3));
+
+                for (int64_t d = 0; d < DK; ++d) {
+                    K32[d*GGML_FA_TILE_KV + j] = GGML_CPU_FP16_TO_FP32(k_data[d]);
+                }
+                ggml_cpu_fp16_to_fp32(v_data, V32 + j*DV, DV);
+            }
+
+            // KQ = Q*K^T
+            ggml_flash_attn_ext_gemm(nq, nk, DK, pq, nbq1/sizeof(float), K32, GGML_FA_TILE_KV, KQ, GGML_FA_TILE_KV, false);
+
+            // online softmax / attention
+            // ref: https://arxiv.org/pdf/2112.05682.pdf
+            for (int i = 0; i < nq; ++i) {
+                float * s = KQ + i*GGML_FA_TILE_KV; // KQ values of the row
+
+                float smax = -INFINITY;
+                for (int j = 0; j < nk; ++j) {
+                    s[j] = s[j]*scale; // scale KQ value
+
+                    if (logit_softcap != 0.0f) {
+                        s[j] = logit_softcap*tanhf(s[j]);
+                    }
+
+                    if (mp[i]) {
+                        s[j] += slope*GGML_CPU_FP16_TO_FP32(mp[i][ic0 + j]); // apply mask
+                    }
+
+                    smax = MAX(smax, s[j]);
+                }
+
+                if (smax == -INFINITY) {
+                    // all keys of the tile are masked for this row
+                    memset(s, 0, nk*sizeof(float));
+                    continue;
+                }
+
+                const float Mnew = MAX(M[i], smax);
+                const float ms   = expf(M[i] - Mnew); // scale of the previous VKQ and KQ sum, 0.0f for the first tile
+
+                if (ms != 1.0f) {
+                    ggml_vec_scale_f32(DV, VKQ + i*DV, ms);
+                }
+
+                // post-softmax KQ values, expf(s - M)
+                const ggml_float sum = ggml_vec_soft_max_f32(nk, s, s, Mnew);
+
+                M[i] = Mnew;
+                S[i] = S[i]*ms + (float) sum;
+            }
+
+            // VKQ += softmax(KQ)*V
+            ggml_flash_attn_ext_gemm(nq, DV, nk, KQ, GGML_FA_TILE_KV, V32, DV, VKQ, DV, true);
+        }
+
+        for (int i = 0; i < nq; ++i) {
+            float * vkq = VKQ + i*DV;
+
+            // V /= S
+            ggml_vec_scale_f32(DV, vkq, 1.0f/S[i]);
+
+            // dst indices, permute(0, 2, 1, 3)
+            const int64_t i1 = iq1 + i;
+            const int64_t i2 = iq2;
+            const int64_t i3 = iq3;
+
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, vkq, nb1);
+        }
+    }
+}
+
 void ggml_compute_forward_flash_attn_ext(
         const ggml_compute_params * params,
         const ggml_tensor * q,
@@ -8218,7 +8605,11 @@ void ggml_compute_forward_flash_attn_ext(
         case GGML_PREC_F32:
             {
                 // uses F32 accumulators
-                ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                if (q->type == GGML_TYPE_F32 && k->type == GGML_TYPE_F16 && v->type == GGML_TYPE_F16 && q->ne[1] >= GGML_FA_TILE_Q) {
+                    ggml_compute_forward_flash_attn_ext_f16_tiled(params, q, k, v, mask, dst);
+                } else {
+                    ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                }
             } break;
         default:
             {
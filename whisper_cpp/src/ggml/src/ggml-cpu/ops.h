@@ -23,6 +23,26 @@ static const size_t CACHE_LINE_SIZE_F32 = CACHE_LINE_SIZE/sizeof(float);
 // Work buffer size for im2col operations in CONV2D
 #define GGML_IM2COL_WORK_SIZE (16 * 1024 * 1024)
 
+// Per-thread work buffer size for the im2col patches of one CONV_1D tile (sized to stay in L2)
+#define GGML_CONV_1D_TILE_WORK_SIZE (256 * 1024)
+
+// max number of output positions per CONV_1D tile for patches of n_patch elements
+static inline int64_t ggml_conv_1d_tile_size(int64_t n_patch, size_t type_size) {
+    const int64_t n = GGML_CONV_1D_TILE_WORK_SIZE/(n_patch*type_size);
+    return n > 0 ? n : 1;
+}
+
+// query rows and KV rows per tile of the tiled FLASH_ATTN_EXT kernel
+#define GGML_FA_TILE_Q  32
+#define GGML_FA_TILE_KV 64
+
+// per-thread work buffer size of FLASH_ATTN_EXT in floats, for K head size DK and V head size DV
+static inline int64_t ggml_flash_attn_ext_work_size(int64_t DK, int64_t DV) {
+    const int64_t n_row  = 1*DK + 2*DV;                                                       // one query row at a time
+    const int64_t n_tile = GGML_FA_TILE_Q*(GGML_FA_TILE_KV + DV + 2) + GGML_FA_TILE_KV*(DK + DV); // one query tile at a time
+    return (n_row > n_tile ? n_row : n_tile) + CACHE_LINE_SIZE_F32;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -66,6 +86,7 @@ void ggml_compute_forward_rope(const struct ggml_compute_params * params, struct
 void ggml_compute_forward_rope_back(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_clamp(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_conv_transpose_1d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
+void ggml_compute_forward_conv_1d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_im2col(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_im2col_back_f32(const struct ggml_compute_params * params, struct ggml_tensor * dst);
 void ggml_compute_forward_conv_2d(const struct ggml_compute_params * params, struct ggml_tensor * dst);
@@ -113,11 +113,49 @@ extern "C" {
         const whisper_ahead * heads;
     } whisper_aheads;
 
+    // Opt-in tracing of the inference, see whisper_trace_summary() and whisper_trace_save_chrome()
+    enum whisper_trace_level {
+        WHISPER_TRACE_NONE,
+        WHISPER_TRACE_GRAPHS, // mel, sampling, encode / decode calls and every graph computation
+        WHISPER_TRACE_OPS,    // also every ggml op - the ops are computed one at a time, which adds synchronization overhead
+    };
+
     struct whisper_context_params {
         bool  use_gpu;
         bool  flash_attn;
         int   gpu_device;  // CUDA device
 
+        // data type of the self- and cross-attention KV caches (default: F16)
+        // block-quantized types such as GGML_TYPE_Q8_0 reduce the memory and the bandwidth of the decoder
+        // a quantized V cache requires flash_attn
+        enum ggml_type type_k;
+        enum ggml_type type_v;
+
+        // CPU threadpool of each whisper_state, created once and reused by all of its graphs
+        // (affinity, priority and polling are applied only when ggml is built without OpenMP)
+        const char * cpu_mask;   // hex mask of the cores to use, e.g. "0xF0" for cores 4-7 (NULL - default affinity)
+        bool         cpu_strict; // pin each thread to its own core from the mask
+        int          cpu_prio;   // thread priority, enum ggml_sched_priority (default: GGML_SCHED_PRIO_NORMAL)
+        uint32_t     cpu_poll;   // how long idle threads poll for work before sleeping (0 - no polling, 100 - aggressive)
+
+        // sidecar file with weights already converted to the layouts of the CPU_REPACK / AMX buffer types,
+        // created with whisper_save_repack_cache() (NULL - convert the weights on every load)
+        // a cache made for a different CPU, ggml build or model is ignored
+        const char * repack_cache;
+
+        // memory budget in MB for the cross-attention KV of recently encoded windows (0 - disabled)
+        // an encoder window with the same log mel input as a cached one skips the encoder, e.g. when the
+        // same recording is transcribed again with different decoding parameters
+        int encoder_cache_mb;
+
+        // ggml-rpc server "host:port" that runs the conv and encoder graphs (NULL - run everything locally)
+        // the encoder weights are uploaded to the server at load time, the decoder and the cross-attention KV stay
+        // local and the encoder output is transferred once per window. requires ggml built with GGML_RPC
+        const char * rpc_server;
+
+        // record timings of the graphs and ops of each state (default: WHISPER_TRACE_NONE)
+        enum whisper_trace_level trace;
+
         // [EXPERIMENTAL] Token-level timestamps with DTW
         bool dtw_token_timestamps;
         enum whisper_alignment_heads_preset dtw_aheads_preset;
@@ -240,6 +278,10 @@ extern "C" {
 
     WHISPER_API struct whisper_state * whisper_init_state(struct whisper_context * ctx);
 
+    // The default state of the context, in which whisper_full() and whisper_full_parallel() store their results
+    // nullptr for contexts initialized without a state
+    WHISPER_API struct whisper_state * whisper_get_state(struct whisper_context * ctx);
+
     // Given a context, enable use of OpenVINO for encode inference.
     // model_path: Optional path to OpenVINO encoder IR model. If set to nullptr,
     //                      the path will be generated from the ggml model path that was passed
@@ -264,6 +306,11 @@ extern "C" {
                     const char * device,
                     const char * cache_dir);
 
+    // Write the weights that were converted on load by the CPU_REPACK / AMX buffer types to a sidecar file, so that later
+    // loads with whisper_context_params.repack_cache = path_cache on the same CPU can skip the conversion
+    // Returns the number of tensors written (0 if no weights were repacked) or -1 on error
+    WHISPER_API int whisper_save_repack_cache(struct whisper_context * ctx, const char * path_cache);
+
     // Frees all allocated memory
     WHISPER_API void whisper_free      (struct whisper_context * ctx);
     WHISPER_API void whisper_free_state(struct whisper_state * state);
@@ -434,6 +481,11 @@ extern "C" {
     WHISPER_API whisper_token whisper_token_translate (struct whisper_context * ctx);
     WHISPER_API whisper_token whisper_token_transcribe(struct whisper_context * ctx);
 
+    // Put the CPU threads of a state to sleep, e.g. while a server is idle, and wake them up again.
+    // A paused state is resumed automatically by its next computation.
+    WHISPER_API void whisper_threadpool_pause (struct whisper_state * state);
+    WHISPER_API void whisper_threadpool_resume(struct whisper_state * state);
+
     // Performance information from the default state.
     struct whisper_timings {
         float sample_ms;
@@ -441,11 +493,48 @@ extern "C" {
         float decode_ms;
         float batchd_ms;
         float prompt_ms;
+
+        // totals since the last whisper_reset_timings()
+        int64_t t_mel_us;
+        int64_t t_sample_us;
+        int64_t t_encode_us;
+        int64_t t_decode_us;
+        int64_t t_batchd_us;
+        int64_t t_prompt_us;
     };
     WHISPER_API struct whisper_timings * whisper_get_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // Same as above for a state created with whisper_init_state()
+    WHISPER_API void whisper_print_timings_with_state(struct whisper_context * ctx, struct whisper_state * state);
+    WHISPER_API void whisper_reset_timings_with_state(struct whisper_context * ctx, struct whisper_state * state);
+
+    // Statistics of the encoder cache of the context, see whisper_context_params.encoder_cache_mb
+    struct whisper_encoder_cache_stats {
+        int64_t n_hit;     // encoder passes served from the cache
+        int64_t n_miss;    // encoder passes computed while the cache was enabled
+        int32_t n_entries; // cached windows
+        size_t  size;      // bytes in use
+    };
+    WHISPER_API struct whisper_encoder_cache_stats whisper_get_encoder_cache_stats(struct whisper_context * ctx);
+
+    // Trace of the default state, see whisper_context_params.trace
+    // whisper_full_parallel() merges the traces of its states into the default state, with one thread per state
+    // The summary lists the time per graph and per op, the per-token decode latency histogram, the time the threadpool
+    // waited between graphs and the high-water marks of the compute buffers. It is valid until the next call.
+    // For a context without a default state (whisper_init_*_no_state()), use the _with_state versions
+    WHISPER_API const char * whisper_trace_summary(struct whisper_context * ctx);
+    WHISPER_API const char * whisper_trace_summary_with_state(struct whisper_state * state);
+
+    // Write the trace in the Chrome trace event format (chrome://tracing, https://ui.perfetto.dev)
+    // Returns false if tracing is disabled or the file cannot be written
+    WHISPER_API bool whisper_trace_save_chrome(struct whisper_context * ctx, const char * fname);
+    WHISPER_API bool whisper_trace_save_chrome_with_state(struct whisper_state * state, const char * fname);
+
+    WHISPER_API void whisper_trace_reset(struct whisper_context * ctx);
+    WHISPER_API void whisper_trace_reset_with_state(struct whisper_state * state);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -520,6 +609,12 @@ extern "C" {
         // A regular expression that matches tokens to suppress
         const char * suppress_regex;
 
+        // Restrict the output layer to these tokens, plus the special and (unless no_timestamps) timestamp tokens
+        // The hidden state is projected only onto their embedding rows and all other tokens get -INF logits, e.g. for
+        // command lists with a few hundred tokens (NULL - full vocabulary)
+        const whisper_token * vocab_shortlist;
+        int                   vocab_shortlist_n;
+
         // tokens to provide to the whisper decoder as initial prompt
         // these are prepended to any existing text context from a previous call
         // use whisper_tokenize() to convert text to tokens
@@ -613,10 +708,12 @@ extern "C" {
                                    int   n_samples);
 
     // Split the input audio in chunks and process each chunk separately using whisper_full_with_state()
+    // The audio is split at silence (the gaps between VAD speech segments when VAD is enabled, otherwise
+    // energy minima) into more chunks than processors. The chunks are distributed over n_processors
+    // worker states that are created on first use and reused by subsequent calls on the same context.
     // Result is stored in the default state of the context
     // Not thread safe if executed in parallel on the same context.
-    // It seems this approach can offer some speedup in some cases.
-    // However, the transcription accuracy can be worse at the beginning and end of each chunk.
+    // The transcription accuracy can still be worse near a boundary if no silence was found around it.
     WHISPER_API int whisper_full_parallel(
                 struct whisper_context * ctx,
             struct whisper_full_params   params,
@@ -624,6 +721,60 @@ extern "C" {
                                    int   n_samples,
                                    int   n_processors);
 
+    // Thresholds of whisper_full_cascade() - a segment of the first pass is transcribed again with the larger
+    // model if any of them is crossed
+    typedef struct whisper_cascade_params {
+        float logprob_thold;   // average log probability of the text tokens below this
+        float entropy_thold;   // entropy of the last 32 text tokens below this (repetitions, see entropy_thold)
+        float no_speech_thold; // no_speech_prob above this
+        int   pad_ms;          // audio context added on both sides of a re-decoded segment
+    } whisper_cascade_params;
+
+    WHISPER_API struct whisper_cascade_params whisper_cascade_default_params(void);
+
+    // Transcribe with a fast model and re-decode only the uncertain segments with a larger one
+    // The audio is transcribed with ctx as with whisper_full(). Runs of consecutive segments that cross the
+    // cascade thresholds are then transcribed again with ctx_large, from a slice of the log mel spectrogram
+    // that was computed for the first pass, and replace the original segments.
+    // Both models must have the same number of mel bands and the same vocabulary (e.g. tiny.en -> small.en).
+    // Result is stored in the default state of ctx, the timings of the second pass in the default state of
+    // ctx_large. new_segment_callback is called for each segment after both passes.
+    WHISPER_API int whisper_full_cascade(
+                struct whisper_context * ctx,
+                struct whisper_context * ctx_large,
+            struct whisper_full_params   params,
+         struct whisper_cascade_params   cparams,
+                           const float * samples,
+                                   int   n_samples);
+
+    // Supplies the audio for whisper_full_from_reader(): write at most n_max mono F32 samples at
+    // WHISPER_SAMPLE_RATE to samples and return their number, 0 at the end of the input or < 0 on error
+    // Called from a worker thread, but never concurrently
+    typedef int (*whisper_audio_read_callback)(float * samples, int n_max, void * user_data);
+
+    // Bounded-memory variant of whisper_full() for long inputs
+    // The audio is pulled from read_callback and transcribed in windows of n_window_ms (at least 60 s).
+    // The next window is decoded while the current one is transcribed, so the memory use does not depend
+    // on the length of the input. The last segment of each window is transcribed again at the start of the
+    // next one, so that words are not cut at the boundary.
+    // The segments of all windows are accumulated in the state, with timestamps relative to the start of
+    // the input, and new_segment_callback is called for each window as its segments become final.
+    // progress_callback is not called, since the length of the input is not known in advance.
+    WHISPER_API int whisper_full_from_reader(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+            whisper_audio_read_callback  read_callback,
+                                  void * read_callback_user_data,
+                                   int   n_window_ms);
+
+    WHISPER_API int whisper_full_from_reader_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+            whisper_audio_read_callback  read_callback,
+                                  void * read_callback_user_data,
+                                   int   n_window_ms);
+
     // Number of generated text segments
     // A segment can be a few words, a sentence, or even a paragraph.
     WHISPER_API int whisper_full_n_segments           (struct whisper_context * ctx);
@@ -670,6 +821,63 @@ extern "C" {
     WHISPER_API float whisper_full_get_token_p           (struct whisper_context * ctx, int i_segment, int i_token);
     WHISPER_API float whisper_full_get_token_p_from_state(struct whisper_state * state, int i_segment, int i_token);
 
+    //
+    // Streaming transcription with stable-prefix commits
+    //
+    // Audio is appended with whisper_stream_push() and the current window is re-transcribed by
+    // whisper_stream_process(). Tokens on which two consecutive hypotheses agree (LocalAgreement-2) are
+    // committed: they are reported once through the token callback and the audio they cover is dropped
+    // from the window, so that only the uncommitted tail has to be transcribed again.
+    // The committed text that is no longer in the window is used as prompt for the next transcriptions.
+    //
+
+    struct whisper_stream;
+
+    // Called at the end of each whisper_stream_process() and whisper_stream_flush() call
+    // tokens_committed are the newly committed tokens (reported only once)
+    // tokens_tentative are the current uncommitted tokens, which may still change
+    // The token timestamps t0 and t1 are relative to the start of the stream
+    typedef void (*whisper_stream_token_callback)(
+            struct whisper_context * ctx,
+        const whisper_token_data * tokens_committed,
+                               int   n_committed,
+        const whisper_token_data * tokens_tentative,
+                               int   n_tentative,
+                             void * user_data);
+
+    struct whisper_stream_params {
+        struct whisper_full_params wparams; // decoding parameters for each transcription of the window
+
+        int max_window_ms; // commit all tokens when the window gets longer than this (must be < 30 s)
+
+        whisper_stream_token_callback token_callback;
+        void * token_callback_user_data;
+    };
+
+    WHISPER_API struct whisper_stream_params whisper_stream_default_params(enum whisper_sampling_strategy strategy);
+
+    // The stream uses its own whisper_state, so it does not affect the default state of the context
+    WHISPER_API struct whisper_stream * whisper_stream_init(struct whisper_context * ctx, struct whisper_stream_params params);
+
+    // Append audio to the window
+    WHISPER_API int whisper_stream_push(
+            struct whisper_stream * stream,
+                      const float * samples,
+                              int   n_samples);
+
+    // Transcribe the current window and commit the stable prefix
+    // Returns the number of newly committed tokens, or a negative value on failure
+    WHISPER_API int whisper_stream_process(struct whisper_stream * stream);
+
+    // Commit the tentative tokens and clear the window (e.g. at the end of the input)
+    // Returns the number of newly committed tokens
+    WHISPER_API int whisper_stream_flush(struct whisper_stream * stream);
+
+    // Length of the audio window that is still transcribed on each call, in samples
+    WHISPER_API int whisper_stream_n_window_samples(struct whisper_stream * stream);
+
+    WHISPER_API void whisper_stream_free(struct whisper_stream * stream);
+
     //
     // Voice Activity Detection (VAD)
     //
@@ -16,6 +16,7 @@
 
 #include <atomic>
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cfloat>
 #define _USE_MATH_DEFINES
@@ -27,6 +28,7 @@
 #include <cstring>
 #include <fstream>
 #include <functional>
+#include <list>
 #include <map>
 #include <mutex>
 #include <random>
@@ -138,7 +140,9 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
     } while (0)
 
 #define WHISPER_MAX_DECODERS 8
+#define WHISPER_SEQ_ID_PROMPT (2*WHISPER_MAX_DECODERS) // KV cells of the prompt, kept for the temperature fallbacks
 #define WHISPER_MAX_NODES 4096
+#define WHISPER_GRAMMAR_CACHE_MAX 256 // grammar states with a cached allowed-token bitmask, per state
 
 static std::string format(const char * fmt, ...) {
     va_list ap;
@@ -555,6 +559,21 @@ static void whisper_batch_prep_legacy(whisper_batch & batch, const whisper_token
     batch.logits[n_tokens - 1] = 1;
 }
 
+// number of rows of the decoder output, i.e. of tokens with logits (at least 1)
+// a batch has at most one such token per decoder, this is what the worst-case graph reserves
+static int whisper_batch_n_outputs(const whisper_batch & batch, bool worst_case) {
+    if (worst_case) {
+        return std::min(batch.n_tokens, WHISPER_MAX_DECODERS);
+    }
+
+    int n_outputs = 0;
+    for (int i = 0; i < batch.n_tokens; ++i) {
+        n_outputs += batch.logits[i] != 0;
+    }
+
+    return std::max(1, n_outputs);
+}
+
 // replace std::pair by using customized pair struct (reason: std::pair is very slow)
 template<typename A, typename B>
 struct whisper_pair {
@@ -792,6 +811,13 @@ struct whisper_model {
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
+
+    // source data hashes of the tensors in CPU_REPACK and AMX buffers, see whisper_save_repack_cache()
+    std::map<std::string, uint64_t> repack_src_hash;
+
+    // identity of the whole model for the repack cache: size and hash of the data of all tensors
+    uint64_t repack_model_size = 0;
+    uint64_t repack_model_hash = 0;
 };
 
 struct whisper_partial_utf8 {
@@ -813,6 +839,39 @@ struct whisper_grammar_candidate {
     whisper_partial_utf8   partial_utf8;
 };
 
+// text token decoded into code points, see whisper_grammar_vocab_init()
+struct whisper_grammar_token {
+    whisper_token        id;
+    whisper_partial_utf8 partial_utf8; // incomplete UTF-8 sequence at the end of the token, if any
+};
+
+// node of the prefix trie over the code points of the text tokens
+// the children of a node are contiguous and sorted by code point
+struct whisper_grammar_trie_node {
+    uint32_t chr;
+
+    int32_t child_begin;
+    int32_t child_end;
+
+    // tokens whose code points end at this node
+    int32_t token_begin;
+    int32_t token_end;
+};
+
+// built once at load and shared by all states of the context
+struct whisper_grammar_vocab {
+    std::vector<whisper_grammar_trie_node> nodes; // nodes[0] is the root
+    std::vector<whisper_grammar_token>     tokens;
+};
+
+// allowed-token bitmasks of recently seen grammar states, keyed by the stacks and the pending partial UTF-8 sequence
+// the keys hold pointers into the rules of the decoders, so the cache is cleared whenever the decoder grammars are reset
+struct whisper_grammar_cache {
+    std::mutex mutex;
+
+    std::map<std::string, std::vector<uint64_t>> entries;
+};
+
 struct whisper_sequence {
     std::vector<whisper_token_data> tokens;
 
@@ -864,6 +923,90 @@ struct vad_time_mapping {
     int64_t original_time;   // Corresponding time in original audio
 };
 
+// CPU threadpool owned by a state
+// created on first use and reused by all graphs of the state, so the worker threads are not re-spawned for every
+// graph (i.e. for every decoded token)
+struct whisper_threadpool {
+    ggml_threadpool_t threadpool = nullptr;
+
+    int n_threads = 0;
+};
+
+// opt-in tracing, see whisper_context_params.trace
+//
+// events keep absolute ggml_time_us() timestamps, so that the traces of several states can be merged
+// the number of events is capped, the statistics keep counting after that
+#define WHISPER_TRACE_MAX_EVENTS (1 << 20)
+
+struct whisper_trace_event {
+    const char * name; // static string - graph, op or host stage
+    const char * cat;  // "host", "graph" or "op"
+
+    int64_t t_start_us;
+    int64_t t_dur_us;
+
+    int32_t tid;
+    int32_t arg; // n_tokens of a decode, n_nodes of a graph (-1 - none)
+
+    char node[GGML_MAX_NAME]; // tensor name of an op
+};
+
+struct whisper_trace_stat {
+    int64_t n        = 0;
+    int64_t t_us     = 0;
+    int64_t t_max_us = 0;
+
+    void add(int64_t t) {
+        n++;
+        t_us    += t;
+        t_max_us = std::max(t_max_us, t);
+    }
+
+    void add(const whisper_trace_stat & other) {
+        n       += other.n;
+        t_us    += other.t_us;
+        t_max_us = std::max(t_max_us, other.t_max_us);
+    }
+};
+
+struct whisper_trace_graph {
+    whisper_trace_stat time;
+
+    size_t mem_max = 0; // high-water mark of the compute buffers
+
+    // indexed by ggml_op, followed by the unary ops
+    std::array<whisper_trace_stat, GGML_OP_COUNT + GGML_UNARY_OP_COUNT> ops;
+};
+
+// upper bounds of the buckets of the per-token decode latency histogram in ms, the last bucket is open-ended
+static const int WHISPER_TRACE_HIST_MS[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512 };
+
+struct whisper_trace {
+    whisper_trace_level level = WHISPER_TRACE_NONE;
+
+    int64_t t_origin_us = 0;
+
+    std::vector<whisper_trace_event> events;
+    int64_t n_dropped = 0;
+
+    std::map<std::string, whisper_trace_graph> graphs;
+    std::map<std::string, whisper_trace_stat>  host;
+
+    // decode calls of the generation steps of whisper_full(), one per step for all decoders
+    whisper_trace_stat token;
+    std::array<int64_t, sizeof(WHISPER_TRACE_HIST_MS)/sizeof(WHISPER_TRACE_HIST_MS[0]) + 1> token_hist = {};
+
+    // time the threadpool spent waiting for work between two graphs of the same whisper_full() call
+    int64_t t_idle_us      = 0;
+    int64_t t_graph_end_us = 0;
+
+    // graph and op being computed, see whisper_trace_eval_cb()
+    whisper_trace_graph * cur_graph = nullptr;
+    int64_t t_op_start_us = 0;
+
+    std::string summary;
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -901,6 +1044,15 @@ struct whisper_state {
 
     std::vector<ggml_backend_t> backends;
 
+    // remote backend of the conv and encoder graphs (nullptr - they run on the local backends)
+    ggml_backend_t backend_enc = nullptr;
+
+    // persistent threadpool of the CPU backend, see whisper_threadpool_prepare()
+    whisper_threadpool threadpool;
+
+    // see whisper_context_params.trace
+    whisper_trace trace;
+
     // - stores meta info about the intermediate tensors into the `meta` buffers
     whisper_sched sched_conv;
     whisper_sched sched_encode;
@@ -918,6 +1070,14 @@ struct whisper_state {
     // decode output (2-dimensional array: [n_tokens][n_vocab])
     std::vector<float> logits;
 
+    // sorted token ids that the decoder projects onto (empty - full vocabulary)
+    // set by whisper_full() from whisper_full_params.vocab_shortlist
+    std::vector<int32_t> vocab_shortlist;
+    std::vector<float>   logits_shortlist;
+
+    // see whisper_suppress_invalid_grammar()
+    whisper_grammar_cache grammar_cache;
+
     std::vector<whisper_segment> result_all;
     std::vector<whisper_token>   prompt_past;
 
@@ -964,6 +1124,30 @@ struct whisper_state {
     std::vector<vad_time_mapping> vad_mapping_table;
 };
 
+// cross-attention KV of a recently encoded window, see whisper_context_params.encoder_cache_mb
+struct whisper_encoder_cache_entry {
+    uint64_t hash;
+    int      n_ctx;
+
+    std::vector<float> mel; // the input of the window, compared on lookup to rule out hash collisions
+
+    std::vector<uint8_t> k;
+    std::vector<uint8_t> v;
+};
+
+struct whisper_encoder_cache {
+    std::mutex mutex;
+
+    size_t size     = 0;
+    size_t size_max = 0;
+
+    int64_t n_hit  = 0;
+    int64_t n_miss = 0;
+
+    // most recently used first
+    std::list<whisper_encoder_cache_entry> entries;
+};
+
 struct whisper_context {
     int64_t t_load_us  = 0;
     int64_t t_start_us = 0;
@@ -976,8 +1160,20 @@ struct whisper_context {
     whisper_model model;
     whisper_vocab vocab;
 
+    // token trie used by grammar-constrained decoding
+    whisper_grammar_vocab grammar_vocab;
+
     whisper_state * state = nullptr;
 
+    // worker states used by whisper_full_parallel(), created on first use
+    std::vector<whisper_state *> states_parallel;
+
+    // shared by all states of the context
+    whisper_encoder_cache encoder_cache;
+
+    // remote device of the conv and encoder graphs, see whisper_context_params.rpc_server
+    ggml_backend_dev_t dev_enc = nullptr;
+
     std::string path_model; // populated by whisper_init_from_file_with_params()
 };
 
@@ -998,7 +1194,8 @@ static void read_safe(whisper_model_loader * loader, T & dest) {
 static bool whisper_kv_cache_init(
              struct whisper_kv_cache & cache,
                       ggml_backend_t   backend,
-                           ggml_type   wtype,
+                           ggml_type   type_k,
+                           ggml_type   type_v,
                              int64_t   n_text_state,
                              int64_t   n_text_layer,
                                  int   n_ctx) {
@@ -1026,8 +1223,8 @@ static bool whisper_kv_cache_init(
         return false;
     }
 
-    cache.k = ggml_new_tensor_1d(ctx, wtype, n_elements);
-    cache.v = ggml_new_tensor_1d(ctx, wtype, n_elements);
+    cache.k = ggml_new_tensor_1d(ctx, type_k, n_elements);
+    cache.v = ggml_new_tensor_1d(ctx, type_v, n_elements);
 
     cache.buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
     if (!cache.buffer) {
@@ -1166,6 +1363,24 @@ static void whisper_kv_cache_seq_cp(
     }
 }
 
+// free all cells that do not belong to seq_id
+static void whisper_kv_cache_seq_keep(struct whisper_kv_cache & cache, whisper_seq_id seq_id) {
+    uint32_t new_head = cache.size;
+
+    for (uint32_t i = 0; i < cache.size; ++i) {
+        if (!cache.cells[i].has_seq_id(seq_id)) {
+            if (cache.cells[i].pos >= 0 && new_head == cache.size) new_head = i;
+            cache.cells[i].pos = -1;
+            cache.cells[i].seq_id.clear();
+        } else {
+            cache.cells[i].seq_id.clear();
+            cache.cells[i].seq_id.insert(seq_id);
+        }
+    }
+
+    if (new_head != cache.size) cache.head = new_head;
+}
+
 static uint32_t whisper_kv_cache_get_padding(const struct whisper_context & wctx) {
     if (!wctx.params.flash_attn || !wctx.params.use_gpu) {
         return 1u;
@@ -1384,6 +1599,341 @@ static std::vector<ggml_backend_t> whisper_backend_init(const whisper_context_pa
     return result;
 }
 
+// the encoder backends are the remote one, if any, followed by the local ones as a fallback for unsupported ops
+static std::vector<ggml_backend_t> whisper_backends_encoder(const whisper_state & state) {
+    std::vector<ggml_backend_t> result;
+
+    if (state.backend_enc) {
+        result.push_back(state.backend_enc);
+    }
+    result.insert(result.end(), state.backends.begin(), state.backends.end());
+
+    return result;
+}
+
+typedef ggml_backend_dev_t (*whisper_rpc_add_device_t)(const char * endpoint);
+
+static ggml_backend_dev_t whisper_rpc_add_device(const char * endpoint) {
+    ggml_backend_reg_t reg = ggml_backend_reg_by_name("RPC");
+    if (!reg) {
+        WHISPER_LOG_ERROR("%s: ggml was built without the RPC backend (GGML_RPC=OFF)\n", __func__);
+        return nullptr;
+    }
+
+    auto * add_device_fn = (whisper_rpc_add_device_t) ggml_backend_reg_get_proc_address(reg, "ggml_backend_rpc_add_device");
+    if (!add_device_fn) {
+        WHISPER_LOG_ERROR("%s: ggml_backend_rpc_add_device() not found\n", __func__);
+        return nullptr;
+    }
+
+    ggml_backend_dev_t dev = add_device_fn(endpoint);
+
+    // the RPC device reports no memory if the server cannot be reached
+    size_t free  = 0;
+    size_t total = 0;
+    ggml_backend_dev_memory(dev, &free, &total);
+    if (total == 0) {
+        WHISPER_LOG_ERROR("%s: failed to connect to RPC server '%s'\n", __func__, endpoint);
+        return nullptr;
+    }
+
+    WHISPER_LOG_INFO("%s: encoder on %s (%zu MB free)\n", __func__, ggml_backend_dev_name(dev), free/1024/1024);
+
+    return dev;
+}
+
+// parse a hex CPU mask such as "0xF0" - the last digit covers cores 0-3
+static bool whisper_parse_cpu_mask(const char * str, bool (&mask)[GGML_MAX_N_THREADS]) {
+    std::string hex = str;
+    if (hex.size() > 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+        hex = hex.substr(2);
+    }
+
+    std::fill(mask, mask + GGML_MAX_N_THREADS, false);
+
+    int core = 0;
+    for (auto it = hex.rbegin(); it != hex.rend() && core < GGML_MAX_N_THREADS; ++it) {
+        int v;
+        if      (*it >= '0' && *it <= '9') { v = *it - '0'; }
+        else if (*it >= 'a' && *it <= 'f') { v = *it - 'a' + 10; }
+        else if (*it >= 'A' && *it <= 'F') { v = *it - 'A' + 10; }
+        else {
+            return false;
+        }
+
+        for (int b = 0; b < 4 && core < GGML_MAX_N_THREADS; ++b, ++core) {
+            mask[core] = (v >> b) & 1;
+        }
+    }
+
+    return true;
+}
+
+// make sure the CPU backend runs on a threadpool with n_threads threads
+// the threadpool is only re-created when the number of threads changes
+static void whisper_threadpool_prepare(
+                         whisper_threadpool & tp,
+        const std::vector<ggml_backend_t> & backends,
+       const whisper_context_params & params,
+                                  int   n_threads) {
+    if (tp.threadpool != nullptr && tp.n_threads == n_threads) {
+        return;
+    }
+
+    // the CPU backend is always the last one
+    ggml_backend_t backend_cpu = backends.back();
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend_cpu));
+
+    auto * fn_threadpool_new  = (decltype(ggml_threadpool_new)  *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_new");
+    auto * fn_threadpool_free = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free");
+    auto * fn_set_threadpool  = (decltype(ggml_backend_cpu_set_threadpool) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_threadpool");
+
+    if (!fn_threadpool_new || !fn_threadpool_free || !fn_set_threadpool) {
+        return;
+    }
+
+    ggml_threadpool_params tpp;
+    ggml_threadpool_params_init(&tpp, n_threads);
+
+    if (params.cpu_mask != nullptr && params.cpu_mask[0] != '\0') {
+        if (!whisper_parse_cpu_mask(params.cpu_mask, tpp.cpumask)) {
+            WHISPER_LOG_WARN("%s: invalid cpu_mask '%s' - using default affinity\n", __func__, params.cpu_mask);
+            std::fill(tpp.cpumask, tpp.cpumask + GGML_MAX_N_THREADS, false);
+        }
+    }
+
+    tpp.strict_cpu = params.cpu_strict;
+    tpp.prio       = (ggml_sched_priority) params.cpu_prio;
+    tpp.poll       = params.cpu_poll;
+
+    ggml_threadpool_t threadpool = fn_threadpool_new(&tpp);
+    if (threadpool == nullptr) {
+        WHISPER_LOG_WARN("%s: failed to create a threadpool with %d threads\n", __func__, n_threads);
+        return;
+    }
+
+    fn_set_threadpool(backend_cpu, threadpool);
+
+    if (tp.threadpool != nullptr) {
+        fn_threadpool_free(tp.threadpool);
+    }
+
+    tp.threadpool = threadpool;
+    tp.n_threads  = n_threads;
+}
+
+static void whisper_threadpool_free(whisper_threadpool & tp) {
+    if (tp.threadpool == nullptr) {
+        return;
+    }
+
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU));
+
+    auto * fn_threadpool_free = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(reg, "ggml_threadpool_free");
+    if (fn_threadpool_free) {
+        fn_threadpool_free(tp.threadpool);
+    }
+
+    tp.threadpool = nullptr;
+    tp.n_threads  = 0;
+}
+
+// pause / resume the worker threads of the threadpool
+static void whisper_threadpool_set_paused(whisper_threadpool & tp, bool paused) {
+    if (tp.threadpool == nullptr) {
+        return;
+    }
+
+    ggml_backend_reg_t reg = ggml_backend_dev_backend_reg(ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU));
+
+    auto * fn = (decltype(ggml_threadpool_pause) *) ggml_backend_reg_get_proc_address(reg, paused ? "ggml_threadpool_pause" : "ggml_threadpool_resume");
+    if (fn) {
+        fn(tp.threadpool);
+    }
+}
+
+static void whisper_trace_reset(whisper_trace & trace) {
+    const auto level = trace.level;
+
+    trace = whisper_trace();
+
+    trace.level       = level;
+    trace.t_origin_us = ggml_time_us();
+}
+
+static void whisper_trace_event_add(
+        whisper_trace & trace,
+         const char * name,
+         const char * cat,
+              int64_t t_start_us,
+              int64_t t_end_us,
+              int32_t arg  = -1,
+         const char * node = nullptr) {
+    if (trace.events.size() >= WHISPER_TRACE_MAX_EVENTS) {
+        trace.n_dropped++;
+        return;
+    }
+
+    whisper_trace_event ev;
+    ev.name       = name;
+    ev.cat        = cat;
+    ev.t_start_us = t_start_us;
+    ev.t_dur_us   = t_end_us - t_start_us;
+    ev.tid        = 0;
+    ev.arg        = arg;
+    snprintf(ev.node, sizeof(ev.node), "%s", node ? node : "");
+
+    trace.events.push_back(ev);
+}
+
+// record a stage that ran on the calling thread and ended now
+static void whisper_trace_host(whisper_trace & trace, const char * name, int64_t t_start_us, int32_t arg = -1) {
+    if (trace.level == WHISPER_TRACE_NONE) {
+        return;
+    }
+
+    const int64_t t_end_us = ggml_time_us();
+
+    trace.host[name].add(t_end_us - t_start_us);
+    whisper_trace_event_add(trace, name, "host", t_start_us, t_end_us, arg);
+}
+
+static void whisper_trace_token(whisper_trace & trace, int64_t t_us) {
+    if (trace.level == WHISPER_TRACE_NONE) {
+        return;
+    }
+
+    trace.token.add(t_us);
+
+    size_t i = 0;
+    while (i < trace.token_hist.size() - 1 && t_us > 1000*WHISPER_TRACE_HIST_MS[i]) {
+        i++;
+    }
+    trace.token_hist[i]++;
+}
+
+static int whisper_trace_op_index(const ggml_tensor * t) {
+    return t->op == GGML_OP_UNARY ? GGML_OP_COUNT + (int) ggml_get_unary_op(t) : (int) t->op;
+}
+
+static const char * whisper_trace_op_name(int i) {
+    return i < GGML_OP_COUNT ? ggml_op_name((ggml_op) i) : ggml_unary_op_name((ggml_unary_op) (i - GGML_OP_COUNT));
+}
+
+// backend sched eval callback that times every op
+// ops that only change the view of a tensor are computed together with the next op
+static bool whisper_trace_eval_cb(struct ggml_tensor * t, bool ask, void * user_data) {
+    auto & trace = *(whisper_trace *) user_data;
+
+    if (ask) {
+        switch (t->op) {
+            case GGML_OP_NONE:
+            case GGML_OP_RESHAPE:
+            case GGML_OP_VIEW:
+            case GGML_OP_PERMUTE:
+            case GGML_OP_TRANSPOSE:
+                return false;
+            default:
+                break;
+        }
+
+        trace.t_op_start_us = ggml_time_us();
+
+        return true;
+    }
+
+    const int64_t t_end_us = ggml_time_us();
+    const int     i_op     = whisper_trace_op_index(t);
+
+    trace.cur_graph->ops[i_op].add(t_end_us - trace.t_op_start_us);
+    whisper_trace_event_add(trace, whisper_trace_op_name(i_op), "op", trace.t_op_start_us, t_end_us, -1, t->name);
+
+    return true;
+}
+
+// add the trace of another state, its events are shown as thread tid
+static void whisper_trace_merge(whisper_trace & dst, const whisper_trace & src, int32_t tid) {
+    if (dst.level == WHISPER_TRACE_NONE) {
+        return;
+    }
+
+    for (const auto & ev : src.events) {
+        if (dst.events.size() >= WHISPER_TRACE_MAX_EVENTS) {
+            dst.n_dropped++;
+            continue;
+        }
+        dst.events.push_back(ev);
+        dst.events.back().tid = tid;
+    }
+    dst.n_dropped += src.n_dropped;
+
+    for (const auto & it : src.graphs) {
+        auto & g = dst.graphs[it.first];
+
+        g.time.add(it.second.time);
+        g.mem_max = std::max(g.mem_max, it.second.mem_max);
+        for (size_t i = 0; i < g.ops.size(); ++i) {
+            g.ops[i].add(it.second.ops[i]);
+        }
+    }
+
+    for (const auto & it : src.host) {
+        dst.host[it.first].add(it.second);
+    }
+
+    dst.token.add(src.token);
+    for (size_t i = 0; i < dst.token_hist.size(); ++i) {
+        dst.token_hist[i] += src.token_hist[i];
+    }
+
+    dst.t_idle_us += src.t_idle_us;
+}
+
+// compute a graph of the state, recording it in the trace when enabled
+static bool whisper_graph_compute(
+          whisper_state & wstate,
+          whisper_sched & wsched,
+     struct ggml_cgraph * graph,
+                    int   n_threads,
+             const char * name) {
+    auto & trace = wstate.trace;
+
+    if (trace.level == WHISPER_TRACE_NONE) {
+        return ggml_graph_compute_helper(wsched.sched, graph, n_threads);
+    }
+
+    auto & stat = trace.graphs[name];
+
+    if (trace.level >= WHISPER_TRACE_OPS) {
+        trace.cur_graph = &stat;
+        ggml_backend_sched_set_eval_callback(wsched.sched, whisper_trace_eval_cb, &trace);
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    if (trace.t_graph_end_us > 0) {
+        trace.t_idle_us += t_start_us - trace.t_graph_end_us;
+    }
+
+    const bool ok = ggml_graph_compute_helper(wsched.sched, graph, n_threads);
+
+    const int64_t t_end_us = ggml_time_us();
+
+    if (trace.level >= WHISPER_TRACE_OPS) {
+        ggml_backend_sched_set_eval_callback(wsched.sched, nullptr, nullptr);
+        trace.cur_graph = nullptr;
+    }
+
+    stat.time.add(t_end_us - t_start_us);
+    stat.mem_max = std::max(stat.mem_max, whisper_sched_size(wsched));
+
+    whisper_trace_event_add(trace, name, "graph", t_start_us, t_end_us, ggml_graph_n_nodes(graph));
+
+    trace.t_graph_end_us = t_end_us;
+
+    return ok;
+}
+
 using buft_list_t = std::vector<std::pair<ggml_backend_dev_t, ggml_backend_buffer_type_t>>;
 
 static buft_list_t make_buft_list(whisper_context_params & params) {
@@ -1496,40 +2046,237 @@ static ggml_backend_buffer_type_t select_weight_buft(const whisper_hparams & hpa
     return nullptr;
 }
 
-// load the model from a ggml file
+// pre-repacked weight cache
+//
+// the CPU_REPACK and AMX buffer types convert quantized weights into interleaved layouts in set_tensor() on every
+// load. the cache is a sidecar file with the converted data of these tensors, so that they can be read straight into
+// their buffer. it is valid only for the ggml build and CPU features that it was created with
 //
 // file format:
 //
-//   - hparams
-//   - pre-computed mel filters
-//   - vocab
-//   - weights
+//   - magic, version
+//   - fingerprint
+//   - model_size, model_hash
+//   - n_tensors x { name, buft, type, ne[4], nbytes, src_hash, offset }
+//   - tensor data
 //
-// see the convert-pt-to-ggml.py script for details
+// strings are stored as uint32 length + bytes
 //
-static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
-    WHISPER_LOG_INFO("%s: loading model\n", __func__);
 
-    const int64_t t_start_us = ggml_time_us();
+static const uint32_t WHISPER_REPACK_CACHE_MAGIC   = 0x7772706b; // "wrpk"
+static const uint32_t WHISPER_REPACK_CACHE_VERSION = 2;
 
-    wctx.t_start_us = t_start_us;
+struct whisper_repack_cache_entry {
+    std::string buft;
 
-    auto & model = wctx.model;
-    auto & vocab = wctx.vocab;
+    int32_t  type;
+    int64_t  ne[4];
+    uint64_t nbytes;
+    uint64_t src_hash;
+    uint64_t offset;
+};
 
-    // verify magic
-    {
-        uint32_t magic;
-        read_safe(loader, magic);
-        if (magic != GGML_FILE_MAGIC) {
-            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
-            return false;
-        }
+struct whisper_repack_cache {
+    std::ifstream fin;
+
+    uint64_t model_size = 0;
+    uint64_t model_hash = 0;
+
+    std::map<std::string, whisper_repack_cache_entry> entries;
+};
+
+static bool whisper_buffer_is_repack(ggml_backend_buffer_t buf) {
+    if (!buf) {
+        return false;
     }
 
-    //load hparams
-    {
-        auto & hparams = model.hparams;
+    const char * name = ggml_backend_buft_name(ggml_backend_buffer_get_type(buf));
+
+    return strcmp(name, "CPU_REPACK") == 0 || strcmp(name, "AMX") == 0;
+}
+
+// size of the converted data, which can differ from ggml_nbytes() (AMX)
+static size_t whisper_repack_nbytes(const ggml_tensor * tensor) {
+    return ggml_backend_buft_get_alloc_size(ggml_backend_buffer_get_type(tensor->buffer), tensor);
+}
+
+// the layouts chosen by CPU_REPACK and AMX depend on the ggml version and on the features of the CPU backend
+static std::string whisper_repack_fingerprint() {
+    std::string s = std::string("ggml ") + ggml_version() + " " + ggml_commit();
+
+    auto * cpu_dev = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    auto * cpu_reg = ggml_backend_dev_backend_reg(cpu_dev);
+    auto * get_features_fn = (ggml_backend_get_features_t) ggml_backend_reg_get_proc_address(cpu_reg, "ggml_backend_get_features");
+    if (get_features_fn) {
+        for (ggml_backend_feature * features = get_features_fn(cpu_reg); features->name; features++) {
+            s += " ";
+            s += features->name;
+            s += "=";
+            s += features->value;
+        }
+    }
+
+    return s;
+}
+
+static const uint64_t WHISPER_REPACK_HASH_SEED = 0xcbf29ce484222325ULL;
+
+// identity of source data for the repack cache, fed 8 bytes at a time so that hashing all of the weights stays cheap
+// next to reading them. it tells apart models with the same shapes, it is not a cryptographic hash
+static uint64_t whisper_repack_hash(uint64_t h, const char * data, size_t n) {
+    h ^= n;
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, data + i, sizeof(w));
+        h ^= w;
+        h *= 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i) {
+        h ^= (uint8_t) data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+template<typename T>
+static void write_value(std::ofstream & fout, const T & value) {
+    fout.write((const char *) &value, sizeof(value));
+}
+
+static void write_string(std::ofstream & fout, const std::string & str) {
+    write_value(fout, (uint32_t) str.size());
+    fout.write(str.data(), str.size());
+}
+
+template<typename T>
+static bool read_value(std::ifstream & fin, T & value) {
+    return (bool) fin.read((char *) &value, sizeof(value));
+}
+
+static bool read_string(std::ifstream & fin, std::string & str) {
+    uint32_t len = 0;
+    if (!read_value(fin, len) || len > (1u << 20)) {
+        return false;
+    }
+    str.resize(len);
+    return (bool) fin.read(&str[0], len);
+}
+
+static bool whisper_repack_cache_open(whisper_repack_cache & cache, const char * path) {
+    cache.fin.open(path, std::ios::binary);
+    if (!cache.fin) {
+        WHISPER_LOG_WARN("%s: failed to open repack cache '%s' - weights will be repacked on load\n", __func__, path);
+        return false;
+    }
+
+    uint32_t magic   = 0;
+    uint32_t version = 0;
+    std::string fingerprint;
+
+    if (!read_value(cache.fin, magic)   || magic   != WHISPER_REPACK_CACHE_MAGIC ||
+        !read_value(cache.fin, version) || version != WHISPER_REPACK_CACHE_VERSION ||
+        !read_string(cache.fin, fingerprint)) {
+        WHISPER_LOG_WARN("%s: '%s' is not a repack cache of this version - weights will be repacked on load\n", __func__, path);
+        return false;
+    }
+
+    if (fingerprint != whisper_repack_fingerprint()) {
+        WHISPER_LOG_WARN("%s: repack cache '%s' was created for a different CPU or ggml build - weights will be repacked on load\n", __func__, path);
+        return false;
+    }
+
+    uint32_t n_tensors = 0;
+    bool ok = read_value(cache.fin, cache.model_size) && read_value(cache.fin, cache.model_hash) && read_value(cache.fin, n_tensors);
+
+    for (uint32_t i = 0; ok && i < n_tensors; ++i) {
+        std::string name;
+        whisper_repack_cache_entry entry;
+
+        ok = read_string(cache.fin, name) && read_string(cache.fin, entry.buft) && read_value(cache.fin, entry.type);
+        for (int j = 0; j < 4; ++j) {
+            ok = ok && read_value(cache.fin, entry.ne[j]);
+        }
+        ok = ok && read_value(cache.fin, entry.nbytes) && read_value(cache.fin, entry.src_hash) && read_value(cache.fin, entry.offset);
+
+        cache.entries[name] = entry;
+    }
+
+    if (!ok) {
+        WHISPER_LOG_WARN("%s: repack cache '%s' is truncated - weights will be repacked on load\n", __func__, path);
+        cache.entries.clear();
+        return false;
+    }
+
+    return true;
+}
+
+// read the pre-repacked data of a tensor from the cache into its buffer, bypassing the conversion in set_tensor()
+static bool whisper_repack_cache_load(whisper_repack_cache & cache, const std::string & name, ggml_tensor * tensor, uint64_t src_hash) {
+    const auto it = cache.entries.find(name);
+    if (it == cache.entries.end()) {
+        return false;
+    }
+
+    const auto & entry = it->second;
+
+    if (entry.buft != ggml_backend_buft_name(ggml_backend_buffer_get_type(tensor->buffer))) {
+        return false;
+    }
+
+    if (entry.type != tensor->type || entry.nbytes != whisper_repack_nbytes(tensor) || entry.src_hash != src_hash) {
+        return false;
+    }
+    for (int j = 0; j < 4; ++j) {
+        if (entry.ne[j] != tensor->ne[j]) {
+            return false;
+        }
+    }
+
+    // these buffers are plain host memory, only their set_tensor() is special
+    cache.fin.seekg(entry.offset);
+    cache.fin.read((char *) tensor->data, entry.nbytes);
+
+    return (bool) cache.fin;
+}
+
+// load the model from a ggml file
+//
+// file format:
+//
+//   - hparams
+//   - pre-computed mel filters
+//   - vocab
+//   - weights
+//
+// see the convert-pt-to-ggml.py script for details
+//
+static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    wctx.t_start_us = t_start_us;
+
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
+
+    // verify magic
+    {
+        uint32_t magic;
+        read_safe(loader, magic);
+        if (magic != GGML_FILE_MAGIC) {
+            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
+            return false;
+        }
+    }
+
+    //load hparams
+    {
+        auto & hparams = model.hparams;
 
         read_safe(loader, hparams.n_vocab);
         read_safe(loader, hparams.n_audio_ctx);
@@ -1736,9 +2483,15 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     // Create a list of available bufts, in priority order
     buft_list_t buft_list = make_buft_list(wctx.params);
 
+    // the encoder weights go to the remote device, the cross-attention projections are part of the local cross graph
+    buft_list_t buft_list_enc = buft_list;
+    if (wctx.dev_enc) {
+        buft_list_enc.insert(buft_list_enc.begin(), { wctx.dev_enc, ggml_backend_dev_buffer_type(wctx.dev_enc) });
+    }
+
     auto create_tensor = [&](asr_tensor type, asr_system system, ggml_tensor * meta, int layer = 0) -> ggml_tensor * {
         ggml_op op = ASR_TENSOR_INFO.at(type);
-        ggml_backend_buffer_type_t buft = select_weight_buft(hparams, meta, op, buft_list);
+        ggml_backend_buffer_type_t buft = select_weight_buft(hparams, meta, op, system == ASR_SYSTEM_ENCODER ? buft_list_enc : buft_list);
         if (!buft) {
             throw std::runtime_error(format("failed to find a compatible buffer type for tensor %s", ASR_TENSOR_NAMES.at(system).at(type)));
         }
@@ -1891,6 +2644,26 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
         std::vector<char> read_buf;
 
+        // the model identity is only needed when some of the weights are converted
+        bool has_repack = false;
+        for (const auto & kv : model.tensors) {
+            has_repack = has_repack || whisper_buffer_is_repack(kv.second->buffer);
+            model.repack_model_size += ggml_nbytes(kv.second);
+        }
+
+        model.repack_model_hash = WHISPER_REPACK_HASH_SEED;
+
+        whisper_repack_cache repack_cache;
+
+        bool has_repack_cache = has_repack && wctx.params.repack_cache && whisper_repack_cache_open(repack_cache, wctx.params.repack_cache);
+
+        if (has_repack_cache && repack_cache.model_size != model.repack_model_size) {
+            WHISPER_LOG_WARN("%s: repack cache '%s' was created for a different model - weights will be repacked on load\n", __func__, wctx.params.repack_cache);
+            has_repack_cache = false;
+        }
+
+        int n_repack_cached = 0;
+
         while (true) {
             int32_t n_dims;
             int32_t length;
@@ -1948,13 +2721,34 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 // for the CPU and Metal backend, we can read directly into the tensor
                 loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
                 BYTESWAP_TENSOR(tensor);
+
+                if (has_repack) {
+                    model.repack_model_hash = whisper_repack_hash(model.repack_model_hash, (const char *) tensor->data, ggml_nbytes(tensor));
+                }
             } else {
                 // read into a temporary buffer first, then copy to device memory
                 read_buf.resize(ggml_nbytes(tensor));
-
                 loader->read(loader->context, read_buf.data(), read_buf.size());
 
-                ggml_backend_tensor_set(tensor, read_buf.data(), 0, ggml_nbytes(tensor));
+                if (has_repack) {
+                    model.repack_model_hash = whisper_repack_hash(model.repack_model_hash, read_buf.data(), read_buf.size());
+                }
+
+                bool cached = false;
+
+                if (whisper_buffer_is_repack(tensor->buffer)) {
+                    const uint64_t src_hash = whisper_repack_hash(WHISPER_REPACK_HASH_SEED, read_buf.data(), read_buf.size());
+
+                    model.repack_src_hash[name] = src_hash;
+
+                    cached = has_repack_cache && whisper_repack_cache_load(repack_cache, name, tensor, src_hash);
+                }
+
+                if (cached) {
+                    n_repack_cached++;
+                } else {
+                    ggml_backend_tensor_set(tensor, read_buf.data(), 0, ggml_nbytes(tensor));
+                }
             }
 
             total_size += ggml_nbytes(tensor);
@@ -1963,6 +2757,16 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
         WHISPER_LOG_INFO("%s: model size    = %7.2f MB\n", __func__, total_size/1e6);
 
+        if (has_repack_cache) {
+            WHISPER_LOG_INFO("%s: loaded %d / %zu repacked tensors from '%s'\n", __func__,
+                    n_repack_cached, model.repack_src_hash.size(), wctx.params.repack_cache);
+
+            // the tensors taken from the cache matched all of their source data, so only the file is stale
+            if (repack_cache.model_hash != model.repack_model_hash) {
+                WHISPER_LOG_WARN("%s: repack cache '%s' was created for a different model - recreate it\n", __func__, wctx.params.repack_cache);
+            }
+        }
+
         if (model.n_loaded == 0) {
             WHISPER_LOG_WARN("%s: WARN no tensors loaded from model file - assuming empty model for testing\n", __func__);
         } else if (model.n_loaded != (int) model.tensors.size()) {
@@ -2026,8 +2830,15 @@ static struct ggml_cgraph * whisper_build_graph_conv(
     struct ggml_tensor * cur = nullptr;
 
     if (!whisper_encode_external(wstate)) {
+        // the CPU backend computes the convolutions directly with the bias and GELU fused,
+        // which avoids materializing the im2col matrices in the compute buffer
+        const bool use_conv_direct = ggml_backend_dev_type(ggml_backend_get_device(whisper_backends_encoder(wstate)[0])) != GGML_BACKEND_DEVICE_TYPE_GPU;
+
         // convolution + gelu
-        {
+        if (use_conv_direct) {
+            cur = ggml_conv_1d_direct_bias_gelu(ctx0, model.e_conv_1_w, mel, model.e_conv_1_b, 1, model.e_conv_1_w->ne[0]/2, 1);
+            cur = ggml_conv_1d_direct_bias_gelu(ctx0, model.e_conv_2_w, cur, model.e_conv_2_b, 2, model.e_conv_2_w->ne[0]/2, 1);
+        } else {
             cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
             cur = ggml_add(ctx0, cur, model.e_conv_1_b);
 
@@ -2318,7 +3129,16 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
     ggml_cgraph * gf = ggml_new_graph(ctx0);
 
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+    struct ggml_tensor * cur = nullptr;
+
+    if (wstate.backend_enc) {
+        // the encoder output is in the memory of the remote backend, whisper_encode_internal() copies it into this input
+        cur = ggml_dup_tensor(ctx0, wstate.embd_enc);
+        ggml_set_name(cur, "embd_enc");
+        ggml_set_input(cur);
+    } else {
+        cur = ggml_view_tensor(ctx0, wstate.embd_enc);
+    }
 
     const float  Kscale = pow(float(n_state_head), -0.25);
 
@@ -2344,15 +3164,15 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
         if (wctx.params.flash_attn) {
             k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+                    ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx_pad));
 
             v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
+                    ggml_row_size(wstate.kv_cross.v->type, n_state)*(il*n_ctx_pad));
         } else {
             Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
 
             k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+                    ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx));
 
             v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
                     (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
@@ -2370,6 +3190,85 @@ static struct ggml_cgraph * whisper_build_graph_cross(
     return gf;
 }
 
+static uint64_t whisper_encoder_cache_hash(const std::vector<float> & mel, int n_ctx) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t) n_ctx;
+
+    const uint32_t * data = (const uint32_t *) mel.data();
+    for (size_t i = 0; i < mel.size(); ++i) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+// restore the cross-attention KV of the current input of the encoder from the cache
+// returns false on a miss, or if the cache is disabled
+static bool whisper_encoder_cache_load(whisper_context & wctx, whisper_state & wstate, int n_ctx) {
+    auto & cache = wctx.encoder_cache;
+
+    if (cache.size_max == 0) {
+        return false;
+    }
+
+    const uint64_t hash = whisper_encoder_cache_hash(wstate.inp_mel, n_ctx);
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    for (auto it = cache.entries.begin(); it != cache.entries.end(); ++it) {
+        if (it->hash != hash || it->n_ctx != n_ctx || it->mel != wstate.inp_mel) {
+            continue;
+        }
+
+        ggml_backend_tensor_set(wstate.kv_cross.k, it->k.data(), 0, it->k.size());
+        ggml_backend_tensor_set(wstate.kv_cross.v, it->v.data(), 0, it->v.size());
+
+        cache.entries.splice(cache.entries.begin(), cache.entries, it);
+        cache.n_hit++;
+
+        return true;
+    }
+
+    cache.n_miss++;
+
+    return false;
+}
+
+// add the cross-attention KV that was just computed to the cache, evicting the least recently used windows
+static void whisper_encoder_cache_store(whisper_context & wctx, whisper_state & wstate, int n_ctx) {
+    auto & cache = wctx.encoder_cache;
+
+    whisper_encoder_cache_entry entry;
+
+    const size_t size = wstate.inp_mel.size()*sizeof(float) + ggml_nbytes(wstate.kv_cross.k) + ggml_nbytes(wstate.kv_cross.v);
+
+    if (size > cache.size_max) {
+        return;
+    }
+
+    entry.hash  = whisper_encoder_cache_hash(wstate.inp_mel, n_ctx);
+    entry.n_ctx = n_ctx;
+    entry.mel   = wstate.inp_mel;
+
+    entry.k.resize(ggml_nbytes(wstate.kv_cross.k));
+    entry.v.resize(ggml_nbytes(wstate.kv_cross.v));
+
+    ggml_backend_tensor_get(wstate.kv_cross.k, entry.k.data(), 0, entry.k.size());
+    ggml_backend_tensor_get(wstate.kv_cross.v, entry.v.data(), 0, entry.v.size());
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    cache.entries.push_front(std::move(entry));
+    cache.size += size;
+
+    while (cache.size > cache.size_max) {
+        const auto & last = cache.entries.back();
+
+        cache.size -= last.mel.size()*sizeof(float) + last.k.size() + last.v.size();
+        cache.entries.pop_back();
+    }
+}
+
 // evaluate the encoder with the given state
 //
 // given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
@@ -2389,6 +3288,40 @@ static bool whisper_encode_internal(
                    void * abort_callback_data) {
     const int64_t t_start_us = ggml_time_us();
 
+    whisper_threadpool_prepare(wstate.threadpool, wstate.backends, wctx.params, n_threads);
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    // prepare the input
+    {
+        const auto & mel_inp = wstate.mel;
+
+        assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
+
+        wstate.inp_mel.resize(2*n_ctx*mel_inp.n_mel);
+
+        float * dst = wstate.inp_mel.data();
+        memset(dst, 0, wstate.inp_mel.size()*sizeof(float));
+
+        const int i0 = std::min(mel_offset,           mel_inp.n_len);
+        const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+
+        for (int j = 0; j < mel_inp.n_mel; ++j) {
+            for (int i = i0; i < i1; ++i) {
+                dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+            }
+        }
+    }
+
+    if (whisper_encoder_cache_load(wctx, wstate, n_ctx)) {
+        wstate.t_encode_us += ggml_time_us() - t_start_us;
+        wstate.n_encode++;
+
+        whisper_trace_host(wstate.trace, "encode (cached)", t_start_us);
+
+        return !(abort_callback && abort_callback(abort_callback_data));
+    }
+
     // conv
     {
         auto & sched = wstate.sched_conv.sched;
@@ -2404,31 +3337,14 @@ static bool whisper_encode_internal(
 
         // set the input
         {
-            const auto & mel_inp = wstate.mel;
-            const int n_ctx      = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
-
             assert(mel->type == GGML_TYPE_F32);
-            assert(mel_inp.n_mel == wctx.model.hparams.n_mels);
-
-            wstate.inp_mel.resize(ggml_nelements(mel));
-
-            float * dst = wstate.inp_mel.data();
-            memset(dst, 0, ggml_nbytes(mel));
-
-            const int i0 = std::min(mel_offset,           mel_inp.n_len);
-            const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
-
-            for (int j = 0; j < mel_inp.n_mel; ++j) {
-                for (int i = i0; i < i1; ++i) {
-                    dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-                }
-            }
+            assert(ggml_nelements(mel) == (int64_t) wstate.inp_mel.size());
 
             ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
         }
 
         if (!whisper_encode_external(wstate)) {
-            if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            if (!whisper_graph_compute(wstate, wstate.sched_conv, gf, n_threads, "conv")) {
                 return false;
             }
         } else {
@@ -2453,7 +3369,7 @@ static bool whisper_encode_internal(
             return false;
         }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!whisper_graph_compute(wstate, wstate.sched_encode, gf, n_threads, "encoder")) {
             return false;
         }
     }
@@ -2469,14 +3385,22 @@ static bool whisper_encode_internal(
             return false;
         }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (wstate.backend_enc) {
+            ggml_backend_tensor_copy(wstate.embd_enc, ggml_graph_get_tensor(gf, "embd_enc"));
+        }
+
+        if (!whisper_graph_compute(wstate, wstate.sched_cross, gf, n_threads, "cross")) {
             return false;
         }
     }
 
+    whisper_encoder_cache_store(wctx, wstate, n_ctx);
+
     wstate.t_encode_us += ggml_time_us() - t_start_us;
     wstate.n_encode++;
 
+    whisper_trace_host(wstate.trace, "encode", t_start_us);
+
     return !(abort_callback && abort_callback(abort_callback_data));
 }
 
@@ -2596,15 +3520,15 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
                 if (wctx.params.flash_attn) {
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.v->type, n_state)*(il*n_ctx + kv_head));
                 } else {
                     Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
 
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
                             (   n_ctx)*ggml_element_size(kv_self.v),
@@ -2625,17 +3549,17 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
             if (wctx.params.flash_attn) {
                 struct ggml_tensor * V =
                     ggml_view_3d(ctx0, kv_self.v,
                             n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state_head),
+                            ggml_row_size(kv_self.v->type, n_state)*n_ctx*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
 
@@ -2706,16 +3630,16 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx_pad*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
                             n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
+                            ggml_row_size(wstate.kv_cross.v->type, n_state),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state)*n_audio_ctx_pad*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
 
@@ -2724,9 +3648,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
@@ -2836,12 +3760,33 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 model.d_ln_b);
     }
 
-    // compute logits only for the last token
-    // comment this line to compute logits for all n_tokens
-    // might be useful in the future
-    //cur = ggml_view_2d(ctx0, cur, cur->ne[0], 1, cur->nb[1], (cur->ne[1] - 1)*cur->nb[1]);
+    // compute logits only for the tokens with batch.logits set - the vocab projection is the largest matmul of a
+    // prompt, of which only the last row is used
+    // the rows are gathered with the "out_ids" input, see whisper_decode_internal()
+    {
+        const int n_outputs = whisper_batch_n_outputs(batch, worst_case);
+
+        if (n_outputs < n_tokens) {
+            struct ggml_tensor * out_ids = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_outputs);
+            ggml_set_name(out_ids, "out_ids");
+            ggml_set_input(out_ids);
+
+            cur = ggml_get_rows(ctx0, cur, out_ids);
+        }
+    }
+
+    struct ggml_tensor * logits = nullptr;
+
+    if (wstate.vocab_shortlist.empty()) {
+        logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    } else {
+        // project only onto the embedding rows of the shortlist
+        struct ggml_tensor * shortlist = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, wstate.vocab_shortlist.size());
+        ggml_set_name(shortlist, "shortlist");
+        ggml_set_input(shortlist);
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+        logits = ggml_mul_mat(ctx0, ggml_get_rows(ctx0, model.d_te, shortlist), cur);
+    }
 
     // [EXPERIMENTAL] Token-level timestamps with DTW
     if (wctx.params.dtw_token_timestamps && aheads_cross_QKs != nullptr) {
@@ -2880,6 +3825,8 @@ static bool whisper_decode_internal(
                    void * abort_callback_data) {
     const int64_t t_start_us = ggml_time_us();
 
+    whisper_threadpool_prepare(wstate.threadpool, wstate.backends, wctx.params, n_threads);
+
     const auto & model   = wctx.model;
     const auto & hparams = model.hparams;
 
@@ -2964,19 +3911,59 @@ static bool whisper_decode_internal(
             ggml_backend_tensor_set(KQ_mask, wstate.inp_mask.data(), 0, ggml_nelements(KQ_mask)*sizeof(float));
         }
 
+        // rows of the tokens with logits, when not all of them have
+        if (struct ggml_tensor * out_ids = ggml_graph_get_tensor(gf, "out_ids")) {
+            std::vector<int32_t> ids;
+            for (int i = 0; i < n_tokens; ++i) {
+                if (batch.logits[i] != 0) {
+                    ids.push_back(i);
+                }
+            }
+            if (ids.empty()) {
+                ids.push_back(n_tokens - 1);
+            }
+
+            ggml_backend_tensor_set(out_ids, ids.data(), 0, ids.size()*sizeof(int32_t));
+        }
+
+        if (struct ggml_tensor * shortlist = ggml_graph_get_tensor(gf, "shortlist")) {
+            ggml_backend_tensor_set(shortlist, wstate.vocab_shortlist.data(), 0, wstate.vocab_shortlist.size()*sizeof(int32_t));
+        }
+
         logits = ggml_graph_node(gf, -1);
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (!whisper_graph_compute(wstate, wstate.sched_decode, gf, n_threads, "decoder")) {
             return false;
         }
     }
 
+    // the output has one row per token with logits, they are kept at the position of the token in logits_out
     logits_out.resize(n_tokens*n_vocab);
-    for (int i = 0; i < n_tokens; i++) {
+
+    const auto & shortlist = wstate.vocab_shortlist;
+
+    for (int i = 0, i_out = 0; i < n_tokens; i++) {
         if (batch.logits[i] == 0) {
             continue;
         }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
+
+        float * dst = logits_out.data() + (n_vocab*i);
+
+        if (shortlist.empty()) {
+            ggml_backend_tensor_get(logits, dst, sizeof(float)*(n_vocab*i_out), sizeof(float)*n_vocab);
+        } else {
+            const int n_short = shortlist.size();
+
+            wstate.logits_shortlist.resize(n_short);
+            ggml_backend_tensor_get(logits, wstate.logits_shortlist.data(), sizeof(float)*(n_short*i_out), sizeof(float)*n_short);
+
+            std::fill(dst, dst + n_vocab, -INFINITY);
+            for (int j = 0; j < n_short; ++j) {
+                dst[shortlist[j]] = wstate.logits_shortlist[j];
+            }
+        }
+
+        i_out++;
     }
 
     if (batch.n_tokens > 1) {
@@ -2988,6 +3975,8 @@ static bool whisper_decode_internal(
         //        wstate.get_buf_max_mem(3)/1e6);
     }
 
+    whisper_trace_host(wstate.trace, "decode", t_start_us, n_tokens);
+
     if (batch.n_tokens == 1) {
         wstate.t_decode_us += ggml_time_us() - t_start_us;
         wstate.n_decode++;
@@ -3270,6 +4259,8 @@ static bool log_mel_spectrogram(
 
     wstate.t_mel_us += ggml_time_us() - t_start_us;
 
+    whisper_trace_host(wstate.trace, "mel", t_start_us);
+
     // Dump log_mel_spectrogram
     if (debug) {
         std::ofstream outFile("log_mel_spectrogram.json");
@@ -3406,10 +4397,22 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         return nullptr;
     }
 
+    if (ctx->dev_enc) {
+        state->backend_enc = ggml_backend_dev_init(ctx->dev_enc, nullptr);
+        if (!state->backend_enc) {
+            WHISPER_LOG_ERROR("%s: failed to initialize %s backend\n", __func__, ggml_backend_dev_name(ctx->dev_enc));
+            whisper_free_state(state);
+            return nullptr;
+        }
+    }
+
+    state->trace.level = ctx->params.trace;
+    whisper_trace_reset(state->trace);
+
     // at this point, we don't know yet how many decoders will be used
     // later during decoding, if more decoders are used, we will recreate the KV cache respectively
     state->kv_self_n_dec = 1;
-    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->params.type_k, ctx->params.type_v,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
@@ -3420,10 +4423,11 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     {
         const size_t memory_size = ggml_nbytes(state->kv_self.k) + ggml_nbytes(state->kv_self.v);
-        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
+        WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB (K %s, V %s)\n", __func__, memory_size / 1e6,
+                ggml_type_name(state->kv_self.k->type), ggml_type_name(state->kv_self.v->type));
     }
 
-    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->params.type_k, ctx->params.type_v,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3437,7 +4441,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
     }
 
-    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
+    if (!whisper_kv_cache_init(state->kv_pad, whisper_backends_encoder(*state)[0], ctx->itype, ctx->itype,
                 ctx->model.hparams.n_audio_state,
                 1,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3496,7 +4500,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     // conv allocator
     {
-        bool ok = whisper_sched_graph_init(state->sched_conv, state->backends,
+        bool ok = whisper_sched_graph_init(state->sched_conv, whisper_backends_encoder(*state),
                 [&]() {
                     return whisper_build_graph_conv(*ctx, *state);
                 });
@@ -3512,7 +4516,7 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 
     // encoder allocator
     if (!whisper_encode_external(*state)) {
-        bool ok = whisper_sched_graph_init(state->sched_encode, state->backends,
+        bool ok = whisper_sched_graph_init(state->sched_encode, whisper_backends_encoder(*state),
                 [&]() {
                     return whisper_build_graph_encoder(*ctx, *state);
                 });
@@ -3628,23 +4632,109 @@ int whisper_ctx_init_openvino_encoder(
     return whisper_ctx_init_openvino_encoder_with_state(ctx, ctx->state, model_path, device, cache_dir);
 }
 
-struct whisper_context_params whisper_context_default_params() {
-    struct whisper_context_params result = {
-        /*.use_gpu              =*/ true,
-        /*.flash_attn           =*/ false,
-        /*.gpu_device           =*/ 0,
+int whisper_save_repack_cache(struct whisper_context * ctx, const char * path_cache) {
+    const auto & model = ctx->model;
 
-        /*.dtw_token_timestamps =*/ false,
-        /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
-        /*.dtw_n_top            =*/ -1,
-        /*.dtw_aheads           =*/ {
-            /*.n_heads          =*/ 0,
-            /*.heads            =*/ NULL,
-        },
-        /*.dtw_mem_size         =*/ 1024*1024*128,
-    };
-    return result;
-}
+    std::vector<std::pair<std::string, ggml_tensor *>> tensors;
+    for (const auto & kv : model.tensors) {
+        if (whisper_buffer_is_repack(kv.second->buffer) && model.repack_src_hash.count(kv.first)) {
+            tensors.emplace_back(kv.first, kv.second);
+        }
+    }
+
+    std::ofstream fout(path_cache, std::ios::binary);
+    if (!fout) {
+        WHISPER_LOG_ERROR("%s: failed to open '%s' for writing\n", __func__, path_cache);
+        return -1;
+    }
+
+    const std::string fingerprint = whisper_repack_fingerprint();
+
+    write_value(fout, WHISPER_REPACK_CACHE_MAGIC);
+    write_value(fout, WHISPER_REPACK_CACHE_VERSION);
+    write_string(fout, fingerprint);
+    write_value(fout, model.repack_model_size);
+    write_value(fout, model.repack_model_hash);
+    write_value(fout, (uint32_t) tensors.size());
+
+    // the data follows the index
+    uint64_t offset = 4*sizeof(uint32_t) + fingerprint.size() + 2*sizeof(uint64_t);
+    uint64_t data_size = 0;
+    for (const auto & t : tensors) {
+        const std::string buft = ggml_backend_buft_name(ggml_backend_buffer_get_type(t.second->buffer));
+
+        offset += 2*sizeof(uint32_t) + t.first.size() + buft.size() + sizeof(int32_t) + 4*sizeof(int64_t) + 3*sizeof(uint64_t);
+    }
+
+    for (const auto & t : tensors) {
+        const ggml_tensor * tensor = t.second;
+
+        write_string(fout, t.first);
+        write_string(fout, ggml_backend_buft_name(ggml_backend_buffer_get_type(tensor->buffer)));
+        write_value(fout, (int32_t) tensor->type);
+        for (int j = 0; j < 4; ++j) {
+            write_value(fout, (int64_t) tensor->ne[j]);
+        }
+        write_value(fout, (uint64_t) whisper_repack_nbytes(tensor));
+        write_value(fout, model.repack_src_hash.at(t.first));
+        write_value(fout, offset);
+
+        offset    += whisper_repack_nbytes(tensor);
+        data_size += whisper_repack_nbytes(tensor);
+    }
+
+    GGML_ASSERT((uint64_t) fout.tellp() == offset - data_size);
+
+    // these buffers have no get_tensor(), but their data is plain host memory
+    for (const auto & t : tensors) {
+        fout.write((const char *) t.second->data, whisper_repack_nbytes(t.second));
+    }
+
+    fout.close();
+    if (!fout) {
+        WHISPER_LOG_ERROR("%s: failed to write '%s'\n", __func__, path_cache);
+        return -1;
+    }
+
+    WHISPER_LOG_INFO("%s: saved %zu repacked tensors to '%s'\n", __func__, tensors.size(), path_cache);
+
+    return (int) tensors.size();
+}
+
+struct whisper_context_params whisper_context_default_params() {
+    struct whisper_context_params result = {
+        /*.use_gpu              =*/ true,
+        /*.flash_attn           =*/ false,
+        /*.gpu_device           =*/ 0,
+
+        /*.type_k               =*/ GGML_TYPE_F16,
+        /*.type_v               =*/ GGML_TYPE_F16,
+
+        /*.cpu_mask             =*/ nullptr,
+        /*.cpu_strict           =*/ false,
+        /*.cpu_prio             =*/ GGML_SCHED_PRIO_NORMAL,
+        /*.cpu_poll             =*/ 50,
+
+        /*.repack_cache         =*/ nullptr,
+        /*.encoder_cache_mb     =*/ 0,
+
+        /*.rpc_server           =*/ nullptr,
+
+        /*.trace                =*/ WHISPER_TRACE_NONE,
+
+        /*.dtw_token_timestamps =*/ false,
+        /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
+        /*.dtw_n_top            =*/ -1,
+        /*.dtw_aheads           =*/ {
+            /*.n_heads          =*/ 0,
+            /*.heads            =*/ NULL,
+        },
+        /*.dtw_mem_size         =*/ 1024*1024*128,
+    };
+    return result;
+}
+
+static void whisper_grammar_vocab_init(whisper_grammar_vocab & gvocab, const whisper_vocab & vocab);
 
 struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
     WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
@@ -3735,16 +4825,34 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
         params.dtw_token_timestamps = false;
     }
 
+    // the non-flash-attn path stores V transposed, which cannot be done in a block-quantized tensor
+    if (!params.flash_attn && ggml_is_quantized(params.type_v)) {
+        WHISPER_LOG_WARN("%s: quantized V cache requires flash_attn - using %s\n", __func__, ggml_type_name(GGML_TYPE_F16));
+        params.type_v = GGML_TYPE_F16;
+    }
+
     WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
     WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
     WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
     WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
+    WHISPER_LOG_INFO("%s: kv type    = K %s, V %s\n", __func__, ggml_type_name(params.type_k), ggml_type_name(params.type_v));
     WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
     WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
 
     whisper_context * ctx = new whisper_context;
     ctx->params = params;
 
+    ctx->encoder_cache.size_max = (size_t) std::max(0, params.encoder_cache_mb)*1024*1024;
+
+    if (params.rpc_server && params.rpc_server[0]) {
+        ctx->dev_enc = whisper_rpc_add_device(params.rpc_server);
+        if (!ctx->dev_enc) {
+            loader->close(loader->context);
+            delete ctx;
+            return nullptr;
+        }
+    }
+
     if (!whisper_model_load(loader, *ctx)) {
         loader->close(loader->context);
         WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
@@ -3754,6 +4862,22 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
 
     loader->close(loader->context);
 
+    whisper_grammar_vocab_init(ctx->grammar_vocab, ctx->vocab);
+
+    // the cache rows are split per head, so a head must hold a whole number of quantization blocks
+    {
+        const int64_t n_state_head = ctx->model.hparams.n_text_state/ctx->model.hparams.n_text_head;
+
+        ggml_type * types[2] = { &ctx->params.type_k, &ctx->params.type_v };
+        for (ggml_type * type : types) {
+            if (n_state_head % ggml_blck_size(*type) != 0) {
+                WHISPER_LOG_WARN("%s: head size %d is not a multiple of the %s block size - using %s\n",
+                        __func__, (int) n_state_head, ggml_type_name(*type), ggml_type_name(GGML_TYPE_F16));
+                *type = GGML_TYPE_F16;
+            }
+        }
+    }
+
     return ctx;
 }
 
@@ -3826,6 +4950,10 @@ struct whisper_context * whisper_init_no_state(struct whisper_model_loader * loa
     return whisper_init_with_params_no_state(loader, whisper_context_default_params());
 }
 
+struct whisper_state * whisper_get_state(struct whisper_context * ctx) {
+    return ctx->state;
+}
+
 void whisper_free_state(struct whisper_state * state) {
     if (state) {
         whisper_kv_cache_free(state->kv_self);
@@ -3857,6 +4985,10 @@ void whisper_free_state(struct whisper_state * state) {
             ggml_backend_free(backend);
         }
 
+        ggml_backend_free(state->backend_enc);
+
+        whisper_threadpool_free(state->threadpool);
+
         // [EXPERIMENTAL] Token-level timestamps with DTW
         aheads_masks_free(state->aheads_masks);
 
@@ -3881,6 +5013,10 @@ void whisper_free(struct whisper_context * ctx) {
 
         whisper_free_state(ctx->state);
 
+        for (whisper_state * state : ctx->states_parallel) {
+            whisper_free_state(state);
+        }
+
         delete ctx;
     }
 }
@@ -3958,6 +5094,9 @@ int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
 }
 
 int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
+    // the shortlist of whisper_full() does not apply to direct calls
+    state->vocab_shortlist.clear();
+
     whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
 
     whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
@@ -4267,6 +5406,14 @@ whisper_token whisper_token_transcribe(struct whisper_context * ctx) {
     return ctx->vocab.token_transcribe;
 }
 
+void whisper_threadpool_pause(struct whisper_state * state) {
+    whisper_threadpool_set_paused(state->threadpool, true);
+}
+
+void whisper_threadpool_resume(struct whisper_state * state) {
+    whisper_threadpool_set_paused(state->threadpool, false);
+}
+
 struct whisper_timings * whisper_get_timings(struct whisper_context * ctx) {
     if (ctx->state == nullptr) {
         return nullptr;
@@ -4277,48 +5424,258 @@ struct whisper_timings * whisper_get_timings(struct whisper_context * ctx) {
     timings->decode_ms = 1e-3f * ctx->state->t_decode_us / std::max(1, ctx->state->n_decode);
     timings->batchd_ms = 1e-3f * ctx->state->t_batchd_us / std::max(1, ctx->state->n_batchd);
     timings->prompt_ms = 1e-3f * ctx->state->t_prompt_us / std::max(1, ctx->state->n_prompt);
+
+    timings->t_mel_us    = ctx->state->t_mel_us;
+    timings->t_sample_us = ctx->state->t_sample_us;
+    timings->t_encode_us = ctx->state->t_encode_us;
+    timings->t_decode_us = ctx->state->t_decode_us;
+    timings->t_batchd_us = ctx->state->t_batchd_us;
+    timings->t_prompt_us = ctx->state->t_prompt_us;
     return timings;
 }
 
 void whisper_print_timings(struct whisper_context * ctx) {
+    whisper_print_timings_with_state(ctx, ctx->state);
+}
+
+void whisper_print_timings_with_state(struct whisper_context * ctx, struct whisper_state * state) {
+    // the prefix of whisper_print_timings(), which the bench scripts parse
+    const char * func = "whisper_print_timings";
+
     const int64_t t_end_us = ggml_time_us();
 
     WHISPER_LOG_INFO("\n");
-    WHISPER_LOG_INFO("%s:     load time = %8.2f ms\n", __func__, ctx->t_load_us / 1000.0f);
-    if (ctx->state != nullptr) {
+    WHISPER_LOG_INFO("%s:     load time = %8.2f ms\n", func, ctx->t_load_us / 1000.0f);
+    if (state != nullptr) {
 
-        const int32_t n_sample = std::max(1, ctx->state->n_sample);
-        const int32_t n_encode = std::max(1, ctx->state->n_encode);
-        const int32_t n_decode = std::max(1, ctx->state->n_decode);
-        const int32_t n_batchd = std::max(1, ctx->state->n_batchd);
-        const int32_t n_prompt = std::max(1, ctx->state->n_prompt);
+        const int32_t n_sample = std::max(1, state->n_sample);
+        const int32_t n_encode = std::max(1, state->n_encode);
+        const int32_t n_decode = std::max(1, state->n_decode);
+        const int32_t n_batchd = std::max(1, state->n_batchd);
+        const int32_t n_prompt = std::max(1, state->n_prompt);
 
-        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h);
-        WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", __func__, ctx->state->t_mel_us / 1000.0f);
-        WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_sample_us, n_sample, 1e-3f * ctx->state->t_sample_us / n_sample);
-        WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_encode_us, n_encode, 1e-3f * ctx->state->t_encode_us / n_encode);
-        WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_decode_us, n_decode, 1e-3f * ctx->state->t_decode_us / n_decode);
-        WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
-        WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
+        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", func, state->n_fail_p, state->n_fail_h);
+        WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", func, state->t_mel_us / 1000.0f);
+        WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", func, 1e-3f * state->t_sample_us, n_sample, 1e-3f * state->t_sample_us / n_sample);
+        WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", func, 1e-3f * state->t_encode_us, n_encode, 1e-3f * state->t_encode_us / n_encode);
+        WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", func, 1e-3f * state->t_decode_us, n_decode, 1e-3f * state->t_decode_us / n_decode);
+        WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", func, 1e-3f * state->t_batchd_us, n_batchd, 1e-3f * state->t_batchd_us / n_batchd);
+        WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", func, 1e-3f * state->t_prompt_us, n_prompt, 1e-3f * state->t_prompt_us / n_prompt);
     }
-    WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
+    WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", func, (t_end_us - ctx->t_start_us)/1000.0f);
 }
 
 void whisper_reset_timings(struct whisper_context * ctx) {
     ctx->t_start_us = ggml_time_us();
-    if (ctx->state != nullptr) {
-        ctx->state->t_mel_us = 0;
-        ctx->state->t_sample_us = 0;
-        ctx->state->t_encode_us = 0;
-        ctx->state->t_decode_us = 0;
-        ctx->state->t_batchd_us = 0;
-        ctx->state->t_prompt_us = 0;
-        ctx->state->n_sample = 0;
-        ctx->state->n_encode = 0;
-        ctx->state->n_decode = 0;
-        ctx->state->n_batchd = 0;
-        ctx->state->n_prompt = 0;
+    whisper_reset_timings_with_state(ctx, ctx->state);
+}
+
+void whisper_reset_timings_with_state(struct whisper_context * /*ctx*/, struct whisper_state * state) {
+    if (state != nullptr) {
+        state->t_mel_us = 0;
+        state->t_sample_us = 0;
+        state->t_encode_us = 0;
+        state->t_decode_us = 0;
+        state->t_batchd_us = 0;
+        state->t_prompt_us = 0;
+        state->n_sample = 0;
+        state->n_encode = 0;
+        state->n_decode = 0;
+        state->n_batchd = 0;
+        state->n_prompt = 0;
+    }
+}
+
+struct whisper_encoder_cache_stats whisper_get_encoder_cache_stats(struct whisper_context * ctx) {
+    auto & cache = ctx->encoder_cache;
+
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    whisper_encoder_cache_stats stats;
+
+    stats.n_hit     = cache.n_hit;
+    stats.n_miss    = cache.n_miss;
+    stats.n_entries = cache.entries.size();
+    stats.size      = cache.size;
+
+    return stats;
+}
+
+const char * whisper_trace_summary(struct whisper_context * ctx) {
+    if (ctx->state == nullptr) {
+        WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
+        return "";
+    }
+    return whisper_trace_summary_with_state(ctx->state);
+}
+
+const char * whisper_trace_summary_with_state(struct whisper_state * state) {
+    auto & trace = state->trace;
+    auto & s     = trace.summary;
+
+    s.clear();
+
+    if (trace.level == WHISPER_TRACE_NONE) {
+        s = "tracing is disabled, see whisper_context_params.trace\n";
+        return s.c_str();
+    }
+
+    const bool has_ops = trace.level >= WHISPER_TRACE_OPS;
+
+    int64_t t_graphs_us = 0;
+    size_t  mem_compute = 0;
+
+    s += format("trace: %-16s %8s %10s %9s %9s %9s %10s\n", "graph", "runs", "total ms", "avg ms", "max ms", "ops ms", "buffer MB");
+    for (const auto & it : trace.graphs) {
+        const auto & g = it.second;
+
+        int64_t t_ops_us = 0;
+        for (const auto & op : g.ops) {
+            t_ops_us += op.t_us;
+        }
+
+        s += format("trace: %-16s %8lld %10.2f %9.3f %9.3f ", it.first.c_str(), (long long) g.time.n,
+                1e-3*g.time.t_us, 1e-3*g.time.t_us/std::max<int64_t>(1, g.time.n), 1e-3*g.time.t_max_us);
+        s += has_ops ? format("%9.2f", 1e-3*t_ops_us) : format("%9s", "-");
+        s += format(" %10.2f\n", g.mem_max/1e6);
+
+        t_graphs_us += g.time.t_us;
+        mem_compute += g.mem_max;
+    }
+
+    s += format("trace: threadpool idle between graphs = %.2f ms (%.1f%% of the graph time)\n",
+            1e-3*trace.t_idle_us, 100.0*trace.t_idle_us/std::max<int64_t>(1, t_graphs_us));
+
+    // the most expensive ops of each graph
+    if (has_ops) {
+        for (const auto & it : trace.graphs) {
+            const auto & g = it.second;
+
+            std::vector<int> idx;
+            for (int i = 0; i < (int) g.ops.size(); ++i) {
+                if (g.ops[i].n > 0) {
+                    idx.push_back(i);
+                }
+            }
+            std::sort(idx.begin(), idx.end(), [&](int a, int b) { return g.ops[a].t_us > g.ops[b].t_us; });
+
+            s += format("trace: %-16s %8s %10s %9s %9s\n", (it.first + " ops").c_str(), "runs", "total ms", "avg us", "share");
+            for (int i = 0; i < (int) std::min<size_t>(idx.size(), 10); ++i) {
+                const auto & op = g.ops[idx[i]];
+                s += format("trace:   %-14s %8lld %10.2f %9.1f %8.1f%%\n", whisper_trace_op_name(idx[i]), (long long) op.n,
+                        1e-3*op.t_us, (double) op.t_us/op.n, 100.0*op.t_us/std::max<int64_t>(1, g.time.t_us));
+            }
+        }
+    }
+
+    for (const auto & it : trace.host) {
+        s += format("trace: %-16s %8lld %10.2f %9.3f %9.3f\n", it.first.c_str(), (long long) it.second.n,
+                1e-3*it.second.t_us, 1e-3*it.second.t_us/std::max<int64_t>(1, it.second.n), 1e-3*it.second.t_max_us);
+    }
+
+    if (trace.token.n > 0) {
+        s += format("trace: per-token decode latency: n = %lld, avg = %.3f ms, max = %.3f ms\n", (long long) trace.token.n,
+                1e-3*trace.token.t_us/trace.token.n, 1e-3*trace.token.t_max_us);
+        for (size_t i = 0; i < trace.token_hist.size(); ++i) {
+            if (trace.token_hist[i] == 0) {
+                continue;
+            }
+            const std::string bucket = i < trace.token_hist.size() - 1 ?
+                format("<= %d ms", WHISPER_TRACE_HIST_MS[i]) : format(" > %d ms", WHISPER_TRACE_HIST_MS[i - 1]);
+            s += format("trace:   %-10s %8lld %5.1f%%\n", bucket.c_str(), (long long) trace.token_hist[i], 100.0*trace.token_hist[i]/trace.token.n);
+        }
+    }
+
+    const auto buf_size = [](const whisper_kv_cache & kv) {
+        return kv.buffer ? ggml_backend_buffer_get_size(kv.buffer) : 0;
+    };
+
+    s += format("trace: memory: compute buffers = %.2f MB (high-water), kv self = %.2f MB, kv cross = %.2f MB, kv pad = %.2f MB\n",
+            mem_compute/1e6, buf_size(state->kv_self)/1e6, buf_size(state->kv_cross)/1e6, buf_size(state->kv_pad)/1e6);
+
+    if (trace.n_dropped > 0) {
+        s += format("trace: %lld events were not recorded (limit %d)\n", (long long) trace.n_dropped, WHISPER_TRACE_MAX_EVENTS);
+    }
+
+    return s.c_str();
+}
+
+static std::string whisper_trace_json_escape(const char * str) {
+    std::string res;
+    for (const char * p = str; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            res += '\\';
+        }
+        if ((unsigned char) *p >= 0x20) {
+            res += *p;
+        }
+    }
+    return res;
+}
+
+bool whisper_trace_save_chrome(struct whisper_context * ctx, const char * fname) {
+    if (ctx->state == nullptr) {
+        WHISPER_LOG_ERROR("%s: ERROR state was not loaded.\n", __func__);
+        return false;
+    }
+    return whisper_trace_save_chrome_with_state(ctx->state, fname);
+}
+
+bool whisper_trace_save_chrome_with_state(struct whisper_state * state, const char * fname) {
+    const auto & trace = state->trace;
+
+    if (trace.level == WHISPER_TRACE_NONE) {
+        WHISPER_LOG_ERROR("%s: tracing is disabled, see whisper_context_params.trace\n", __func__);
+        return false;
+    }
+
+    FILE * fout = fopen(fname, "w");
+    if (!fout) {
+        WHISPER_LOG_ERROR("%s: failed to open '%s' for writing\n", __func__, fname);
+        return false;
+    }
+
+    fprintf(fout, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fout, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"whisper\"}}");
+
+    std::set<int32_t> tids;
+    for (const auto & ev : trace.events) {
+        tids.insert(ev.tid);
+    }
+    for (const auto tid : tids) {
+        fprintf(fout, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"state %d\"}}", tid, tid);
+    }
+
+    for (const auto & ev : trace.events) {
+        fprintf(fout, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":0,\"tid\":%d",
+                ev.name, ev.cat, (long long) (ev.t_start_us - trace.t_origin_us), (long long) ev.t_dur_us, ev.tid);
+
+        if (ev.node[0] != '\0') {
+            fprintf(fout, ",\"args\":{\"node\":\"%s\"}", whisper_trace_json_escape(ev.node).c_str());
+        } else if (ev.arg >= 0) {
+            fprintf(fout, ",\"args\":{\"%s\":%d}", strcmp(ev.cat, "graph") == 0 ? "n_nodes" : "n_tokens", ev.arg);
+        }
+
+        fprintf(fout, "}");
+    }
+
+    fprintf(fout, "\n]}\n");
+
+    const bool ok = !ferror(fout);
+    fclose(fout);
+
+    return ok;
+}
+
+void whisper_trace_reset(struct whisper_context * ctx) {
+    if (ctx->state == nullptr) {
+        return;
     }
+    whisper_trace_reset_with_state(ctx->state);
+}
+
+void whisper_trace_reset_with_state(struct whisper_state * state) {
+    whisper_trace_reset(state->trace);
 }
 
 static int whisper_has_coreml(void) {
@@ -4439,6 +5796,7 @@ struct whisper_vad_context {
     int     n_threads;
 
     std::vector<ggml_backend_t> backends;
+    whisper_threadpool          threadpool;
     ggml_backend_buffer_t       buffer = nullptr;
     whisper_context_params      params;
     std::vector<uint8_t>        ctx_buf;
@@ -4796,6 +6154,7 @@ struct whisper_vad_context * whisper_vad_init_with_params(
 
     whisper_vad_context * vctx = new whisper_vad_context;
     vctx->n_threads = params.n_threads;
+    vctx->params = whisper_context_default_params();
     vctx->params.use_gpu = params.use_gpu;
     vctx->params.gpu_device = params.gpu_device;
 
@@ -5138,6 +6497,8 @@ bool whisper_vad_detect_speech(
     struct ggml_tensor * frame = ggml_graph_get_tensor(gf, "frame");
     struct ggml_tensor * prob  = ggml_graph_get_tensor(gf, "prob");
 
+    whisper_threadpool_prepare(vctx->threadpool, vctx->backends, vctx->params, vctx->n_threads);
+
     // we are going to reuse the graph multiple times for each chunk
     const int64_t t_start_vad_us = ggml_time_us();
 
@@ -5473,6 +6834,7 @@ void whisper_vad_free(whisper_vad_context * ctx) {
             ggml_backend_free(backend);
         }
 
+        whisper_threadpool_free(ctx->threadpool);
 
         delete ctx;
     }
@@ -5830,8 +7192,154 @@ static struct whisper_grammar whisper_grammar_init(
     return { std::move(vec_rules), std::move(stacks), {} };
 }
 
+// decodes the text tokens into code points and builds a prefix trie over them, so that the grammar can reject all tokens
+// with a common prefix at once instead of matching each of them from the start
+static void whisper_grammar_vocab_init(whisper_grammar_vocab & gvocab, const whisper_vocab & vocab) {
+    // flat arena with the code points of all tokens, token i spans [offsets[i], offsets[i + 1])
+    std::vector<uint32_t>              code_points;
+    std::vector<size_t>                offsets;
+    std::vector<whisper_grammar_token> tokens;
+
+    for (whisper_token id = 0; id < vocab.token_eot; ++id) {
+        const auto it = vocab.id_to_token.find(id);
+        if (it == vocab.id_to_token.end() || it->second.empty()) {
+            continue;
+        }
+
+        // note the terminating 0 of the decoded string
+        const auto decoded = decode_utf8(it->second.c_str(), { 0, 0 });
+
+        offsets.push_back(code_points.size());
+        code_points.insert(code_points.end(), decoded.first.begin(), decoded.first.end() - 1);
+        tokens.push_back({ id, decoded.second });
+    }
+    offsets.push_back(code_points.size());
+
+    const auto len = [&](size_t i) { return offsets[i + 1] - offsets[i]; };
+    const auto chr = [&](size_t i, size_t depth) { return code_points[offsets[i] + depth]; };
+
+    // in lexicographic order the tokens of a subtree are contiguous and the ones that end at its root come first
+    std::vector<size_t> order(tokens.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return std::lexicographical_compare(
+                code_points.begin() + offsets[a], code_points.begin() + offsets[a + 1],
+                code_points.begin() + offsets[b], code_points.begin() + offsets[b + 1]);
+    });
+
+    struct node_range {
+        int32_t inode;
+        size_t  begin;
+        size_t  end;
+        size_t  depth;
+    };
+
+    gvocab.nodes.clear();
+    gvocab.tokens.clear();
+    gvocab.tokens.reserve(tokens.size());
+
+    // breadth-first, so that the children of each node are allocated next to each other
+    gvocab.nodes.push_back({ 0, 0, 0, 0, 0 });
+
+    std::vector<node_range> queue = { { 0, 0, order.size(), 0 } };
+
+    for (size_t q = 0; q < queue.size(); ++q) {
+        const node_range r = queue[q];
+
+        size_t i = r.begin;
+
+        gvocab.nodes[r.inode].token_begin = (int32_t) gvocab.tokens.size();
+        for (; i < r.end && len(order[i]) == r.depth; ++i) {
+            gvocab.tokens.push_back(tokens[order[i]]);
+        }
+        gvocab.nodes[r.inode].token_end = (int32_t) gvocab.tokens.size();
+
+        gvocab.nodes[r.inode].child_begin = (int32_t) gvocab.nodes.size();
+        while (i < r.end) {
+            const uint32_t c = chr(order[i], r.depth);
+
+            size_t j = i + 1;
+            while (j < r.end && chr(order[j], r.depth) == c) {
+                ++j;
+            }
+
+            queue.push_back({ (int32_t) gvocab.nodes.size(), i, j, r.depth + 1 });
+            gvocab.nodes.push_back({ c, 0, 0, 0, 0 });
+
+            i = j;
+        }
+        gvocab.nodes[r.inode].child_end = (int32_t) gvocab.nodes.size();
+    }
+
+    WHISPER_LOG_DEBUG("%s: %zu tokens, %zu code points, %zu trie nodes\n", __func__,
+            gvocab.tokens.size(), code_points.size(), gvocab.nodes.size());
+}
+
+// marks the tokens in the subtree of trie node `inode` that are accepted by at least one of the stacks, where `stacks`
+// are the grammar stacks after the code points on the path from the root to the node
+// the subtree of a child is skipped as soon as no stack accepts its code point
+static void whisper_grammar_trie_accept(
+        const std::vector<std::vector<whisper_grammar_element>>         & rules,
+        const whisper_grammar_vocab                                     & gvocab,
+        int32_t                                                           inode,
+        const std::vector<std::vector<const whisper_grammar_element *>> & stacks,
+        std::vector<uint64_t>                                           & allowed) {
+    const auto & node = gvocab.nodes[inode];
+
+    for (int32_t i = node.token_begin; i < node.token_end; ++i) {
+        const auto & tok = gvocab.tokens[i];
+
+        for (const auto & stack : stacks) {
+            // reached the end of the full code points of the token, accept it unless it ended in a partial sequence
+            // that cannot satisfy this position in the grammar
+            if (tok.partial_utf8.n_remain == 0 ||
+                (!stack.empty() && whisper_grammar_match_partial_char(stack.back(), tok.partial_utf8))) {
+                allowed[tok.id/64] |= 1ull << (tok.id%64);
+                break;
+            }
+        }
+    }
+
+    std::vector<std::vector<const whisper_grammar_element *>> next_stacks;
+
+    for (int32_t ic = node.child_begin; ic < node.child_end; ++ic) {
+        const uint32_t chr = gvocab.nodes[ic].chr;
+
+        next_stacks.clear();
+
+        for (const auto & stack : stacks) {
+            if (stack.empty()) {
+                continue;
+            }
+
+            const auto match = whisper_grammar_match_char(stack.back(), chr);
+            if (match.first) {
+                // update top of stack to next element, if any
+                std::vector<const whisper_grammar_element *> stack_after(stack.begin(), stack.end() - 1);
+                if (!whisper_grammar_is_end_of_sequence(match.second)) {
+                    stack_after.push_back(match.second);
+                }
+                whisper_grammar_advance_stack(rules, stack_after, next_stacks);
+            }
+        }
+
+        if (next_stacks.empty()) {
+            continue;
+        }
+
+        // different stacks often advance to the same one
+        std::sort(next_stacks.begin(), next_stacks.end());
+        next_stacks.erase(std::unique(next_stacks.begin(), next_stacks.end()), next_stacks.end());
+
+        whisper_grammar_trie_accept(rules, gvocab, ic, next_stacks, allowed);
+    }
+}
+
 static void whisper_suppress_invalid_grammar(
              whisper_context  & ctx,
+               whisper_state  & state,
     const whisper_full_params & params,
            std::vector<float> & logits,
     const     whisper_grammar & grammar) {
@@ -5850,21 +7358,73 @@ static void whisper_suppress_invalid_grammar(
 
     const whisper_token eot = whisper_token_eot(&ctx);
 
-    std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
-    std::vector<whisper_grammar_candidate>                              candidates_grammar;
+    const auto & gvocab = ctx.grammar_vocab;
+
+    // a pending sequence only changes how the tokens are decoded if it is incomplete
+    const bool has_partial = grammar.partial_utf8.n_remain > 0;
+
+    // the allowed tokens depend only on the stacks and on the pending sequence
+    std::string key;
+    {
+        const whisper_partial_utf8 partial_utf8 = has_partial ? grammar.partial_utf8 : whisper_partial_utf8{ 0, 0 };
+        key.append((const char *) &partial_utf8, sizeof(partial_utf8));
+
+        for (const auto & stack : grammar.stacks) {
+            const size_t n = stack.size();
+            key.append((const char *) &n, sizeof(n));
+            key.append((const char *) stack.data(), n*sizeof(stack[0]));
+        }
+    }
+
+    std::vector<uint64_t> allowed;
+    {
+        std::lock_guard<std::mutex> lock(state.grammar_cache.mutex);
 
-    for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
-            candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
+        const auto it = state.grammar_cache.entries.find(key);
+        if (it != state.grammar_cache.entries.end()) {
+            allowed = it->second;
         }
     }
 
-    const auto rejects = whisper_grammar_reject_candidates(grammar.rules, grammar.stacks, candidates_grammar);
+    if (allowed.empty()) {
+        allowed.assign((eot + 63)/64, 0);
+
+        if (!has_partial) {
+            whisper_grammar_trie_accept(grammar.rules, gvocab, 0, grammar.stacks, allowed);
+        } else {
+            // the tokens have to be decoded as a continuation of the pending sequence, so the trie does not apply
+            std::vector<std::pair<std::vector<uint32_t>, whisper_partial_utf8>> candidates_decoded;
+            std::vector<whisper_grammar_candidate>                              candidates_grammar;
+
+            candidates_decoded.reserve(gvocab.tokens.size());
+            candidates_grammar.reserve(gvocab.tokens.size());
+
+            for (const auto & tok : gvocab.tokens) {
+                candidates_decoded.push_back(decode_utf8(ctx.vocab.id_to_token.at(tok.id).c_str(), grammar.partial_utf8));
+                candidates_grammar.push_back({ tok.id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
+
+                allowed[tok.id/64] |= 1ull << (tok.id%64);
+            }
+
+            const auto rejects = whisper_grammar_reject_candidates(grammar.rules, grammar.stacks, candidates_grammar);
+
+            for (const auto & reject : rejects) {
+                allowed[reject.id/64] &= ~(1ull << (reject.id%64));
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(state.grammar_cache.mutex);
+
+        if (state.grammar_cache.entries.size() >= WHISPER_GRAMMAR_CACHE_MAX) {
+            state.grammar_cache.entries.clear();
+        }
+        state.grammar_cache.entries[key] = allowed;
+    }
 
-    for (const auto & reject : rejects) {
-        logits[reject.id] -= params.grammar_penalty;
+    for (const auto & tok : gvocab.tokens) {
+        if ((allowed[tok.id/64] & (1ull << (tok.id%64))) == 0) {
+            logits[tok.id] -= params.grammar_penalty;
+        }
     }
 
     // when the grammar allows a continuation, we penalize the end-of-text token
@@ -5952,6 +7512,9 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
 
         /* suppress_regex    =*/ nullptr,
 
+        /*.vocab_shortlist   =*/ nullptr,
+        /*.vocab_shortlist_n =*/ 0,
+
         /*.initial_prompt    =*/ nullptr,
         /*.prompt_tokens     =*/ nullptr,
         /*.prompt_n_tokens   =*/ 0,
@@ -6342,7 +7905,7 @@ static void whisper_process_logits(
                 }
             } else {
                 if (params.n_grammar_rules > 0) {
-                    whisper_suppress_invalid_grammar(ctx, params, logits, decoder.grammar);
+                    whisper_suppress_invalid_grammar(ctx, state, params, logits, decoder.grammar);
 
                     // populate the logprobs array (log_softmax)
                     {
@@ -6642,6 +8205,11 @@ static bool whisper_vad(
             WHISPER_LOG_ERROR("%s: failed to initialize VAD context\n", __func__);
             return false;
         }
+        // the VAD threads run with the CPU settings of the whisper context
+        vctx->params.cpu_mask   = ctx->params.cpu_mask;
+        vctx->params.cpu_strict = ctx->params.cpu_strict;
+        vctx->params.cpu_prio   = ctx->params.cpu_prio;
+        vctx->params.cpu_poll   = ctx->params.cpu_poll;
         state->vad_context = vctx;
     }
     auto vctx = state->vad_context;
@@ -6652,8 +8220,8 @@ static bool whisper_vad(
 
     if (vad_segments->data.size() > 0) {
         state->has_vad_segments = true;
-        ctx->state->vad_segments.clear();
-        ctx->state->vad_segments.reserve(vad_segments->data.size());
+        state->vad_segments.clear();
+        state->vad_segments.reserve(vad_segments->data.size());
 
         // Initialize the time mapping table
         state->vad_mapping_table.clear();
@@ -6749,7 +8317,7 @@ static bool whisper_vad(
 
                 WHISPER_LOG_INFO("%s: vad_segment_info: orig_start: %.2f, orig_end: %.2f, vad_start: %.2f, vad_end: %.2f\n",
                     __func__, segment.orig_start/100.0, segment.orig_end/100.0, segment.vad_start/100.0, segment.vad_end/100.0);
-                ctx->state->vad_segments.push_back(segment);
+                state->vad_segments.push_back(segment);
 
                 // Copy this speech segment
                 memcpy(filtered_samples.data() + offset, samples + segment_start_samples, segment_length * sizeof(float));
@@ -6812,20 +8380,37 @@ int whisper_full_with_state(
 
     result_all.clear();
 
-    if (n_samples > 0) {
-        // compute log mel spectrogram
-        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
-            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
-            return -2;
-        }
-    }
-
-    // auto-detect language if not specified
-    if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
-        std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
+    // the threadpool waits for the caller between whisper_full() calls, this is not counted as idle time
+    state->trace.t_graph_end_us = 0;
 
-        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
-        if (lang_id < 0) {
+    std::vector<float> vad_samples;
+    if (params.vad) {
+        WHISPER_LOG_INFO("%s: VAD is enabled, processing speech segments only\n", __func__);
+        if (!whisper_vad(ctx, state, params, samples, n_samples, vad_samples)) {
+            WHISPER_LOG_ERROR("%s: failed to compute VAD\n", __func__);
+            return -1;
+        }
+        if (vad_samples.empty()) {
+            return 0;
+        }
+        samples = vad_samples.data();
+        n_samples = vad_samples.size();
+    }
+
+    if (n_samples > 0) {
+        // compute log mel spectrogram
+        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
+            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+            return -2;
+        }
+    }
+
+    // auto-detect language if not specified
+    if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
+        std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
+
+        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
+        if (lang_id < 0) {
             WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
             return -3;
         }
@@ -6892,6 +8477,9 @@ int whisper_full_with_state(
         return -4;
     }
 
+    // reseed the first decoder as well, so that the result does not depend on the previous calls on this state
+    state->decoders[0].rng = std::mt19937(0);
+
     // TAGS: WHISPER_DECODER_INIT
     for (int j = 1; j < n_decoders; j++) {
         auto & decoder = state->decoders[j];
@@ -6946,6 +8534,29 @@ int whisper_full_with_state(
     }
     state->exp_n_audio_ctx = params.audio_ctx;
 
+    // output layer shortlist - the special tokens are always needed by the decoding logic
+    state->vocab_shortlist.clear();
+    if (params.vocab_shortlist && params.vocab_shortlist_n > 0) {
+        const int n_vocab  = whisper_n_vocab(ctx);
+        const int id_first = whisper_token_eot(ctx);
+        const int id_last  = params.no_timestamps ? whisper_token_beg(ctx) : n_vocab;
+
+        auto & shortlist = state->vocab_shortlist;
+
+        for (int i = 0; i < params.vocab_shortlist_n; ++i) {
+            const whisper_token id = params.vocab_shortlist[i];
+            if (id >= 0 && id < id_first) {
+                shortlist.push_back(id);
+            }
+        }
+        for (int id = id_first; id < id_last; ++id) {
+            shortlist.push_back(id);
+        }
+
+        std::sort(shortlist.begin(), shortlist.end());
+        shortlist.erase(std::unique(shortlist.begin(), shortlist.end()), shortlist.end());
+    }
+
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
 
@@ -6978,6 +8589,12 @@ int whisper_full_with_state(
     std::vector<whisper_token> prompt;
     prompt.reserve(whisper_n_text_ctx(ctx));
 
+    // the prompt decoded for the current window, its KV cells are kept in the WHISPER_SEQ_ID_PROMPT sequence
+    // the temperature fallbacks of a window mostly decode the same prompt again, so it is restored instead
+    std::vector<whisper_token> prompt_kv;
+    std::vector<float>         prompt_logits;
+    float                      prompt_no_speech_prob = 0.0f;
+
     struct beam_candidate {
         int decoder_idx;
         int seek_delta;
@@ -7018,6 +8635,9 @@ int whisper_full_with_state(
             return -6;
         }
 
+        // the self-attention KV of the prompt depends on the encoder output
+        prompt_kv.clear();
+
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
         // to confuse the decoder and often make it repeat or hallucinate stuff
         if (seek > seek_start && seek + 500 >= seek_end) {
@@ -7077,8 +8697,10 @@ int whisper_full_with_state(
                 }
             }
 
+            // the cached grammar states point into the rules of the previous decoder grammars
+            state->grammar_cache.entries.clear();
+
             // init prompt and kv cache for the current iteration
-            // TODO: do not recompute the prompt if it is the same as previous time
             {
                 prompt.clear();
 
@@ -7109,7 +8731,7 @@ int whisper_full_with_state(
                     // overallocate to workaround KV cache fragmentation issues
                     const int factor = n_decoders_cur > 1 ? n_decoders_cur + 2 : 1;
 
-                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->params.type_k, ctx->params.type_v,
                                 ctx->model.hparams.n_text_state,
                                 ctx->model.hparams.n_text_layer,
                                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256)*factor)) {
@@ -7119,27 +8741,47 @@ int whisper_full_with_state(
                     }
 
                     state->kv_self_n_dec = n_decoders_cur;
+
+                    prompt_kv.clear();
                 }
 
-                whisper_kv_cache_clear(state->kv_self);
+                const int n_logits = ctx->vocab.id_to_token.size();
 
-                whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+                if (prompt_kv == prompt) {
+                    // same window and prompt as the previous temperature - drop the sampled tokens and restore the prompt
+                    whisper_kv_cache_seq_keep(state->kv_self, WHISPER_SEQ_ID_PROMPT);
+                    whisper_kv_cache_seq_cp  (state->kv_self, WHISPER_SEQ_ID_PROMPT, 0, -1, -1);
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
-                    WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
-                    return -8;
-                }
+                    state->logits.resize(prompt.size()*n_logits);
+                    std::copy(prompt_logits.begin(), prompt_logits.end(), state->logits.end() - n_logits);
 
-                // Calculate no_speech probability after first decode.
-                // This has to be done before any logit filtering. Hence we cannot use the probs from the whisper_process_logits.
-                {
-                    const int n_logits = ctx->vocab.id_to_token.size();
-                    std::vector<float> logprobs(n_logits);
-                    std::vector<float> probs(n_logits);
+                    state->no_speech_prob = prompt_no_speech_prob;
+                } else {
+                    whisper_kv_cache_clear(state->kv_self);
+
+                    whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
+
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                        return -8;
+                    }
+
+                    // Calculate no_speech probability after first decode.
+                    // This has to be done before any logit filtering. Hence we cannot use the probs from the whisper_process_logits.
+                    {
+                        std::vector<float> logprobs(n_logits);
+                        std::vector<float> probs(n_logits);
+
+                        whisper_compute_logprobs(state->logits, n_logits, logprobs);
+                        whisper_compute_probs(state->logits, n_logits, logprobs, probs);
+                        state->no_speech_prob = probs[whisper_token_nosp(ctx)];
+                    }
+
+                    whisper_kv_cache_seq_cp(state->kv_self, 0, WHISPER_SEQ_ID_PROMPT, -1, -1);
 
-                    whisper_compute_logprobs(state->logits, n_logits, logprobs);
-                    whisper_compute_probs(state->logits, n_logits, logprobs, probs);
-                    state->no_speech_prob = probs[whisper_token_nosp(ctx)];
+                    prompt_kv = prompt;
+                    prompt_logits.assign(state->logits.end() - n_logits, state->logits.end());
+                    prompt_no_speech_prob = state->no_speech_prob;
                 }
 
                 {
@@ -7160,6 +8802,8 @@ int whisper_full_with_state(
                     }
 
                     state->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                    whisper_trace_host(state->trace, "sample", t_start_sample_us);
                 }
             }
 
@@ -7408,6 +9052,8 @@ int whisper_full_with_state(
 
                 state->t_sample_us += ggml_time_us() - t_start_sample_us;
 
+                whisper_trace_host(state->trace, "sample", t_start_sample_us);
+
                 // obtain logits for the next token
                 {
                     auto & batch = state->batch;
@@ -7437,11 +9083,17 @@ int whisper_full_with_state(
 
                     assert(batch.n_tokens > 0);
 
+                    const int64_t t_start_decode_us = ggml_time_us();
+
                     if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
                         WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                         return -9;
                     }
 
+                    // the batch holds the next token of every active decoder (beam search, best_of), so the
+                    // latency is recorded per step rather than per decode call with a single token
+                    whisper_trace_token(state->trace, ggml_time_us() - t_start_decode_us);
+
                     const int64_t t_start_sample_us = ggml_time_us();
 
                     // TODO: avoid memory allocations, optimize, avoid threads?
@@ -7486,6 +9138,8 @@ int whisper_full_with_state(
                     }
 
                     state->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                    whisper_trace_host(state->trace, "sample", t_start_sample_us);
                 }
             }
 
@@ -7724,22 +9378,92 @@ int whisper_full(
     struct whisper_full_params   params,
                    const float * samples,
                            int   n_samples) {
+    return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
+}
 
-    std::vector<float> vad_samples;
-    if (params.vad) {
-        WHISPER_LOG_INFO("%s: VAD is enabled, processing speech segments only\n", __func__);
-        if (!whisper_vad(ctx, ctx->state, params, samples, n_samples, vad_samples)) {
-            WHISPER_LOG_ERROR("%s: failed to compute VAD\n", __func__);
-            return -1;
+// find the sample positions at which whisper_full_parallel() splits the audio into n_chunks chunks
+// each nominal (equidistant) boundary is moved to the nearest silence gap between the VAD speech segments,
+// or, when VAD is not used, to the quietest 100 ms of audio within a search window around it
+// the returned vector has n_chunks + 1 elements: [i_beg, split_1, ..., split_{n_chunks - 1}, i_end]
+static std::vector<int> whisper_parallel_split_points(
+        const whisper_state & state,
+                const float * samples,
+                          int i_beg,
+                          int i_end,
+                          int n_chunks,
+            std::vector<bool> & aligned) {
+    std::vector<int> result(n_chunks + 1);
+    aligned.assign(n_chunks + 1, true);
+
+    result[0]        = i_beg;
+    result[n_chunks] = i_end;
+
+    const int n_samples_chunk = (i_end - i_beg)/n_chunks;
+
+    // look for a split point at most 5 s (or a quarter of a chunk) away from the nominal boundary
+    const int n_samples_search = std::min(5*WHISPER_SAMPLE_RATE, n_samples_chunk/4);
+
+    // silence gaps inserted by whisper_vad() between consecutive speech segments
+    std::vector<int> gaps;
+    if (state.has_vad_segments) {
+        for (size_t i = 0; i + 1 < state.vad_segments.size(); ++i) {
+            gaps.push_back((cs_to_samples(state.vad_segments[i].vad_end) + cs_to_samples(state.vad_segments[i + 1].vad_start))/2);
         }
-        if (vad_samples.empty()) {
-            ctx->state->result_all.clear();
-            return 0;
+    }
+
+    // prefix sums of the per-frame signal energy (10 ms frames)
+    const int n_frame    = WHISPER_HOP_LENGTH;
+    const int n_frames   = (i_end - i_beg)/n_frame;
+    const int n_smooth   = 10;
+
+    std::vector<double> energy_sum(n_frames + 1, 0.0);
+    for (int f = 0; f < n_frames; ++f) {
+        const float * frame = samples + i_beg + f*n_frame;
+
+        double sum = 0.0;
+        for (int j = 0; j < n_frame; ++j) {
+            sum += fabsf(frame[j]);
         }
-        samples = vad_samples.data();
-        n_samples = vad_samples.size();
+        energy_sum[f + 1] = energy_sum[f] + sum;
     }
-    return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
+
+    for (int i = 1; i < n_chunks; ++i) {
+        const int nominal = i_beg + i*n_samples_chunk;
+
+        int best = -1;
+
+        // 1. nearest VAD silence gap
+        for (int gap : gaps) {
+            if (std::abs(gap - nominal) <= n_samples_search && (best < 0 || std::abs(gap - nominal) < std::abs(best - nominal))) {
+                best = gap;
+            }
+        }
+
+        // 2. energy minimum
+        if (best < 0 && n_frames > n_smooth) {
+            const int f0 = std::max(0,                   (nominal - n_samples_search - i_beg)/n_frame);
+            const int f1 = std::min(n_frames - n_smooth, (nominal + n_samples_search - i_beg)/n_frame);
+
+            double e_min = DBL_MAX;
+            for (int f = f0; f <= f1; ++f) {
+                const double e = energy_sum[f + n_smooth] - energy_sum[f];
+                if (e < e_min) {
+                    e_min = e;
+                    best  = i_beg + (f + n_smooth/2)*n_frame;
+                }
+            }
+        }
+
+        // keep the chunks ordered and at least 1 s long
+        if (best <= result[i - 1] + WHISPER_SAMPLE_RATE || best >= i_end - WHISPER_SAMPLE_RATE) {
+            best       = nominal;
+            aligned[i] = false;
+        }
+
+        result[i] = best;
+    }
+
+    return result;
 }
 
 int whisper_full_parallel(
@@ -7766,64 +9490,151 @@ int whisper_full_parallel(
         samples = vad_samples.data();
         n_samples = vad_samples.size();
     }
-    int ret = 0;
 
-    // prepare separate states for each thread
-    std::vector<whisper_state*> states;
+    const int offset_samples = std::min(n_samples, (WHISPER_SAMPLE_RATE*params.offset_ms)/1000);
+    const int end_samples    = params.duration_ms == 0 ? n_samples : std::min(n_samples, offset_samples + (WHISPER_SAMPLE_RATE*params.duration_ms)/1000);
 
-    const int offset_samples = (WHISPER_SAMPLE_RATE*params.offset_ms)/1000;
-    const int n_samples_per_processor = (n_samples - offset_samples)/n_processors;
+    // split the audio into more chunks than processors, so that the workers that finish early can pick up
+    // the remaining work instead of waiting for the slowest one
+    // chunks shorter than one encoder window are not worth it, since the encoder always processes 30 s of audio
+    const int n_chunks_per_processor = 4;
+    const int n_samples_chunk_min    = WHISPER_CHUNK_SIZE*WHISPER_SAMPLE_RATE;
 
-    // the calling thread will process the first chunk
-    // while the other threads will process the remaining chunks
+    const int n_chunks = std::max(n_processors, std::min(n_processors*n_chunks_per_processor, (end_samples - offset_samples)/n_samples_chunk_min));
 
-    std::vector<std::thread> workers(n_processors - 1);
-    for (int i = 0; i < n_processors - 1; ++i) {
-        // create a new state for each thread
-        states.push_back(whisper_init_state(ctx));
+    std::vector<bool> aligned;
+    const std::vector<int> splits = whisper_parallel_split_points(*ctx->state, samples, offset_samples, end_samples, n_chunks, aligned);
 
-        const int start_samples = offset_samples + (i + 1)*n_samples_per_processor;
-        const int n_samples_cur = (i == n_processors - 2) ? n_samples - start_samples : n_samples_per_processor;
+    // the worker states are kept in the context and reused by subsequent calls
+    while ((int) ctx->states_parallel.size() < n_processors) {
+        whisper_state * state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to initialize worker state\n", __func__);
+            return -1;
+        }
+        ctx->states_parallel.push_back(state);
+    }
 
-        auto params_cur = params;
+    // process the longest chunks first
+    std::vector<int> order(n_chunks);
+    for (int i = 0; i < n_chunks; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return splits[a + 1] - splits[a] > splits[b + 1] - splits[b];
+    });
 
-        params_cur.offset_ms = 0;
-        params_cur.print_progress = false;
-        params_cur.print_realtime = false;
+    std::vector<std::vector<whisper_segment>> results(n_chunks);
+    std::vector<whisper_token> prompt_past_last;
 
-        params_cur.new_segment_callback = nullptr;
-        params_cur.new_segment_callback_user_data = nullptr;
+    std::atomic<int> i_next { 0 };
+    std::atomic<int> n_done { 0 };
+    std::atomic<int> ret    { 0 };
 
-        params_cur.progress_callback = nullptr;
-        params_cur.progress_callback_user_data = nullptr;
+    auto params_cur = params;
 
-        workers[i] = std::thread(whisper_full_with_state, ctx, states[i], std::move(params_cur), samples + start_samples, n_samples_cur);
-    }
+    params_cur.offset_ms   = 0;
+    params_cur.duration_ms = 0;
+    params_cur.vad         = false;
 
-    {
-        auto params_cur = params;
+    params_cur.print_progress = false;
+    params_cur.print_realtime = false;
+
+    params_cur.new_segment_callback = nullptr;
+    params_cur.new_segment_callback_user_data = nullptr;
+
+    params_cur.progress_callback = nullptr;
+    params_cur.progress_callback_user_data = nullptr;
+
+    // each worker pulls the next chunk from the shared queue until it is empty
+    // the calling thread acts as worker 0 and is the only one that reports progress
+    auto worker = [&](int i_worker) {
+        whisper_state * state = ctx->states_parallel[i_worker];
+
+        while (ret == 0) {
+            const int i = i_next++;
+            if (i >= n_chunks) {
+                break;
+            }
+
+            const int i_chunk = order[i];
+
+            // the first chunk continues the text context of the default state, the others start from scratch
+            state->prompt_past.clear();
+            if (i_chunk == 0 && !params.no_context) {
+                state->prompt_past = ctx->state->prompt_past;
+            }
+
+            const int res = whisper_full_with_state(ctx, state, params_cur, samples + splits[i_chunk], splits[i_chunk + 1] - splits[i_chunk]);
+            if (res != 0) {
+                ret = res;
+                break;
+            }
 
-        // We need to disable the print real-time for this one as well, otherwise it will show only for the first chunk.
-        params_cur.print_realtime = false;
+            results[i_chunk] = std::move(state->result_all);
+            state->result_all.clear();
 
-        // Run the first transformation using default state but only for the first chunk.
-        ret = whisper_full_with_state(ctx, ctx->state, std::move(params_cur), samples, offset_samples + n_samples_per_processor);
+            if (i_chunk == n_chunks - 1) {
+                prompt_past_last = state->prompt_past;
+            }
+
+            const int progress = (100*++n_done)/n_chunks;
+            if (i_worker == 0 && params.progress_callback) {
+                params.progress_callback(ctx, ctx->state, progress, params.progress_callback_user_data);
+            }
+        }
+    };
+
+    for (int i = 0; i < n_processors; ++i) {
+        whisper_state * state = ctx->states_parallel[i];
+
+        state->t_mel_us    = 0;
+        state->t_sample_us = 0;
+        state->t_encode_us = 0;
+        state->t_decode_us = 0;
+        state->t_batchd_us = 0;
+        state->t_prompt_us = 0;
+
+        state->n_sample = 0;
+        state->n_encode = 0;
+        state->n_decode = 0;
+        state->n_batchd = 0;
+        state->n_prompt = 0;
+
+        whisper_trace_reset(state->trace);
     }
 
+    std::vector<std::thread> workers(n_processors - 1);
+    for (int i = 0; i < n_processors - 1; ++i) {
+        workers[i] = std::thread(worker, i + 1);
+    }
+
+    worker(0);
+
     for (int i = 0; i < n_processors - 1; ++i) {
         workers[i].join();
     }
 
+    if (ret != 0) {
+        return ret;
+    }
+
+    ctx->state->result_all.clear();
+    ctx->state->lang_id = ctx->states_parallel[0]->lang_id;
+    if (!params.no_context) {
+        ctx->state->prompt_past = std::move(prompt_past_last);
+    }
+
     const int64_t offset_t = (int64_t) params.offset_ms/10.0;
 
-    // combine results into result_state->result_all from all other states
-    for (int i = 0; i < n_processors - 1; ++i) {
-        auto& results_i = states[i]->result_all;
+    // combine results into result_state->result_all from all chunks
+    for (int i = 0; i < n_chunks; ++i) {
+        const int64_t t_chunk = 100ll*(splits[i] - offset_samples)/WHISPER_SAMPLE_RATE + offset_t;
 
-        for (auto& result : results_i) {
+        for (auto & result : results[i]) {
             // correct the segment timestamp taking into account the offset
-            result.t0 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
-            result.t1 += 100 * ((i + 1) * n_samples_per_processor) / WHISPER_SAMPLE_RATE + offset_t;
+            result.t0 += t_chunk;
+            result.t1 += t_chunk;
 
             // make sure that segments are not overlapping
             if (!ctx->state->result_all.empty()) {
@@ -7837,22 +9648,26 @@ int whisper_full_parallel(
                 params.new_segment_callback(ctx, ctx->state, 1, params.new_segment_callback_user_data);
             }
         }
+    }
+
+    for (int i = 0; i < n_processors; ++i) {
+        const whisper_state * state = ctx->states_parallel[i];
 
-        ctx->state->t_mel_us += states[i]->t_mel_us;
+        ctx->state->t_mel_us += state->t_mel_us;
 
-        ctx->state->t_sample_us += states[i]->t_sample_us;
-        ctx->state->t_encode_us += states[i]->t_encode_us;
-        ctx->state->t_decode_us += states[i]->t_decode_us;
-        ctx->state->t_batchd_us += states[i]->t_batchd_us;
-        ctx->state->t_prompt_us += states[i]->t_prompt_us;
+        ctx->state->t_sample_us += state->t_sample_us;
+        ctx->state->t_encode_us += state->t_encode_us;
+        ctx->state->t_decode_us += state->t_decode_us;
+        ctx->state->t_batchd_us += state->t_batchd_us;
+        ctx->state->t_prompt_us += state->t_prompt_us;
 
-        ctx->state->n_sample += states[i]->n_sample;
-        ctx->state->n_encode += states[i]->n_encode;
-        ctx->state->n_decode += states[i]->n_decode;
-        ctx->state->n_batchd += states[i]->n_batchd;
-        ctx->state->n_prompt += states[i]->n_prompt;
+        ctx->state->n_sample += state->n_sample;
+        ctx->state->n_encode += state->n_encode;
+        ctx->state->n_decode += state->n_decode;
+        ctx->state->n_batchd += state->n_batchd;
+        ctx->state->n_prompt += state->n_prompt;
 
-        whisper_free_state(states[i]);
+        whisper_trace_merge(ctx->state->trace, state->trace, i + 1);
     }
 
     // average the timings
@@ -7862,16 +9677,748 @@ int whisper_full_parallel(
     ctx->state->t_decode_us /= n_processors;
 
     // print information about the audio boundaries
-    WHISPER_LOG_WARN("\n");
-    WHISPER_LOG_WARN("%s: the audio has been split into %d chunks at the following times:\n", __func__, n_processors);
-    for (int i = 0; i < n_processors - 1; ++i) {
-        WHISPER_LOG_WARN("%s: split %d - %s\n", __func__, (i + 1), to_timestamp(100*((i + 1)*n_samples_per_processor)/WHISPER_SAMPLE_RATE + offset_t).c_str());
+    WHISPER_LOG_INFO("%s: the audio has been split into %d chunks at the following times:\n", __func__, n_chunks);
+    bool any_unaligned = false;
+    for (int i = 1; i < n_chunks; ++i) {
+        WHISPER_LOG_INFO("%s: split %d - %s%s\n", __func__, i, to_timestamp(100ll*(splits[i] - offset_samples)/WHISPER_SAMPLE_RATE + offset_t).c_str(), aligned[i] ? "" : " (no silence found)");
+        any_unaligned = any_unaligned || !aligned[i];
+    }
+    if (any_unaligned) {
+        WHISPER_LOG_WARN("%s: some of the splits are not aligned to silence - the transcription quality may be degraded near these boundaries\n", __func__);
+    }
+
+    return 0;
+}
+
+struct whisper_cascade_params whisper_cascade_default_params(void) {
+    whisper_cascade_params result = {
+        /* logprob_thold   = */ -0.6f,
+        /* entropy_thold   = */  2.4f,
+        /* no_speech_thold = */  0.3f,
+        /* pad_ms          = */  200,
+    };
+    return result;
+}
+
+// check if a segment of the first pass of whisper_full_cascade() should be re-decoded
+// the text tokens of the segment are scored with the same criteria as the temperature fallback of whisper_full()
+static bool whisper_cascade_is_uncertain(
+        const whisper_context & ctx,
+        const whisper_segment & segment,
+        const whisper_cascade_params & cparams) {
+    if (segment.no_speech_prob > cparams.no_speech_thold) {
+        return true;
+    }
+
+    std::vector<whisper_token> tokens;
+    double sum_logprobs = 0.0;
+
+    for (const auto & token : segment.tokens) {
+        if (token.id < ctx.vocab.token_eot) {
+            tokens.push_back(token.id);
+            sum_logprobs += token.plog;
+        }
+    }
+
+    if (tokens.empty()) {
+        return false;
+    }
+
+    if (sum_logprobs/tokens.size() < cparams.logprob_thold) {
+        return true;
+    }
+
+    // entropy of the last 32 tokens, only meaningful for long segments
+    const int n = 32;
+
+    if ((int) tokens.size() > n) {
+        std::map<whisper_token, int> token_counts;
+        for (int i = (int) tokens.size() - n; i < (int) tokens.size(); ++i) {
+            token_counts[tokens[i]]++;
+        }
+
+        double entropy = 0.0;
+        for (const auto & kv : token_counts) {
+            const auto p = kv.second/(double) n;
+            entropy -= p*log(p);
+        }
+
+        if (entropy < cparams.entropy_thold) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int whisper_full_cascade(
+        struct whisper_context * ctx,
+        struct whisper_context * ctx_large,
+    struct whisper_full_params   params,
+ struct whisper_cascade_params   cparams,
+                   const float * samples,
+                           int   n_samples) {
+    if (ctx->model.hparams.n_mels != ctx_large->model.hparams.n_mels || ctx->vocab.n_vocab != ctx_large->vocab.n_vocab) {
+        WHISPER_LOG_ERROR("%s: the models must have the same number of mel bands and the same vocabulary\n", __func__);
+        return -1;
+    }
+
+    auto params_cur = params;
+
+    params_cur.print_realtime = false;
+
+    params_cur.new_segment_callback = nullptr;
+    params_cur.new_segment_callback_user_data = nullptr;
+
+    {
+        const int ret = whisper_full_with_state(ctx, ctx->state, params_cur, samples, n_samples);
+        if (ret != 0 || params.detect_language) {
+            return ret;
+        }
+    }
+
+    whisper_state * state       = ctx->state;
+    whisper_state * state_large = ctx_large->state;
+
+    auto & result_all = state->result_all;
+
+    // the second pass continues in the processed time of the first one (i.e. after VAD) and in its language
+    if (params_cur.language == nullptr || strlen(params_cur.language) == 0 || strcmp(params_cur.language, "auto") == 0) {
+        params_cur.language = whisper_lang_str(state->lang_id);
+    }
+
+    params_cur.offset_ms   = 0;
+    params_cur.duration_ms = 0;
+    params_cur.vad         = false;
+    params_cur.no_context  = true;
+
+    params_cur.progress_callback = nullptr;
+    params_cur.progress_callback_user_data = nullptr;
+
+    // group consecutive uncertain segments, so that each group fits in one encoder window
+    const int n_pad        = std::max(0, cparams.pad_ms/10);
+    const int n_frames_win = WHISPER_CHUNK_SIZE*100;
+
+    std::vector<std::pair<int, int>> groups;
+
+    for (int i = 0; i < (int) result_all.size(); ++i) {
+        if (!whisper_cascade_is_uncertain(*ctx, result_all[i], cparams)) {
+            continue;
+        }
+
+        if (!groups.empty() && groups.back().second == i &&
+            result_all[i].t1 - result_all[groups.back().first].t0 + 2*n_pad <= n_frames_win) {
+            groups.back().second = i + 1;
+        } else {
+            groups.push_back({ i, i + 1 });
+        }
+    }
+
+    const whisper_mel & mel = state->mel;
+
+    std::vector<whisper_segment> result_new;
+
+    int     n_redecoded = 0;
+    int64_t t_redecoded = 0;
+
+    int i_next = 0;
+
+    for (const auto & group : groups) {
+        for (; i_next < group.first; ++i_next) {
+            result_new.push_back(std::move(result_all[i_next]));
+        }
+        i_next = group.second;
+
+        const int64_t t0 = result_all[group.first].t0;
+        const int64_t t1 = result_all[group.second - 1].t1;
+
+        const int f0 = std::max<int64_t>(0,             t0 - n_pad);
+        const int f1 = std::min<int64_t>(mel.n_len_org, t1 + n_pad);
+
+        // too short for whisper_full_with_state() - keep the original segments
+        if (f1 - f0 < 10) {
+            for (int i = group.first; i < group.second; ++i) {
+                result_new.push_back(std::move(result_all[i]));
+            }
+            continue;
+        }
+
+        // the slice of the spectrogram is followed by the same padding as the whole input
+        {
+            whisper_mel & mel_large = state_large->mel;
+
+            mel_large.n_mel     = mel.n_mel;
+            mel_large.n_len_org = f1 - f0;
+            mel_large.n_len     = f1 - f0 + n_frames_win;
+            mel_large.data.resize(mel_large.n_mel*mel_large.n_len);
+
+            for (int j = 0; j < mel.n_mel; ++j) {
+                const float * src = mel.data.data() + j*mel.n_len;
+                float       * dst = mel_large.data.data() + j*mel_large.n_len;
+
+                std::copy(src + f0, src + f1, dst);
+                std::fill(dst + (f1 - f0), dst + mel_large.n_len, src[mel.n_len - 1]);
+            }
+        }
+
+        if (params_cur.token_timestamps) {
+            const size_t s0 = std::min(state->energy.size(), (size_t) f0*WHISPER_HOP_LENGTH);
+            const size_t s1 = std::min(state->energy.size(), (size_t) f1*WHISPER_HOP_LENGTH);
+
+            state_large->energy.assign(state->energy.begin() + s0, state->energy.begin() + s1);
+        }
+
+        // prompt with the text of the previous segment - the vocabularies are the same
+        std::vector<whisper_token> prompt;
+        if (!result_new.empty()) {
+            for (const auto & token : result_new.back().tokens) {
+                if (token.id < whisper_token_eot(ctx)) {
+                    prompt.push_back(token.id);
+                }
+            }
+        }
+
+        params_cur.prompt_tokens   = prompt.empty() ? params.prompt_tokens   : prompt.data();
+        params_cur.prompt_n_tokens = prompt.empty() ? params.prompt_n_tokens : (int) prompt.size();
+
+        const int ret = whisper_full_with_state(ctx_large, state_large, params_cur, nullptr, 0);
+        if (ret != 0) {
+            return ret;
+        }
+
+        for (auto & segment : state_large->result_all) {
+            segment.t0 += f0;
+            segment.t1 += f0;
+
+            for (auto & token : segment.tokens) {
+                token.t0    = token.t0    < 0 ? token.t0    : token.t0    + f0;
+                token.t1    = token.t1    < 0 ? token.t1    : token.t1    + f0;
+                token.t_dtw = token.t_dtw < 0 ? token.t_dtw : token.t_dtw + f0;
+            }
+
+            // drop the text that was transcribed from the padding around the group
+            const int64_t t_mid = (segment.t0 + segment.t1)/2;
+            if (t_mid < t0 || t_mid > t1) {
+                continue;
+            }
+
+            if (!result_new.empty()) {
+                segment.t0 = std::max(segment.t0, result_new.back().t1);
+            }
+
+            result_new.push_back(std::move(segment));
+        }
+
+        state_large->result_all.clear();
+
+        n_redecoded += group.second - group.first;
+        t_redecoded += f1 - f0;
+    }
+
+    const int n_segments = result_all.size();
+
+    for (; i_next < n_segments; ++i_next) {
+        result_new.push_back(std::move(result_all[i_next]));
+    }
+
+    WHISPER_LOG_INFO("%s: re-decoded %d / %d segments (%.1f%% of the audio) with the larger model\n", __func__,
+            n_redecoded, n_segments, 100.0*t_redecoded/std::max(1, mel.n_len_org));
+
+    result_all.clear();
+
+    for (auto & segment : result_new) {
+        result_all.push_back(std::move(segment));
+
+        if (params.new_segment_callback) {
+            params.new_segment_callback(ctx, state, 1, params.new_segment_callback_user_data);
+        }
+    }
+
+    return 0;
+}
+
+static int64_t map_processed_to_original_time(int64_t processed_time, const std::vector<vad_time_mapping> & mapping_table);
+
+int whisper_full_from_reader_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_full_params   params,
+    whisper_audio_read_callback  read_callback,
+                          void * read_callback_user_data,
+                           int   n_window_ms) {
+    // a window shorter than two encoder chunks would mostly consist of its re-transcribed tail
+    const size_t n_window = (size_t) std::max(n_window_ms, 2*WHISPER_CHUNK_SIZE*1000)/1000*WHISPER_SAMPLE_RATE;
+
+    std::vector<float> window; // the audio that is being transcribed
+    std::vector<float> ahead;  // the audio that has been decoded ahead of the window
+
+    window.reserve(n_window);
+    ahead.reserve(n_window);
+
+    bool eof      = false;
+    int  ret_read = 0;
+
+    int64_t n_skip = (int64_t) params.offset_ms*WHISPER_SAMPLE_RATE/1000;
+    int64_t n_left = params.duration_ms == 0 ? INT64_MAX : (int64_t) params.duration_ms*WHISPER_SAMPLE_RATE/1000;
+
+    // append up to n_want samples to dst, skipping the first offset_ms of the stream
+    auto read = [&](std::vector<float> & dst, size_t n_want) {
+        std::vector<float> buf(std::min<size_t>(n_want, 64*1024));
+        while (!eof && n_want > 0) {
+            const int n_max = (int) std::min<int64_t>(n_skip > 0 ? n_skip : std::min<int64_t>(n_want, n_left), buf.size());
+            if (n_max == 0) {
+                eof = true;
+                break;
+            }
+
+            const int n = read_callback(buf.data(), n_max, read_callback_user_data);
+            if (n <= 0) {
+                ret_read = n;
+                eof = true;
+                break;
+            }
+
+            if (n_skip > 0) {
+                n_skip -= n;
+                continue;
+            }
+
+            dst.insert(dst.end(), buf.begin(), buf.begin() + n);
+            n_want -= n;
+            n_left -= n;
+        }
+    };
+
+    auto params_cur = params;
+
+    params_cur.offset_ms   = 0;
+    params_cur.duration_ms = 0;
+    params_cur.vad         = false;
+
+    params_cur.print_progress = false;
+    params_cur.print_realtime = false;
+
+    params_cur.new_segment_callback = nullptr;
+    params_cur.new_segment_callback_user_data = nullptr;
+
+    params_cur.progress_callback = nullptr;
+    params_cur.progress_callback_user_data = nullptr;
+
+    std::vector<whisper_segment> result_all;
+
+    int64_t i_window = 0; // position of the window in the stream, in samples
+    int ret = 0;
+
+    read(ahead, n_window);
+
+    while (true) {
+        // top up the window with the audio decoded ahead
+        const size_t n_take = std::min(ahead.size(), n_window - window.size());
+        window.insert(window.end(), ahead.begin(), ahead.begin() + n_take);
+        ahead.erase(ahead.begin(), ahead.begin() + n_take);
+
+        if (window.empty()) {
+            break;
+        }
+
+        // decode the next window while this one is transcribed
+        std::thread reader;
+        if (!eof) {
+            reader = std::thread(read, std::ref(ahead), n_window - ahead.size());
+        }
+
+        std::vector<float> vad_samples;
+        const float * samples   = window.data();
+        int           n_samples = window.size();
+
+        state->has_vad_segments = false;
+        if (params.vad) {
+            if (!whisper_vad(ctx, state, params, samples, n_samples, vad_samples)) {
+                WHISPER_LOG_ERROR("%s: failed to compute VAD\n", __func__);
+                ret = -1;
+            }
+            samples   = vad_samples.data();
+            n_samples = vad_samples.size();
+        }
+
+        state->result_all.clear();
+        if (ret == 0 && n_samples > 0) {
+            ret = whisper_full_with_state(ctx, state, params_cur, samples, n_samples);
+        }
+
+        if (reader.joinable()) {
+            reader.join();
+        }
+
+        if (ret != 0 || ret_read < 0) {
+            break;
+        }
+
+        if (params.detect_language) {
+            result_all.clear();
+            break;
+        }
+
+        // detect the language once, on the first window
+        if (params_cur.language == nullptr || strlen(params_cur.language) == 0 || strcmp(params_cur.language, "auto") == 0) {
+            params_cur.language = whisper_lang_str(state->lang_id);
+        }
+
+        std::vector<whisper_segment> segments = std::move(state->result_all);
+        state->result_all.clear();
+
+        // the VAD mapping is only valid for this window, so bake it into the timestamps
+        if (state->has_vad_segments && !state->vad_mapping_table.empty()) {
+            for (auto & segment : segments) {
+                segment.t0 = map_processed_to_original_time(segment.t0, state->vad_mapping_table);
+                segment.t1 = std::max(segment.t0 + 1, map_processed_to_original_time(segment.t1, state->vad_mapping_table));
+                for (auto & token : segment.tokens) {
+                    if (token.t0 >= 0) {
+                        token.t0 = map_processed_to_original_time(token.t0, state->vad_mapping_table);
+                        token.t1 = map_processed_to_original_time(token.t1, state->vad_mapping_table);
+                    }
+                }
+            }
+        }
+        state->has_vad_segments = false;
+
+        const bool is_last = eof && ahead.empty();
+
+        // the last segment may be cut by the end of the window, so it is dropped and its audio is
+        // transcribed again at the start of the next window
+        size_t n_final    = segments.size();
+        size_t n_consumed = window.size();
+        if (!is_last && segments.size() > 1) {
+            const int64_t i_cut = cs_to_samples(segments.back().t0);
+            if (i_cut > 0 && i_cut < (int64_t) window.size()) {
+                n_final    = segments.size() - 1;
+                n_consumed = i_cut;
+            }
+        }
+
+        // the text context of the next window must end before the audio that is transcribed again, so the tokens of
+        // the dropped segment and everything after them are cut from prompt_past
+        // they are not there if the context was reset by a later chunk of the window, e.g. a short one at the end
+        if (n_final < segments.size() && !segments.back().tokens.empty()) {
+            auto & past = state->prompt_past;
+
+            std::vector<whisper_token> dropped;
+            for (const auto & token : segments.back().tokens) {
+                dropped.push_back(token.id);
+            }
+
+            const auto it = std::find_end(past.begin(), past.end(), dropped.begin(), dropped.end());
+            if (it != past.end()) {
+                past.erase(it, past.end());
+            }
+        }
+
+        const int64_t t_window = 100*i_window/WHISPER_SAMPLE_RATE + params.offset_ms/10;
+
+        const size_t n_before = result_all.size();
+        for (size_t i = 0; i < n_final; ++i) {
+            auto & segment = segments[i];
+
+            segment.t0 += t_window;
+            segment.t1 += t_window;
+            for (auto & token : segment.tokens) {
+                // -1 marks timestamps that have not been computed
+                if (token.t0 >= 0) {
+                    token.t0 += t_window;
+                    token.t1 += t_window;
+                }
+                if (token.t_dtw >= 0) {
+                    token.t_dtw += t_window;
+                }
+            }
+
+            // make sure that segments are not overlapping
+            if (!result_all.empty()) {
+                segment.t0 = std::max(segment.t0, result_all.back().t1);
+            }
+
+            result_all.push_back(std::move(segment));
+        }
+
+        if (params.new_segment_callback && result_all.size() > n_before) {
+            std::swap(state->result_all, result_all);
+            params.new_segment_callback(ctx, state, state->result_all.size() - n_before, params.new_segment_callback_user_data);
+            std::swap(state->result_all, result_all);
+        }
+
+        window.erase(window.begin(), window.begin() + n_consumed);
+        i_window += n_consumed;
+
+        if (is_last) {
+            break;
+        }
+    }
+
+    state->result_all = std::move(result_all);
+
+    if (ret_read < 0) {
+        WHISPER_LOG_ERROR("%s: failed to read audio (%d)\n", __func__, ret_read);
+        return -1;
     }
-    WHISPER_LOG_WARN("%s: the transcription quality may be degraded near these boundaries\n", __func__);
 
     return ret;
 }
 
+int whisper_full_from_reader(
+        struct whisper_context * ctx,
+    struct whisper_full_params   params,
+    whisper_audio_read_callback  read_callback,
+                          void * read_callback_user_data,
+                           int   n_window_ms) {
+    return whisper_full_from_reader_with_state(ctx, ctx->state, params, read_callback, read_callback_user_data, n_window_ms);
+}
+
+//
+// streaming with stable-prefix commits
+//
+
+struct whisper_stream {
+    whisper_context * ctx   = nullptr;
+    whisper_state   * state = nullptr;
+
+    whisper_stream_params params;
+
+    // audio that has not been dropped yet
+    std::vector<float> pcmf32;
+
+    // number of samples dropped from the start of the stream
+    int64_t n_samples_dropped = 0;
+
+    // all committed tokens, with timestamps relative to the start of the stream
+    std::vector<whisper_token_data> committed;
+
+    // number of committed tokens at the start of the window (their audio has not been dropped yet)
+    int n_committed_window = 0;
+
+    // uncommitted tail of the last hypothesis
+    std::vector<whisper_token_data> tentative;
+};
+
+struct whisper_stream_params whisper_stream_default_params(enum whisper_sampling_strategy strategy) {
+    struct whisper_stream_params result = {
+        /*.wparams                  =*/ whisper_full_default_params(strategy),
+        /*.max_window_ms            =*/ 20000,
+        /*.token_callback           =*/ nullptr,
+        /*.token_callback_user_data =*/ nullptr,
+    };
+
+    return result;
+}
+
+struct whisper_stream * whisper_stream_init(struct whisper_context * ctx, struct whisper_stream_params params) {
+    if (params.max_window_ms <= 0 || params.max_window_ms >= WHISPER_CHUNK_SIZE*1000) {
+        WHISPER_LOG_ERROR("%s: max_window_ms must be in (0, %d) ms\n", __func__, WHISPER_CHUNK_SIZE*1000);
+        return nullptr;
+    }
+
+    whisper_state * state = whisper_init_state(ctx);
+    if (state == nullptr) {
+        return nullptr;
+    }
+
+    whisper_stream * stream = new whisper_stream;
+
+    stream->ctx    = ctx;
+    stream->state  = state;
+    stream->params = params;
+
+    return stream;
+}
+
+int whisper_stream_push(struct whisper_stream * stream, const float * samples, int n_samples) {
+    stream->pcmf32.insert(stream->pcmf32.end(), samples, samples + n_samples);
+
+    return 0;
+}
+
+static int64_t whisper_stream_t_offset(const whisper_stream & stream) {
+    return (100ll*stream.n_samples_dropped)/WHISPER_SAMPLE_RATE;
+}
+
+static void whisper_stream_report(whisper_stream & stream, int n_new) {
+    if (stream.params.token_callback) {
+        stream.params.token_callback(stream.ctx,
+                stream.committed.data() + stream.committed.size() - n_new, n_new,
+                stream.tentative.data(), stream.tentative.size(),
+                stream.params.token_callback_user_data);
+    }
+}
+
+int whisper_stream_process(struct whisper_stream * stream) {
+    auto & s   = *stream;
+    auto * ctx = s.ctx;
+
+    // whisper_full() does not process less than 100 ms
+    if ((int) s.pcmf32.size() < WHISPER_SAMPLE_RATE/10) {
+        return 0;
+    }
+
+    whisper_full_params wparams = s.params.wparams;
+
+    wparams.no_context       = true;
+    wparams.single_segment   = true;
+    wparams.token_timestamps = true;
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+
+    wparams.new_segment_callback           = nullptr;
+    wparams.new_segment_callback_user_data = nullptr;
+
+    // the token times are relative to the window, which must not be filtered
+    wparams.vad = false;
+
+    // condition on the committed text that is no longer in the window
+    std::vector<whisper_token> prompt;
+    {
+        const int n_prev = (int) s.committed.size() - s.n_committed_window;
+        const int n_take = std::min(n_prev, whisper_n_text_ctx(ctx)/2);
+
+        for (int i = n_prev - n_take; i < n_prev; ++i) {
+            prompt.push_back(s.committed[i].id);
+        }
+    }
+
+    wparams.prompt_tokens   = prompt.empty() ? nullptr : prompt.data();
+    wparams.prompt_n_tokens = prompt.size();
+
+    if (whisper_full_with_state(ctx, s.state, wparams, s.pcmf32.data(), s.pcmf32.size()) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to process audio\n", __func__);
+        return -1;
+    }
+
+    // the text tokens of the hypothesis, with timestamps relative to the start of the window
+    std::vector<whisper_token_data> hyp;
+    for (const auto & segment : s.state->result_all) {
+        for (const auto & token : segment.tokens) {
+            if (token.id < whisper_token_eot(ctx)) {
+                hyp.push_back(token);
+            }
+        }
+    }
+
+    const int64_t t_offset = whisper_stream_t_offset(s);
+
+    // the first tokens of the hypothesis should be the committed tokens of the window. the window is
+    // re-transcribed from scratch, so the model can also word them differently - then the tokens of
+    // the audio that the committed tokens cover are skipped instead
+    const int n_cw = s.n_committed_window;
+    const int i_cw = (int) s.committed.size() - n_cw;
+
+    const bool aligned = n_cw <= (int) hyp.size() &&
+        std::equal(s.committed.begin() + i_cw, s.committed.end(), hyp.begin(),
+                [](const whisper_token_data & a, const whisper_token_data & b) { return a.id == b.id; });
+
+    int n_skip = 0;
+    if (aligned) {
+        n_skip = n_cw;
+    } else {
+        const int64_t t_end = s.committed.back().t1 - t_offset;
+        while (n_skip < (int) hyp.size() && (hyp[n_skip].t0 + hyp[n_skip].t1)/2 < t_end) {
+            n_skip++;
+        }
+    }
+
+    // LocalAgreement-2: commit the longest common prefix of the current and the previous hypothesis
+    int n_agree = 0;
+    while (n_skip + n_agree < (int) hyp.size() && n_agree < (int) s.tentative.size() &&
+           hyp[n_skip + n_agree].id == s.tentative[n_agree].id) {
+        n_agree++;
+    }
+
+    // do not let the window grow beyond the encoder context
+    const bool force = (int64_t) s.pcmf32.size()*1000 > (int64_t) s.params.max_window_ms*WHISPER_SAMPLE_RATE;
+    if (force) {
+        n_agree = hyp.size() - n_skip;
+    }
+
+    // drop the audio of the committed tokens - cut only at word boundaries
+    int n_cut = 0;
+    for (int i = n_skip + n_agree; i > 0; --i) {
+        if (i == (int) hyp.size() || whisper_token_to_str(ctx, hyp[i].id)[0] == ' ') {
+            n_cut = i;
+            break;
+        }
+    }
+
+    int n_samples_cut = n_cut > 0 ? std::min((int64_t) s.pcmf32.size(), (hyp[n_cut - 1].t1*WHISPER_SAMPLE_RATE)/100) : 0;
+
+    // the window is too long and nothing can be cut at a word boundary - drop all of it
+    if (force && n_samples_cut <= 0) {
+        n_cut         = hyp.size();
+        n_samples_cut = s.pcmf32.size();
+    }
+
+    // report the new tokens with timestamps relative to the start of the stream
+    for (int i = n_skip; i < (int) hyp.size(); ++i) {
+        hyp[i].t0 += t_offset;
+        hyp[i].t1 += t_offset;
+    }
+
+    s.committed.insert(s.committed.end(), hyp.begin() + n_skip, hyp.begin() + n_skip + n_agree);
+    s.tentative.assign(hyp.begin() + n_skip + n_agree, hyp.end());
+
+    s.n_committed_window = n_cw + n_agree;
+
+    whisper_stream_report(s, n_agree);
+
+    if (n_samples_cut > 0) {
+        // the committed tokens whose audio is dropped
+        int n_dropped = n_cut;
+        if (!aligned) {
+            if (n_cut >= n_skip) {
+                n_dropped = n_cw + n_cut - n_skip;
+            } else {
+                const int64_t t_cut = t_offset + (100ll*n_samples_cut)/WHISPER_SAMPLE_RATE;
+
+                n_dropped = 0;
+                while (n_dropped < n_cw && s.committed[i_cw + n_dropped].t1 <= t_cut) {
+                    n_dropped++;
+                }
+            }
+        }
+
+        s.pcmf32.erase(s.pcmf32.begin(), s.pcmf32.begin() + n_samples_cut);
+        s.n_samples_dropped  += n_samples_cut;
+        s.n_committed_window -= n_dropped;
+    }
+
+    return n_agree;
+}
+
+int whisper_stream_flush(struct whisper_stream * stream) {
+    auto & s = *stream;
+
+    const int n_new = s.tentative.size();
+
+    s.committed.insert(s.committed.end(), s.tentative.begin(), s.tentative.end());
+    s.tentative.clear();
+
+    s.n_samples_dropped += s.pcmf32.size();
+    s.pcmf32.clear();
+    s.n_committed_window = 0;
+
+    whisper_stream_report(s, n_new);
+
+    return n_new;
+}
+
+int whisper_stream_n_window_samples(struct whisper_stream * stream) {
+    return stream->pcmf32.size();
+}
+
+void whisper_stream_free(struct whisper_stream * stream) {
+    if (stream) {
+        whisper_free_state(stream->state);
+
+        delete stream;
+    }
+}
+
 int whisper_full_n_segments_from_state(struct whisper_state * state) {
     return state->result_all.size();
 }
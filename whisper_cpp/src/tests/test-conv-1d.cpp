@@ -0,0 +1,145 @@
+// compares the direct GGML_OP_CONV_1D with the im2col path it replaces in the encoder:
+// gelu(conv_1d_ph(a, b) + c) and conv_1d_ph(a, b)
+// the im2col path only takes F16 kernels, F32 kernels are compared with a plain loop instead
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+static void fill(struct ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    const int64_t n = ggml_nelements(t);
+    if (t->type == GGML_TYPE_F16) {
+        ggml_fp16_t * data = (ggml_fp16_t *) t->data;
+        for (int64_t i = 0; i < n; ++i) {
+            data[i] = ggml_fp32_to_fp16(dist(rng));
+        }
+    } else {
+        float * data = (float *) t->data;
+        for (int64_t i = 0; i < n; ++i) {
+            data[i] = dist(rng);
+        }
+    }
+}
+
+// relative to the magnitude of b, absolute below 1
+static float max_diff(const struct ggml_tensor * a, const struct ggml_tensor * b) {
+    assert(ggml_nelements(a) == ggml_nelements(b));
+
+    float res = 0.0f;
+    for (int64_t i = 0; i < ggml_nelements(a); ++i) {
+        const float va = ((const float *) a->data)[i];
+        const float vb = ((const float *) b->data)[i];
+        res = std::max(res, std::fabs(va - vb)/std::max(1.0f, std::fabs(vb)));
+    }
+    return res;
+}
+
+// conv_1d_ph of an F32 kernel
+static void conv_1d_ref(const struct ggml_tensor * a, const struct ggml_tensor * b, int s, struct ggml_tensor * dst) {
+    const int64_t K  = a->ne[0];
+    const int64_t IC = a->ne[1];
+    const int64_t L  = b->ne[0];
+    const int64_t p  = K/2;
+
+    for (int64_t oc = 0; oc < dst->ne[1]; ++oc) {
+        for (int64_t x = 0; x < dst->ne[0]; ++x) {
+            double sum = 0.0;
+            for (int64_t ic = 0; ic < IC; ++ic) {
+                for (int64_t kx = 0; kx < K; ++kx) {
+                    const int64_t sx = x*s + kx - p;
+                    if (sx >= 0 && sx < L) {
+                        sum += (double) ((const float *) a->data)[(oc*IC + ic)*K + kx] * ((const float *) b->data)[ic*L + sx];
+                    }
+                }
+            }
+
+            ((float *) dst->data)[oc*dst->ne[0] + x] = sum;
+        }
+    }
+}
+
+static void test_conv_1d(ggml_type type, int64_t K, int64_t IC, int64_t OC, int64_t L, int s, int n_threads) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 256*1024*1024,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    struct ggml_tensor * a = ggml_new_tensor_3d(ctx, type, K, IC, OC);
+    struct ggml_tensor * b = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, L, IC);
+    struct ggml_tensor * c = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 1, OC);
+    fill(a, rng);
+    fill(b, rng);
+    fill(c, rng);
+
+    struct ggml_tensor * fused  = ggml_conv_1d_direct_bias_gelu(ctx, a, b, c, s, K/2, 1);
+    struct ggml_tensor * direct = ggml_conv_1d_direct(ctx, a, b, s, K/2, 1);
+
+    struct ggml_tensor * ref        = nullptr;
+    struct ggml_tensor * direct_ref = nullptr;
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, fused);
+    ggml_build_forward_expand(gf, direct);
+
+    if (type == GGML_TYPE_F16) {
+        direct_ref = ggml_conv_1d_ph(ctx, a, b, s, 1);
+    } else {
+        direct_ref = ggml_dup_tensor(ctx, direct);
+        conv_1d_ref(a, b, s, direct_ref);
+    }
+    ref = ggml_gelu(ctx, ggml_add(ctx, direct_ref, c));
+
+    ggml_build_forward_expand(gf, ref);
+
+    assert(ggml_graph_compute_with_ctx(ctx, gf, n_threads) == GGML_STATUS_SUCCESS);
+
+    assert(fused->ne[0] == ref->ne[0] && fused->ne[1] == ref->ne[1]);
+    assert(direct->ne[0] == direct_ref->ne[0] && direct->ne[1] == direct_ref->ne[1]);
+
+    const float err_fused  = max_diff(fused,  ref);
+    const float err_direct = max_diff(direct, direct_ref);
+
+    printf("%s: %s K = %2lld, IC = %3lld, OC = %3lld, L = %4lld, s = %d, threads = %d: max diff = %g (fused), %g (direct)\n",
+            __func__, ggml_type_name(type), (long long) K, (long long) IC, (long long) OC, (long long) L, s, n_threads,
+            err_fused, err_direct);
+
+    // for F16 both paths use the same patches and dot products, for F32 only the order of the sums differs. the
+    // GELU of the CPU backend goes through an F16 table, so a difference in the last bits of its input can move the
+    // result by one F16 step
+    assert(err_direct < 1e-5f);
+    assert(err_fused  < (type == GGML_TYPE_F16 ? 1e-5f : 2e-3f));
+
+    ggml_free(ctx);
+}
+
+int main() {
+    for (ggml_type type : { GGML_TYPE_F16, GGML_TYPE_F32 }) {
+        for (int s : { 1, 2 }) {
+            // the encoder convolutions, with a short odd input
+            test_conv_1d(type, 3,  80, 64,  301, s, 1);
+            test_conv_1d(type, 3,  64, 64,  301, s, 4);
+
+            // odd lengths and kernel sizes, fewer output positions than threads and tiles
+            test_conv_1d(type, 5,   7, 13,   17, s, 3);
+            test_conv_1d(type, 1,   3,  5,    1, s, 2);
+            test_conv_1d(type, 3,  16,  8, 1001, s, 4);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+// compares the tiled FLASH_ATTN_EXT kernel of the CPU backend (F16 K/V, at least GGML_FA_TILE_Q query rows) with the
+// per-row kernel, by computing every query row on its own, and with a double precision reference
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+static void fill(struct ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    const int64_t n = ggml_nelements(t);
+    if (t->type == GGML_TYPE_F16) {
+        ggml_fp16_t * data = (ggml_fp16_t *) t->data;
+        for (int64_t i = 0; i < n; ++i) {
+            data[i] = ggml_fp32_to_fp16(dist(rng));
+        }
+    } else {
+        float * data = (float *) t->data;
+        for (int64_t i = 0; i < n; ++i) {
+            data[i] = dist(rng);
+        }
+    }
+}
+
+static float get_f16(const struct ggml_tensor * t, int64_t i) {
+    return ggml_fp16_to_fp32(((const ggml_fp16_t *) t->data)[i]);
+}
+
+static void test_flash_attn(int64_t D, int64_t n_q, int64_t n_kv, int64_t n_head, int64_t n_head_kv, bool masked, int n_threads) {
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ 256*1024*1024,
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+    struct ggml_context * ctx = ggml_init(params);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    const float scale = 1.0f/std::sqrt((float) D);
+
+    struct ggml_tensor * q = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, D, n_q,  n_head,    1);
+    struct ggml_tensor * k = ggml_new_tensor_4d(ctx, GGML_TYPE_F16, D, n_kv, n_head_kv, 1);
+    struct ggml_tensor * v = ggml_new_tensor_4d(ctx, GGML_TYPE_F16, D, n_kv, n_head_kv, 1);
+    fill(q, rng);
+    fill(k, rng);
+    fill(v, rng);
+
+    // causal, aligned to the end of K/V if it is longer, so that the first query blocks skip whole K/V tiles and
+    // every row sees at least one K/V row
+    struct ggml_tensor * mask = nullptr;
+    if (masked) {
+        mask = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_kv, GGML_PAD(n_q, GGML_KQ_MASK_PAD));
+        for (int64_t i = 0; i < mask->ne[1]; ++i) {
+            for (int64_t j = 0; j < n_kv; ++j) {
+                const bool visible = i >= n_q || j <= i + std::max<int64_t>(0, n_kv - n_q);
+                ((ggml_fp16_t *) mask->data)[i*n_kv + j] = ggml_fp32_to_fp16(visible ? 0.0f : -INFINITY);
+            }
+        }
+    }
+
+    struct ggml_tensor * tiled = ggml_flash_attn_ext(ctx, q, k, v, mask, scale, 0.0f, 0.0f);
+
+    struct ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, tiled);
+
+    // the same attention one query row at a time goes through the per-row kernel
+    std::vector<struct ggml_tensor *> rows(n_q);
+    for (int64_t i = 0; i < n_q; ++i) {
+        struct ggml_tensor * q_i = ggml_new_tensor_4d(ctx, GGML_TYPE_F32, D, 1, n_head, 1);
+        for (int64_t h = 0; h < n_head; ++h) {
+            memcpy((char *) q_i->data + h*q_i->nb[2], (const char *) q->data + i*q->nb[1] + h*q->nb[2], D*sizeof(float));
+        }
+
+        struct ggml_tensor * mask_i = nullptr;
+        if (mask) {
+            mask_i = ggml_new_tensor_2d(ctx, GGML_TYPE_F16, n_kv, GGML_KQ_MASK_PAD);
+            memset(mask_i->data, 0, ggml_nbytes(mask_i));
+            memcpy(mask_i->data, (const char *) mask->data + i*mask->nb[1], n_kv*sizeof(ggml_fp16_t));
+        }
+
+        rows[i] = ggml_flash_attn_ext(ctx, q_i, k, v, mask_i, scale, 0.0f, 0.0f);
+        ggml_build_forward_expand(gf, rows[i]);
+    }
+
+    assert(ggml_graph_compute_with_ctx(ctx, gf, n_threads) == GGML_STATUS_SUCCESS);
+
+    // result: [D, n_head, n_q]
+    double err_rows = 0.0;
+    double err_ref  = 0.0;
+    double err_row_ref = 0.0;
+
+    std::vector<double> p(n_kv);
+    for (int64_t i = 0; i < n_q; ++i) {
+        for (int64_t h = 0; h < n_head; ++h) {
+            const int64_t h_kv = h / (n_head / n_head_kv);
+
+            const float * q_row = (const float *) ((const char *) q->data + i*q->nb[1] + h*q->nb[2]);
+
+            double m = -INFINITY;
+            for (int64_t j = 0; j < n_kv; ++j) {
+                double s = 0.0;
+                for (int64_t d = 0; d < D; ++d) {
+                    s += (double) q_row[d] * get_f16(k, (h_kv*n_kv + j)*D + d);
+                }
+                s *= scale;
+                if (mask) {
+                    s += get_f16(mask, i*n_kv + j);
+                }
+                p[j] = s;
+                m = std::max(m, s);
+            }
+
+            double sum = 0.0;
+            for (int64_t j = 0; j < n_kv; ++j) {
+                p[j] = std::exp(p[j] - m);
+                sum += p[j];
+            }
+
+            for (int64_t d = 0; d < D; ++d) {
+                double ref = 0.0;
+                for (int64_t j = 0; j < n_kv; ++j) {
+                    ref += p[j] * get_f16(v, (h_kv*n_kv + j)*D + d);
+                }
+                ref /= sum;
+
+                const float val_tiled = ((const float *) tiled->data)[(i*n_head + h)*D + d];
+                const float val_row   = ((const float *) rows[i]->data)[h*D + d];
+
+                assert(std::isfinite(val_tiled) && std::isfinite(val_row));
+
+                err_rows    = std::max(err_rows,    (double) std::fabs(val_tiled - val_row));
+                err_ref     = std::max(err_ref,     std::fabs(val_tiled - ref));
+                err_row_ref = std::max(err_row_ref, std::fabs(val_row   - ref));
+            }
+        }
+    }
+
+    printf("%s: D = %3lld, n_q = %3lld, n_kv = %3lld, n_head = %lld/%lld, mask = %d, threads = %d: "
+            "max diff = %.2e (per-row kernel), %.2e (reference), per-row kernel vs reference = %.2e\n",
+            __func__, (long long) D, (long long) n_q, (long long) n_kv, (long long) n_head, (long long) n_head_kv,
+            masked, n_threads, err_rows, err_ref, err_row_ref);
+
+    // the tiled kernel keeps Q and the accumulators in F32, the per-row kernel rounds Q to F16 and, for F16 V,
+    // accumulates in F16, so the per-row kernel is the less accurate of the two
+    assert(err_ref  < 1e-5);
+    assert(err_rows < 2e-3);
+
+    ggml_free(ctx);
+}
+
+int main() {
+    for (bool masked : { false, true }) {
+        // the encoder self-attention shape, scaled down
+        test_flash_attn(64,  64, 128, 4, 4, masked, 1);
+        test_flash_attn(64,  64, 128, 4, 4, masked, 4);
+
+        // head sizes that are not a multiple of the SIMD blocks of the micro-kernel
+        test_flash_attn(40,  45, 100, 3, 3, masked, 2);
+        test_flash_attn(20,  33,  77, 2, 2, masked, 3);
+        test_flash_attn(80,  70, 150, 2, 2, masked, 4);
+
+        // K/V lengths below one tile and just above a tile boundary, GQA broadcast
+        test_flash_attn(64,  32,  17, 4, 2, masked, 2);
+        test_flash_attn(64,  96,  65, 4, 1, masked, 4);
+    }
+
+    return 0;
+}